@@ -0,0 +1,151 @@
+// Host benchmark for the memory functions (my_efilib/my_string.c).
+// Compares them with a byte loop, like gnu-efi's CopyMem and SetMem,
+// and with the C library, for sizes from 16 bytes to 32 MiB. The
+// functions are checked against the byte loops first, also for
+// overlapping areas and unaligned addresses.
+//
+// Usage: bench_mem [MiB per measurement]
+
+#include "../my_efilib/my_string.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NO_LIBCALL __attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+#define MAX_SIZE (32 << 20)
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static NO_LIBCALL void *byte_memmove(void *dest, const void *src, size_t n) {
+	unsigned char *d = dest;
+	const unsigned char *s = src;
+	if (d > s && d < s + n) {
+		for (d += n, s += n; n--;) {
+			*--d = *--s;
+		}
+	} else {
+		while (n--) {
+			*d++ = *s++;
+		}
+	}
+	return dest;
+}
+
+static NO_LIBCALL void *byte_memset(void *s, int c, size_t n) {
+	unsigned char *d = s;
+	while (n--) {
+		*d++ = c;
+	}
+	return s;
+}
+
+static NO_LIBCALL int byte_memcmp(const void *cs, const void *ct, size_t n) {
+	const unsigned char *a = cs, *b = ct;
+	for (; n; --n, ++a, ++b) {
+		if (*a != *b) {
+			return *a - *b;
+		}
+	}
+	return 0;
+}
+
+static int sign(int x) {
+	return (x > 0) - (x < 0);
+}
+
+static int check(void) {
+	enum { N = 8192 };
+	static unsigned char buf[3][2 * N];
+	int errors = 0;
+	srand(1);
+	for (int i = 0; i < 200000; ++i) {
+		size_t n = rand() % 4 ? rand() % 300 : rand() % N;
+		size_t so = rand() % N, dof = rand() % N;
+		int c = rand();
+		for (size_t j = 0; j < 2 * N; ++j) {
+			buf[0][j] = buf[1][j] = rand();
+		}
+		// Overlapping moves within one buffer.
+		byte_memmove(buf[0] + dof, buf[0] + so, n);
+		my_memmove(buf[1] + dof, buf[1] + so, n);
+		errors += memcmp(buf[0], buf[1], 2 * N) != 0;
+		// Copies between buffers.
+		my_memcpy(buf[2] + dof, buf[0] + so, n);
+		errors += memcmp(buf[2] + dof, buf[0] + so, n) != 0;
+		byte_memset(buf[0] + dof, c, n);
+		my_memset(buf[1] + dof, c, n);
+		errors += memcmp(buf[0], buf[1], 2 * N) != 0;
+		// A difference at a random place, or none.
+		my_memcpy(buf[2], buf[1], 2 * N);
+		if (n && rand() % 2) {
+			buf[2][so + rand() % n] ^= 1 << rand() % 8;
+		}
+		errors += sign(my_memcmp(buf[1] + so, buf[2] + so, n)) != sign(byte_memcmp(buf[1] + so, buf[2] + so, n));
+		errors += sign(my_memcmp(buf[2] + so, buf[1] + so, n)) != sign(byte_memcmp(buf[2] + so, buf[1] + so, n));
+	}
+	return errors;
+}
+
+typedef void bench_t(unsigned char *dst, const unsigned char *src, size_t n);
+
+static void copy_byte(unsigned char *d, const unsigned char *s, size_t n) { byte_memmove(d, s, n); }
+static void copy_libc(unsigned char *d, const unsigned char *s, size_t n) { memcpy(d, s, n); }
+static void copy_my(unsigned char *d, const unsigned char *s, size_t n) { my_memcpy(d, s, n); }
+static void set_byte(unsigned char *d, const unsigned char *s, size_t n) { byte_memset(d, s[0], n); }
+static void set_libc(unsigned char *d, const unsigned char *s, size_t n) { memset(d, s[0], n); }
+static void set_my(unsigned char *d, const unsigned char *s, size_t n) { my_memset(d, s[0], n); }
+static volatile int result;
+static void cmp_byte(unsigned char *d, const unsigned char *s, size_t n) { result = byte_memcmp(d, s, n); }
+static void cmp_libc(unsigned char *d, const unsigned char *s, size_t n) { result = memcmp(d, s, n); }
+static void cmp_my(unsigned char *d, const unsigned char *s, size_t n) { result = my_memcmp(d, s, n); }
+
+static bench_t *const benches[] = {
+	copy_byte, copy_libc, copy_my,
+	set_byte, set_libc, set_my,
+	cmp_byte, cmp_libc, cmp_my,
+};
+
+int main(int argc, char** argv) {
+	double mib = argc > 1 ? atof(argv[1]) : 256;
+
+	int errors = check();
+	if (errors) {
+		printf("ERROR: %d mismatches against the byte loops.\n", errors);
+		return 1;
+	}
+
+	unsigned char* src = aligned_alloc(64, MAX_SIZE);
+	unsigned char* dst = aligned_alloc(64, MAX_SIZE);
+	if (!src || !dst) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	memset(src, 0x5a, MAX_SIZE);
+	memset(dst, 0x5a, MAX_SIZE);
+
+	printf("GB/s, %.0f MiB per measurement\n", mib);
+	printf("%9s | %7s %7s %7s | %7s %7s %7s | %7s %7s %7s\n", "size",
+		"cpy byt", "libc", "my", "set byt", "libc", "my", "cmp byt", "libc", "my");
+	for (size_t n = 16; n <= MAX_SIZE; n *= 2) {
+		size_t iterations = (size_t) (mib * (1 << 20) / n);
+		iterations = iterations ? iterations : 1;
+		printf("%9zu |", n);
+		for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b) {
+			double t0 = now();
+			for (size_t i = 0; i < iterations; ++i) {
+				benches[b](dst, src, n);
+			}
+			double t = now() - t0;
+			printf(" %7.2f%s", n * iterations / t / 1e9, b % 3 == 2 && b + 1 < sizeof(benches) / sizeof(benches[0]) ? " |" : "");
+		}
+		printf("\n");
+	}
+	return 0;
+}
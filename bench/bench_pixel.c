@@ -0,0 +1,109 @@
+// Host benchmark for the pixel row conversion kernels (src/pixel.c).
+// Compares the 24-bit BGR and the 32-bit BGRX output modes, and the SIMD
+// kernels that this CPU supports with the C kernels.
+//
+// Usage: bench_pixel [width] [height] [iterations]
+
+#include "../src/pixel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static size_t stride(size_t w, int bpp) {
+	return ((w * bpp + 31) / 32) * 4;
+}
+
+static const struct {
+	const char* name;
+	enum HackBGRT_pixel_format format;
+	int bytes;
+} formats[] = {
+	{"RGB8", PIXEL_RGB8, 3},
+	{"RGBA8", PIXEL_RGBA8, 4},
+	{"RGB16", PIXEL_RGB16, 6},
+	{"GRAY8", PIXEL_GRAY8, 1},
+	{"BGR8", PIXEL_BGR8, 3},
+};
+
+int main(int argc, char** argv) {
+	size_t w = argc > 1 ? atoi(argv[1]) : 1920;
+	size_t h = argc > 2 ? atoi(argv[2]) : 1080;
+	int iterations = argc > 3 ? atoi(argv[3]) : 20;
+
+	uint8_t* src = malloc(w * h * 6);
+	uint8_t* out24 = aligned_alloc(64, (stride(w, 24) * h + 63) / 64 * 64);
+	uint8_t* out32 = aligned_alloc(64, stride(w, 32) * h);
+	if (!src || !out24 || !out32) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	srand(1);
+	for (size_t i = 0; i < w * h * 6; ++i) {
+		src[i] = rand();
+	}
+
+	uint8_t* ref = aligned_alloc(64, stride(w, 32) * h);
+	if (!ref) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	enum CpuLevel cpu = CpuDetect();
+	printf("%zux%zu, %d iterations, CPU %s\n", w, h, iterations, CpuLevelName(cpu));
+	printf("%-8s %4s %-8s %10s %10s %12s\n", "format", "bpp", "kernels", "Mpixel/s", "MB/s out", "output bytes");
+	int errors = 0, simd_errors = 0;
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+		for (int bpp = 24; bpp <= 32; bpp += 8) {
+			uint8_t* out = bpp == 32 ? out32 : out24;
+			size_t out_size = stride(w, bpp) * h;
+			// Every kernel level the CPU has, starting with plain C as the reference.
+			pixel_row_t* done = 0;
+			for (enum CpuLevel level = CPU_GENERIC; level <= cpu; ++level) {
+				enum CpuLevel used = PixelSetCpuLevel(level);
+				pixel_row_t* convert = PixelRowFunction(formats[f].format, bpp);
+				if (convert == done) {
+					continue;
+				}
+				done = convert;
+				memset(out, 0xcc, out_size);
+				double t0 = now();
+				for (int i = 0; i < iterations; ++i) {
+					for (size_t y = 0; y < h; ++y) {
+						convert(out + y * stride(w, bpp), src + y * w * formats[f].bytes, w);
+					}
+				}
+				double t = (now() - t0) / iterations;
+				printf("%-8s %4d %-8s %10.1f %10.1f %12zu\n", formats[f].name, bpp, CpuLevelName(used), w * h / t / 1e6, out_size / t / 1e6, out_size + 54);
+				if (used == CPU_GENERIC) {
+					memcpy(ref, out, out_size);
+				} else if (memcmp(ref, out, out_size) != 0) {
+					++simd_errors;
+					printf("ERROR: %s kernel output differs from C.\n", CpuLevelName(used));
+				}
+			}
+		}
+		// Both modes must produce the same colors.
+		for (size_t y = 0; y < h; ++y) {
+			for (size_t x = 0; x < w; ++x) {
+				if (memcmp(out24 + y * stride(w, 24) + x * 3, out32 + y * stride(w, 32) + x * 4, 3) != 0) {
+					++errors;
+				}
+			}
+		}
+	}
+	if (errors) {
+		printf("ERROR: %d pixels differ between 24-bit and 32-bit output.\n", errors);
+		return 1;
+	}
+	if (simd_errors) {
+		return 1;
+	}
+	return 0;
+}
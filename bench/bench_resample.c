@@ -0,0 +1,141 @@
+// Host benchmark for the resampling kernels (src/resample.c).
+// Scales random images down with the box filter and up with the bilinear
+// filter, like the writer, and compares the SIMD kernels that this CPU
+// supports with the C kernels. The horizontal and vertical passes are
+// timed separately.
+//
+// Usage: bench_resample [iterations]
+
+#include "../src/resample.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ONE (1 << RESAMPLE_WEIGHT_BITS)
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static const struct {
+	size_t src_w, src_h, dst_w, dst_h;
+} sizes[] = {
+	{1920, 1080, 1280, 720},
+	{4000, 3000, 1920, 1080},
+	{800, 600, 1920, 1080},
+	{333, 77, 1000, 1001},
+};
+
+// The same taps as ComputeTaps in writer.c, for a whole axis.
+static uint32_t Taps(size_t src, size_t dst, uint32_t** first, uint16_t** weights) {
+	uint32_t taps = dst < src ? (src + dst - 1) / dst + 1 : 2;
+	*first = calloc(dst, sizeof(**first));
+	*weights = calloc(dst * taps, sizeof(**weights));
+	for (size_t i = 0; i < dst; ++i) {
+		uint16_t* w = *weights + i * taps;
+		if (dst <= src) {
+			uint64_t start = i * src, end = start + src;
+			uint32_t j = start / dst, k = 0, sum = 0;
+			(*first)[i] = j;
+			for (; (uint64_t) j * dst < end && k < taps; ++j, ++k) {
+				uint64_t lo = (uint64_t) j * dst, hi = lo + dst;
+				lo = lo > start ? lo : start;
+				hi = hi < end ? hi : end;
+				w[k] = (hi - lo) * ONE / src;
+				sum += w[k];
+			}
+			w[k - 1] += ONE - sum;
+		} else {
+			int64_t s = (int64_t) (((2 * i + 1) * src << 16) / (2 * dst)) - 0x8000;
+			s = s < 0 ? 0 : s;
+			uint32_t j = s >> 16, f = (s & 0xffff) >> (16 - RESAMPLE_WEIGHT_BITS);
+			if (j >= src - 1) {
+				j = src - 1;
+				f = 0;
+			}
+			(*first)[i] = j;
+			w[0] = ONE - f;
+			w[1] = f;
+		}
+	}
+	return taps;
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 5;
+	enum CpuLevel cpu = CpuDetect();
+	printf("%d iterations, CPU %s\n", iterations, CpuLevelName(cpu));
+	printf("%-21s %5s %-8s %12s %12s\n", "size", "bytes", "kernels", "horiz. ms", "vert. ms");
+	int errors = 0;
+	for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); ++z) {
+		const size_t src_w = sizes[z].src_w, src_h = sizes[z].src_h;
+		const size_t dst_w = sizes[z].dst_w, dst_h = sizes[z].dst_h;
+		uint32_t *h_first, *v_first;
+		uint16_t *h_weights, *v_weights;
+		uint32_t h_taps = Taps(src_w, dst_w, &h_first, &h_weights);
+		uint32_t v_taps = Taps(src_h, dst_h, &v_first, &v_weights);
+		uint8_t* src = malloc(src_w * src_h * 4);
+		uint16_t* rows = malloc(src_h * dst_w * 3 * sizeof(*rows));
+		uint16_t* ref_rows = malloc(src_h * dst_w * 3 * sizeof(*rows));
+		uint8_t* out = malloc(dst_h * dst_w * 3);
+		uint8_t* ref = malloc(dst_h * dst_w * 3);
+		if (!h_first || !v_first || !h_weights || !v_weights || !src || !rows || !ref_rows || !out || !ref) {
+			fprintf(stderr, "Out of memory.\n");
+			return 1;
+		}
+		srand(1);
+		for (size_t i = 0; i < src_w * src_h * 4; ++i) {
+			src[i] = rand();
+		}
+		// Fault the pages in before the first measurement.
+		memset(rows, 0, src_h * dst_w * 3 * sizeof(*rows));
+		memset(out, 0, dst_h * dst_w * 3);
+		for (size_t bytes = 3; bytes <= 4; ++bytes) {
+			for (enum CpuLevel level = CPU_GENERIC; level <= cpu; ++level) {
+				enum CpuLevel used = ResampleSetCpuLevel(level);
+				if (used != level) {
+					continue;
+				}
+				// All source rows are kept, so the ring is the whole image.
+				double t0 = now();
+				for (int i = 0; i < iterations; ++i) {
+					for (size_t y = 0; y < src_h; ++y) {
+						ResampleHorizontal(rows + y * dst_w * 3, src + y * src_w * bytes, bytes, src_w, h_first, h_weights, h_taps, dst_w);
+					}
+				}
+				double t1 = now();
+				for (int i = 0; i < iterations; ++i) {
+					for (size_t y = 0; y < dst_h; ++y) {
+						uint32_t n = v_taps < src_h - v_first[y] ? v_taps : src_h - v_first[y];
+						ResampleVertical(out + y * dst_w * 3, rows, src_h, v_first[y], v_weights + y * v_taps, n, dst_w * 3);
+					}
+				}
+				double t2 = now();
+				char size[32];
+				snprintf(size, sizeof(size), "%zux%zu->%zux%zu", src_w, src_h, dst_w, dst_h);
+				printf("%-21s %5zu %-8s %12.2f %12.2f\n", size, bytes, CpuLevelName(used), (t1 - t0) / iterations * 1e3, (t2 - t1) / iterations * 1e3);
+				if (used == CPU_GENERIC) {
+					memcpy(ref_rows, rows, src_h * dst_w * 3 * sizeof(*rows));
+					memcpy(ref, out, dst_h * dst_w * 3);
+				} else if (memcmp(ref_rows, rows, src_h * dst_w * 3 * sizeof(*rows)) != 0 || memcmp(ref, out, dst_h * dst_w * 3) != 0) {
+					++errors;
+					printf("ERROR: %s kernel output differs from C.\n", CpuLevelName(used));
+				}
+			}
+		}
+		free(h_first);
+		free(v_first);
+		free(h_weights);
+		free(v_weights);
+		free(src);
+		free(rows);
+		free(ref_rows);
+		free(out);
+		free(ref);
+	}
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+// Host benchmark for lossless WebP (webp/vp8l.c) against PNG (upng/upng.c).
+// Measures the time to read and decode each file, the same work as
+// LoadWebP and LoadPNG do; give the same images in both formats to
+// compare them.
+//
+// Usage: bench_webp [-n iterations] file.png|file.webp ...
+
+#include "../webp/vp8l.h"
+#include "../upng/upng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void* read_file(const char* path, size_t* size) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	rewind(f);
+	void* data = malloc(*size);
+	if (data && fread(data, 1, *size, f) != *size) {
+		free(data);
+		data = 0;
+	}
+	fclose(f);
+	return data;
+}
+
+// Decode all rows; returns the image size in pixels, or 0 on failure.
+static size_t decode_webp(const void* data, size_t size) {
+	vp8l_decoder* dec = vp8l_new_from_bytes(data, size);
+	if (!dec) {
+		return 0;
+	}
+	size_t pixels = (size_t) vp8l_get_width(dec) * vp8l_get_height(dec);
+	for (unsigned y = 0; y < vp8l_get_height(dec); ++y) {
+		if (!vp8l_next_row(dec)) {
+			pixels = 0;
+			break;
+		}
+	}
+	vp8l_free(dec);
+	return pixels;
+}
+
+static size_t decode_png(const void* data, size_t size) {
+	upng_t* upng = upng_new_from_bytes((const unsigned char*) data, size);
+	if (!upng) {
+		return 0;
+	}
+	size_t pixels = 0;
+	if (upng_decode(upng) == UPNG_EOK) {
+		pixels = (size_t) upng_get_width(upng) * upng_get_height(upng);
+	}
+	upng_free(upng);
+	return pixels;
+}
+
+int main(int argc, char** argv) {
+	int iterations = 20;
+	int i = 1;
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		iterations = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc || iterations < 1) {
+		fprintf(stderr, "Usage: %s [-n iterations] file.png|file.webp ...\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-32s %10s %10s %10s %10s %10s\n", "file", "bytes", "pixels", "read ms", "decode ms", "MP/s");
+	for (; i < argc; ++i) {
+		const char* ext = strrchr(argv[i], '.');
+		int is_webp = ext && strcmp(ext, ".webp") == 0;
+		double read_time = 0, decode_time = 0;
+		size_t size = 0, pixels = 0;
+		for (int n = 0; n < iterations; ++n) {
+			double t0 = now();
+			void* data = read_file(argv[i], &size);
+			double t1 = now();
+			pixels = data ? (is_webp ? decode_webp(data, size) : decode_png(data, size)) : 0;
+			double t2 = now();
+			free(data);
+			if (!pixels) {
+				break;
+			}
+			read_time += t1 - t0;
+			decode_time += t2 - t1;
+		}
+		if (!pixels) {
+			printf("%-32s failed\n", argv[i]);
+			continue;
+		}
+		printf("%-32s %10zu %10zu %10.3f %10.3f %10.1f\n", argv[i], size, pixels,
+			read_time * 1e3 / iterations, decode_time * 1e3 / iterations,
+			pixels * iterations / decode_time / 1e6);
+	}
+	return 0;
+}
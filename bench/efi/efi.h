@@ -0,0 +1,2 @@
+// Stand-in for the gnu-efi header, so that the decoders that include
+// my_efilib.h (upng, webp) can be built on the host with the C library.
@@ -5,44 +5,205 @@
 
 // #include <stdlib.h>
 // Memory Allocation
+// malloc takes memory from an arena: blocks of pages from AllocatePages,
+// handed out with a bump pointer in 64-byte steps. Each allocation has a
+// header with its size, so realloc copies only what is needed and can
+// grow the last allocation in place. free returns memory only at the tip;
+// the rest is returned in one go with arena_release or arena_free_all.
+// This keeps the many small decoder allocations away from the firmware
+// pool. Only the boot processor may allocate.
+
+#define ARENA_ALIGN 64
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena_block {
+	struct arena_block *prev;
+	size_t size; // block size in bytes, whole pages
+	size_t used; // bytes used, including the header
+	size_t floor; // the last mark; the tip doesn't move below it
+};
+
+struct arena_header {
+	size_t size; // requested size
+	size_t space; // reserved bytes after the header, a multiple of ARENA_ALIGN
+	size_t freed;
+};
+
+// The headers are padded so that the data stays aligned.
+#define ARENA_BLOCK_HEADER ARENA_ROUND(sizeof(struct arena_block))
+#define ARENA_HEADER ARENA_ROUND(sizeof(struct arena_header))
+
+static struct arena_block *arena_top;
+static arena_stats stats;
+
+static struct arena_header *header_of(void *ptr) {
+	return (struct arena_header *)((unsigned char *) ptr - ARENA_HEADER);
+}
+
+// Check whether an allocation is the last one in the arena and
+// was made after the last mark, so that it may be resized in place.
+static int is_tip(struct arena_header *header) {
+	unsigned char *base = (unsigned char *) arena_top;
+	return arena_top && (unsigned char *) header >= base + arena_top->floor
+		&& (unsigned char *) header + ARENA_HEADER + header->space == base + arena_top->used;
+}
+
+static void count_bytes(size_t old_size, size_t new_size) {
+	stats.current = stats.current - old_size + new_size;
+	if (stats.current > stats.peak) {
+		stats.peak = stats.current;
+	}
+}
+
+static void *arena_alloc(size_t size) {
+	if (size > (size_t)-1 - ARENA_BLOCK_SIZE) {
+		return NULL;
+	}
+	size_t space = ARENA_ROUND(size);
+	if (!arena_top || arena_top->size - arena_top->used < ARENA_HEADER + space) {
+		size_t bytes = ARENA_BLOCK_HEADER + ARENA_HEADER + space;
+		bytes = bytes > ARENA_BLOCK_SIZE ? bytes : ARENA_BLOCK_SIZE;
+		UINTN pages = EFI_SIZE_TO_PAGES(bytes);
+		EFI_PHYSICAL_ADDRESS addr;
+		if (EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiBootServicesData, pages, &addr))) {
+			return NULL;
+		}
+		stats.blocks += 1;
+		struct arena_block *block = (struct arena_block *)(UINTN) addr;
+		block->prev = arena_top;
+		block->size = pages * EFI_PAGE_SIZE;
+		block->used = ARENA_BLOCK_HEADER;
+		block->floor = ARENA_BLOCK_HEADER;
+		arena_top = block;
+	}
+	struct arena_header *header = (struct arena_header *)((unsigned char *) arena_top + arena_top->used);
+	header->size = size;
+	header->space = space;
+	header->freed = 0;
+	arena_top->used += ARENA_HEADER + space;
+	count_bytes(0, size);
+	return (unsigned char *) header + ARENA_HEADER;
+}
+
+static void arena_free(void *ptr) {
+	struct arena_header *header = header_of(ptr);
+	if (header->freed) {
+		return;
+	}
+	header->freed = 1;
+	count_bytes(header->size, 0);
+	if (is_tip(header)) {
+		arena_top->used -= ARENA_HEADER + header->space;
+	}
+}
+
+// Stop counting the allocations in a block from the given offset on.
+static void forget(struct arena_block *block, size_t from) {
+	for (size_t pos = from; pos < block->used;) {
+		struct arena_header *header = (struct arena_header *)((unsigned char *) block + pos);
+		if (!header->freed) {
+			count_bytes(header->size, 0);
+		}
+		pos += ARENA_HEADER + header->space;
+	}
+}
+
+arena_mark arena_get_mark(void) {
+	arena_mark mark = { arena_top, arena_top ? arena_top->used : 0 };
+	if (arena_top) {
+		arena_top->floor = arena_top->used;
+	}
+	return mark;
+}
+
+void arena_release(arena_mark mark) {
+	while (arena_top && arena_top != mark.block) {
+		struct arena_block *block = arena_top;
+		forget(block, ARENA_BLOCK_HEADER);
+		arena_top = block->prev;
+		BS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN) block, EFI_SIZE_TO_PAGES(block->size));
+	}
+	if (arena_top) {
+		forget(arena_top, mark.used);
+		arena_top->used = mark.used;
+		arena_top->floor = mark.used;
+	}
+}
+
+void arena_free_all(void) {
+	arena_mark none = { NULL, 0 };
+	arena_release(none);
+}
+
+void arena_get_stats(arena_stats *out) {
+	*out = stats;
+}
+
+void arena_reset_peak(void) {
+	stats.peak = stats.current;
+}
+
 void *malloc(size_t size) {
-	void* data;
-	BS->AllocatePool(EfiBootServicesData, size, &data);
-	return data;
+	stats.mallocs += 1;
+	return arena_alloc(size);
 }
 
 void *calloc(size_t nmemb, size_t size) {
-	void* data;
-	BS->AllocatePool(EfiBootServicesData, (nmemb * size), &data);
+	stats.callocs += 1;
+	if (size && nmemb > (size_t)-1 / size) {
+		return NULL;
+	}
+	void* data = arena_alloc(nmemb * size);
 	// calloc function is Allocate and Clear zero memory
-	memset(data, 0x00, (nmemb * size));
+	if (data) {
+		memset(data, 0x00, (nmemb * size));
+	}
 	return data;
 }
 
 void free(void *ptr) {
-	FreePool(ptr);
+	if (ptr) {
+		stats.frees += 1;
+		arena_free(ptr);
+	}
 }
 
 void *realloc(void *ptr, size_t size) {
-	void* data = malloc(size);
-	if (data && ptr) {
-		// Ignore Read Overflow of Old size < New size
-		memcpy(data, ptr, size);
-		free(ptr);
+	if (!ptr) {
+		return malloc(size);
+	}
+	stats.reallocs += 1;
+	if (size > (size_t)-1 - ARENA_BLOCK_SIZE) {
+		return NULL;
+	}
+	struct arena_header *header = header_of(ptr);
+	size_t space = ARENA_ROUND(size);
+	int tip = is_tip(header);
+	// Shrink, or grow within the padding or at the end of the block.
+	if (space <= header->space || (tip && arena_top->size - arena_top->used >= space - header->space)) {
+		if (tip) {
+			arena_top->used = arena_top->used - header->space + space;
+			header->space = space;
+		}
+		count_bytes(header->size, size);
+		header->size = size;
+		stats.in_place += 1;
+		return ptr;
+	}
+	void* data = arena_alloc(size);
+	if (data) {
+		memcpy(data, ptr, header->size);
+		arena_free(ptr);
 	}
 	return data;
 }
 
 // #include <string.h>
 // Compare two areas of memory
+// The symbol is kept for calls generated by the compiler.
+#undef memcmp
 int memcmp(const void *cs, const void *ct, size_t count) {
-	const unsigned char *su1, *su2;
-	int res = 0;
-
-	for (su1 = cs, su2 = ct; 0 < count; ++su1, ++su2, --count) {
-		if ((res = *su1 - *su2) != 0) break;
-	}
-
-	return res;
+	return my_memcmp(cs, ct, count);
 }
 
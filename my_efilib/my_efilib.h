@@ -32,6 +32,28 @@ void free(void *ptr);
 // #define free(p) FreePool(p)
 void *realloc(void *ptr, size_t size);
 
+// Arena: malloc/calloc/realloc allocate from page blocks, and free only
+// returns the last allocation. A mark records the arena position;
+// arena_release frees everything allocated after the mark.
+typedef struct arena_mark {
+	void *block;
+	size_t used;
+} arena_mark;
+arena_mark arena_get_mark(void);
+void arena_release(arena_mark mark);
+void arena_free_all(void);
+
+// Allocation statistics, for finding the memory use of the decoders.
+typedef struct arena_stats {
+	size_t current; // bytes allocated and not freed
+	size_t peak; // the highest value of current
+	size_t mallocs, callocs, reallocs, frees;
+	size_t in_place; // reallocs that didn't move the data
+	size_t blocks; // AllocatePages calls
+} arena_stats;
+void arena_get_stats(arena_stats *stats);
+void arena_reset_peak(void);
+
 // #include <string.h>
 // memset/memcpy by gnu-efi/lib/init.c
 void *memset(void *s, int c, __SIZE_TYPE__ n);
@@ -39,6 +61,13 @@ void *memcpy(void *dest, const void *src, __SIZE_TYPE__ n);
 // Compare two areas of memory
 int memcmp(const void *cs, const void *ct, size_t count);
 
+// Use the optimized versions from my_string.c instead
+#include "my_string.h"
+#define memcpy(dest, src, n) my_memcpy(dest, src, n)
+#define memmove(dest, src, n) my_memmove(dest, src, n)
+#define memset(s, c, n) my_memset(s, c, n)
+#define memcmp(cs, ct, n) my_memcmp(cs, ct, n)
+
 // #include <types.h>
 #ifndef NULL
 #define NULL ((void *)0)
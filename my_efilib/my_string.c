@@ -0,0 +1,211 @@
+// Optimized memcpy/memmove/memset/memcmp.
+//
+// gnu-efi's memcpy and memset copy one byte at a time. These use 16-byte
+// vectors (SSE2 on x86_64) with overlapping loads and stores at the ends,
+// so that no size needs a byte loop, and on x86_64 rep movsb/stosb for
+// large sizes when the CPU has ERMS (Enhanced REP MOVSB/STOSB), where the
+// microcode is faster than any loop.
+
+#include "my_string.h"
+
+#include <stdint.h>
+
+// GCC would turn the copy loops back into calls to memcpy and memset.
+#define NO_LIBCALL __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+// Unaligned types, so the loads and stores work at any address.
+typedef unsigned char vec16 __attribute__((vector_size(16), aligned(1), may_alias));
+typedef uint64_t u64u __attribute__((aligned(1), may_alias));
+typedef uint32_t u32u __attribute__((aligned(1), may_alias));
+typedef uint16_t u16u __attribute__((aligned(1), may_alias));
+
+// From this size on, rep movsb/stosb beats the vector loop with ERMS.
+#define ERMS_THRESHOLD 2048
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+
+static int erms = -1;
+
+static int has_erms(void) {
+	if (erms < 0) {
+		unsigned a, b, c, d;
+		erms = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 9));
+	}
+	return erms;
+}
+#endif
+
+// Copy up to 32 bytes. Everything is loaded before anything is stored,
+// so the areas may overlap.
+static inline void copy_small(unsigned char *d, const unsigned char *s, size_t n) {
+	if (n >= 16) {
+		vec16 a = *(const vec16 *) s, b = *(const vec16 *)(s + n - 16);
+		*(vec16 *) d = a;
+		*(vec16 *)(d + n - 16) = b;
+	} else if (n >= 8) {
+		uint64_t a = *(const u64u *) s, b = *(const u64u *)(s + n - 8);
+		*(u64u *) d = a;
+		*(u64u *)(d + n - 8) = b;
+	} else if (n >= 4) {
+		uint32_t a = *(const u32u *) s, b = *(const u32u *)(s + n - 4);
+		*(u32u *) d = a;
+		*(u32u *)(d + n - 4) = b;
+	} else if (n >= 2) {
+		uint16_t a = *(const u16u *) s, b = *(const u16u *)(s + n - 2);
+		*(u16u *) d = a;
+		*(u16u *)(d + n - 2) = b;
+	} else if (n) {
+		*d = *s;
+	}
+}
+
+// Copy more than 32 bytes from the start. Each chunk is loaded before it
+// is stored, and the last 16 bytes are loaded first, so dest may overlap
+// src from below.
+static NO_LIBCALL void copy_forward(unsigned char *d, const unsigned char *s, size_t n) {
+	vec16 tail = *(const vec16 *)(s + n - 16);
+	unsigned char *end = d + n - 16;
+	for (; n > 64; n -= 64, s += 64, d += 64) {
+		vec16 a = *(const vec16 *) s, b = *(const vec16 *)(s + 16);
+		vec16 c = *(const vec16 *)(s + 32), e = *(const vec16 *)(s + 48);
+		*(vec16 *) d = a;
+		*(vec16 *)(d + 16) = b;
+		*(vec16 *)(d + 32) = c;
+		*(vec16 *)(d + 48) = e;
+	}
+	for (; n > 16; n -= 16, s += 16, d += 16) {
+		*(vec16 *) d = *(const vec16 *) s;
+	}
+	*(vec16 *) end = tail;
+}
+
+// Copy more than 32 bytes from the end, for dest overlapping src from above.
+static NO_LIBCALL void copy_backward(unsigned char *d, const unsigned char *s, size_t n) {
+	vec16 head = *(const vec16 *) s;
+	unsigned char *start = d;
+	for (d += n, s += n; n > 64; n -= 64) {
+		s -= 64;
+		d -= 64;
+		vec16 a = *(const vec16 *) s, b = *(const vec16 *)(s + 16);
+		vec16 c = *(const vec16 *)(s + 32), e = *(const vec16 *)(s + 48);
+		*(vec16 *)(d + 48) = e;
+		*(vec16 *)(d + 32) = c;
+		*(vec16 *)(d + 16) = b;
+		*(vec16 *) d = a;
+	}
+	for (; n > 16; n -= 16) {
+		s -= 16;
+		d -= 16;
+		*(vec16 *) d = *(const vec16 *) s;
+	}
+	*(vec16 *) start = head;
+}
+
+void *my_memcpy(void *dest, const void *src, size_t n) {
+	unsigned char *d = dest;
+	const unsigned char *s = src;
+	if (n <= 32) {
+		copy_small(d, s, n);
+		return dest;
+	}
+#if defined(__x86_64__)
+	// rep movsb copies forwards byte by byte as far as overlap is concerned.
+	if (n >= ERMS_THRESHOLD && has_erms()) {
+		__asm__ volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+		return dest;
+	}
+#endif
+	copy_forward(d, s, n);
+	return dest;
+}
+
+void *my_memmove(void *dest, const void *src, size_t n) {
+	// Copying forwards is safe unless dest starts inside src.
+	if ((uintptr_t) dest - (uintptr_t) src >= n) {
+		return my_memcpy(dest, src, n);
+	}
+	if (n <= 32) {
+		copy_small(dest, src, n);
+	} else {
+		copy_backward(dest, src, n);
+	}
+	return dest;
+}
+
+NO_LIBCALL void *my_memset(void *s, int c, size_t n) {
+	unsigned char *d = s;
+	uint64_t x = (unsigned char) c * 0x0101010101010101ULL;
+	if (n >= 16) {
+		vec16 v = (vec16) { 0 } + (unsigned char) c;
+		if (n <= 32) {
+			*(vec16 *) d = v;
+			*(vec16 *)(d + n - 16) = v;
+			return s;
+		}
+#if defined(__x86_64__)
+		if (n >= ERMS_THRESHOLD && has_erms()) {
+			__asm__ volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+			return s;
+		}
+#endif
+		unsigned char *end = d + n - 16;
+		for (; n > 64; n -= 64, d += 64) {
+			*(vec16 *) d = v;
+			*(vec16 *)(d + 16) = v;
+			*(vec16 *)(d + 32) = v;
+			*(vec16 *)(d + 48) = v;
+		}
+		for (; n > 16; n -= 16, d += 16) {
+			*(vec16 *) d = v;
+		}
+		*(vec16 *) end = v;
+	} else if (n >= 8) {
+		*(u64u *) d = x;
+		*(u64u *)(d + n - 8) = x;
+	} else if (n >= 4) {
+		*(u32u *) d = (uint32_t) x;
+		*(u32u *)(d + n - 4) = (uint32_t) x;
+	} else if (n >= 2) {
+		*(u16u *) d = (uint16_t) x;
+		*(u16u *)(d + n - 2) = (uint16_t) x;
+	} else if (n) {
+		*d = (unsigned char) c;
+	}
+	return s;
+}
+
+int my_memcmp(const void *cs, const void *ct, size_t n) {
+	const unsigned char *a = cs, *b = ct;
+	// Skip equal 64-byte blocks; the difference is found below.
+	for (; n >= 64; n -= 64, a += 64, b += 64) {
+		vec16 x = *(const vec16 *) a ^ *(const vec16 *) b;
+		x |= *(const vec16 *)(a + 16) ^ *(const vec16 *)(b + 16);
+		x |= *(const vec16 *)(a + 32) ^ *(const vec16 *)(b + 32);
+		x |= *(const vec16 *)(a + 48) ^ *(const vec16 *)(b + 48);
+		uint64_t lo, hi;
+		__builtin_memcpy(&lo, &x, 8);
+		__builtin_memcpy(&hi, (const unsigned char *) &x + 8, 8);
+		if (lo | hi) {
+			break;
+		}
+	}
+	for (; n >= 8; n -= 8, a += 8, b += 8) {
+		uint64_t x = *(const u64u *) a, y = *(const u64u *) b;
+		if (x != y) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			x = __builtin_bswap64(x);
+			y = __builtin_bswap64(y);
+#endif
+			// The first differing byte is the lowest one.
+			int shift = __builtin_ctzll(x ^ y) & ~7;
+			return (int)((x >> shift) & 0xff) - (int)((y >> shift) & 0xff);
+		}
+	}
+	for (; n; --n, ++a, ++b) {
+		if (*a != *b) {
+			return *a - *b;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+// Optimized memory functions for the EFI build.
+// They don't depend on EFI or the C library, so the host tools and
+// benchmarks can use them too.
+
+#ifndef MY_STRING_H
+#define MY_STRING_H
+
+#include <stddef.h>
+
+// Copy n bytes; the areas may overlap if dest is below src.
+void *my_memcpy(void *dest, const void *src, size_t n);
+
+// Copy n bytes; the areas may overlap in any way.
+void *my_memmove(void *dest, const void *src, size_t n);
+
+// Fill n bytes with the byte c.
+void *my_memset(void *s, int c, size_t n);
+
+// Compare n bytes as unsigned chars.
+int my_memcmp(const void *cs, const void *ct, size_t n);
+
+#endif
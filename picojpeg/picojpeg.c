@@ -220,6 +220,7 @@ static pjpeg_need_bytes_callback_t g_pNeedBytesCallback;
 static void *g_pCallback_data;
 static uint8 gCallbackStatus;
 static uint8 gReduce;
+static uint8 gSkipTransform;
 //------------------------------------------------------------------------------
 static void fillInBuf(void)
 {
@@ -1479,6 +1480,228 @@ static PJPG_INLINE uint8 subAndClamp(uint8 a, int16 b)
    return (uint8)b;
 }
 /*----------------------------------------------------------------------------*/
+// Vector versions of the IDCT and the color conversion, written with GCC's
+// generic vectors, which compile to SSE2 on x86_64. The same code is also
+// compiled for SSE4.1 (pmulld for the 32-bit products of the IDCT) and AVX2
+// (eight 32-bit lanes in one register). The results are identical to the C
+// code; the DC-only short cuts of idctRows and idctCols give the same values
+// as the full transform. See pjpeg_set_simd.
+#if defined(__x86_64__)
+#define PJPG_SIMD 1
+
+typedef int16 vec16s __attribute__((vector_size(16)));
+typedef uint16 vec16u __attribute__((vector_size(16)));
+typedef int vec32s __attribute__((vector_size(32)));
+typedef int vec32s4 __attribute__((vector_size(16)));
+typedef long long vec64s __attribute__((vector_size(16)));
+typedef uint8 vec8u __attribute__((vector_size(8)));
+// Unaligned types for gCoeffBuf and the MCU buffers.
+typedef int16 vec16s_u __attribute__((vector_size(16), aligned(2), may_alias));
+typedef uint8 vec8u_u __attribute__((vector_size(8), aligned(1), may_alias));
+
+#define PJPG_SIMD_INLINE static inline __attribute__((always_inline))
+#define PJPG_WIDEN(v) __builtin_convertvector(v, vec32s)
+
+// Like imul_b1_b3 etc., with the multiplier k. The 16-bit sums of the IDCT
+// wrap around like the int16 variables of the C code, so they are done on
+// unsigned vectors, where the overflow is defined.
+PJPG_SIMD_INLINE vec16u imulVec(vec16u w, int k)
+{
+   return (vec16u)__builtin_convertvector((PJPG_WIDEN((vec16s)w) * k + 128) >> 8, vec16s);
+}
+
+// clamp(PJPG_DESCALE(a + b * sign) + 128), with the sum in 32 bits
+PJPG_SIMD_INLINE vec16u descaleVec(vec16u a, vec16u b, int sign)
+{
+   vec32s x = PJPG_WIDEN((vec16s)a) + PJPG_WIDEN((vec16s)b) * sign;
+   vec32s over;
+   x = ((x + (1 << (PJPG_DCT_SCALE_BITS - 1))) >> PJPG_DCT_SCALE_BITS) + 128;
+   x &= ~(x >> 31);
+   over = x > 255;
+   return (vec16u)__builtin_convertvector((x & ~over) | (over & 255), vec16s);
+}
+
+// Transpose the 8x8 block in p
+PJPG_SIMD_INLINE void transposeVec(vec16u* p)
+{
+   vec16u a[8];
+   vec32s4 b[8];
+   uint8 i;
+
+   for (i = 0; i < 8; i += 2)
+   {
+      a[i] = __builtin_shuffle(p[i], p[i + 1], (vec16u){0, 8, 1, 9, 2, 10, 3, 11});
+      a[i + 1] = __builtin_shuffle(p[i], p[i + 1], (vec16u){4, 12, 5, 13, 6, 14, 7, 15});
+   }
+   for (i = 0; i < 8; i += 4)
+   {
+      b[i] = __builtin_shuffle((vec32s4)a[i], (vec32s4)a[i + 2], (vec32s4){0, 4, 1, 5});
+      b[i + 1] = __builtin_shuffle((vec32s4)a[i], (vec32s4)a[i + 2], (vec32s4){2, 6, 3, 7});
+      b[i + 2] = __builtin_shuffle((vec32s4)a[i + 1], (vec32s4)a[i + 3], (vec32s4){0, 4, 1, 5});
+      b[i + 3] = __builtin_shuffle((vec32s4)a[i + 1], (vec32s4)a[i + 3], (vec32s4){2, 6, 3, 7});
+   }
+   for (i = 0; i < 4; i++)
+   {
+      p[2 * i] = (vec16u)__builtin_shuffle((vec64s)b[i], (vec64s)b[i + 4], (vec64s){0, 2});
+      p[2 * i + 1] = (vec16u)__builtin_shuffle((vec64s)b[i], (vec64s)b[i + 4], (vec64s){1, 3});
+   }
+}
+
+// One pass of idctRows on the columns of p (p[k] holds coefficient k),
+// or of idctCols on the rows of p, with the descaling and clamping
+PJPG_SIMD_INLINE void idctVec(vec16u* p, uint8 cols)
+{
+   vec16u x4 = p[5] - p[3];
+   vec16u x7 = p[5] + p[3];
+   vec16u x5 = p[1] + p[7];
+   vec16u x6 = p[1] - p[7];
+
+   vec16u tmp1 = imulVec(x4 - x6, 196);
+   vec16u stg26 = imulVec(x6, 277) - tmp1;
+   vec16u x24 = tmp1 - imulVec(x4, 669);
+
+   vec16u x15 = x5 - x7;
+   vec16u x17 = x5 + x7;
+
+   vec16u tmp2 = stg26 - x17;
+   vec16u tmp3 = imulVec(x15, 362) - tmp2;
+   vec16u x44 = tmp3 + x24;
+
+   vec16u x30 = p[0] + p[4];
+   vec16u x31 = p[0] - p[4];
+   vec16u x12 = p[2] - p[6];
+   vec16u x13 = p[2] + p[6];
+
+   vec16u x32 = imulVec(x12, 362) - x13;
+
+   vec16u x40 = x30 + x13;
+   vec16u x43 = x30 - x13;
+   vec16u x41 = x31 + x32;
+   vec16u x42 = x31 - x32;
+
+   if (cols)
+   {
+      p[0] = descaleVec(x40, x17, 1);
+      p[1] = descaleVec(x41, tmp2, 1);
+      p[2] = descaleVec(x42, tmp3, 1);
+      p[3] = descaleVec(x43, x44, -1);
+      p[4] = descaleVec(x43, x44, 1);
+      p[5] = descaleVec(x42, tmp3, -1);
+      p[6] = descaleVec(x41, tmp2, -1);
+      p[7] = descaleVec(x40, x17, -1);
+   }
+   else
+   {
+      p[0] = x40 + x17;
+      p[1] = x41 + tmp2;
+      p[2] = x42 + tmp3;
+      p[3] = x43 - x44;
+      p[4] = x43 + x44;
+      p[5] = x42 - tmp3;
+      p[6] = x41 - tmp2;
+      p[7] = x40 - x17;
+   }
+}
+
+// idctRows and idctCols
+PJPG_SIMD_INLINE void idctBlockVec(void)
+{
+   vec16u p[8];
+   uint8 i;
+
+   for (i = 0; i < 8; i++)
+      p[i] = (vec16u)((const vec16s_u*)gCoeffBuf)[i];
+   transposeVec(p);
+   idctVec(p, 0);
+   transposeVec(p);
+   idctVec(p, 1);
+   for (i = 0; i < 8; i++)
+      ((vec16s_u*)gCoeffBuf)[i] = (vec16s)p[i];
+}
+
+// Add t to 8 pixels and clamp, like addAndClamp (and subAndClamp with -t)
+PJPG_SIMD_INLINE void addAndClampVec(uint8* pDst, vec16s t)
+{
+   vec16s x = __builtin_convertvector(*(const vec8u_u*)pDst, vec16s) + t;
+   vec16s over;
+   x &= ~(x >> 15);
+   over = x > 255;
+   *(vec8u_u*)pDst = __builtin_convertvector((x & ~over) | (over & 255), vec8u);
+}
+
+// copyY
+PJPG_SIMD_INLINE void copyYVec(uint8 dstOfs)
+{
+   uint8 i;
+
+   for (i = 0; i < 8; i++)
+   {
+      vec8u c = __builtin_convertvector(((const vec16s_u*)gCoeffBuf)[i], vec8u);
+      *(vec8u_u*)(gMCUBufR + dstOfs + i * 8) = c;
+      *(vec8u_u*)(gMCUBufG + dstOfs + i * 8) = c;
+      *(vec8u_u*)(gMCUBufB + dstOfs + i * 8) = c;
+   }
+}
+
+// convertCb/convertCr (cr = 0/1), or with h and/or v the upsampleCb/Cr variants
+PJPG_SIMD_INLINE void chromaVec(uint8 cr, uint8 srcOfs, uint8 dstOfs, uint8 h, uint8 v)
+{
+   const vec16s_u* pSrc = (const vec16s_u*)(gCoeffBuf + (srcOfs & ~7));
+   uint8* pDst1 = (cr ? gMCUBufR : gMCUBufG) + dstOfs;
+   uint8* pDst2 = (cr ? gMCUBufG : gMCUBufB) + dstOfs;
+   uint8 y;
+
+   for (y = 0; y < (v ? 4 : 8); y++)
+   {
+      vec16u c = (vec16u)pSrc[y] & 255;
+      vec16s t1, t2;
+
+      if (h)
+      {
+         if (srcOfs & 7)
+            c = __builtin_shuffle(c, (vec16u){4, 4, 5, 5, 6, 6, 7, 7});
+         else
+            c = __builtin_shuffle(c, (vec16u){0, 0, 1, 1, 2, 2, 3, 3});
+      }
+
+      if (cr)
+      {
+         t1 = (vec16s)(c + ((c * 103) >> 8)) - 179;
+         t2 = 91 - (vec16s)((c * 183) >> 8);
+      }
+      else
+      {
+         t1 = 44 - (vec16s)((c * 88) >> 8);
+         t2 = (vec16s)(c + ((c * 198) >> 8)) - 227;
+      }
+
+      addAndClampVec(pDst1 + y * (v ? 16 : 8), t1);
+      addAndClampVec(pDst2 + y * (v ? 16 : 8), t2);
+      if (v)
+      {
+         addAndClampVec(pDst1 + y * 16 + 8, t1);
+         addAndClampVec(pDst2 + y * 16 + 8, t2);
+      }
+   }
+}
+
+#define PJPG_SIMD_FUNCTIONS(name, attr) \
+   attr static void idctBlock##name(void) { idctBlockVec(); } \
+   attr static void copyY##name(uint8 dstOfs) { copyYVec(dstOfs); } \
+   attr static void chroma##name(uint8 cr, uint8 srcOfs, uint8 dstOfs, uint8 h, uint8 v) { chromaVec(cr, srcOfs, dstOfs, h, v); }
+
+PJPG_SIMD_FUNCTIONS(Base, )
+#if defined(__x86_64__)
+PJPG_SIMD_FUNCTIONS(SSE41, __attribute__((target("sse4.1"))))
+PJPG_SIMD_FUNCTIONS(AVX2, __attribute__((target("avx2"))))
+#endif
+
+// The selected functions, or 0 for the C code
+static void (*gIdctBlockSimd)(void);
+static void (*gCopyYSimd)(uint8 dstOfs);
+static void (*gChromaSimd)(uint8 cr, uint8 srcOfs, uint8 dstOfs, uint8 h, uint8 v);
+#endif
+/*----------------------------------------------------------------------------*/
 // 103/256
 //R = Y + 1.402 (Cr-128)
 
@@ -1491,6 +1714,13 @@ static PJPG_INLINE uint8 subAndClamp(uint8 a, int16 b)
 // Cb upsample and accumulate, 4x4 to 8x8
 static void upsampleCb(uint8 srcOfs, uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(0, srcOfs, dstOfs, 1, 1);
+      return;
+   }
+#endif
    // Cb - affects G and B
    uint8 x, y;
    int16* pSrc = gCoeffBuf + srcOfs;
@@ -1528,6 +1758,13 @@ static void upsampleCb(uint8 srcOfs, uint8 dstOfs)
 // Cb upsample and accumulate, 4x8 to 8x8
 static void upsampleCbH(uint8 srcOfs, uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(0, srcOfs, dstOfs, 1, 0);
+      return;
+   }
+#endif
    // Cb - affects G and B
    uint8 x, y;
    int16* pSrc = gCoeffBuf + srcOfs;
@@ -1559,6 +1796,13 @@ static void upsampleCbH(uint8 srcOfs, uint8 dstOfs)
 // Cb upsample and accumulate, 8x4 to 8x8
 static void upsampleCbV(uint8 srcOfs, uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(0, srcOfs, dstOfs, 0, 1);
+      return;
+   }
+#endif
    // Cb - affects G and B
    uint8 x, y;
    int16* pSrc = gCoeffBuf + srcOfs;
@@ -1600,6 +1844,13 @@ static void upsampleCbV(uint8 srcOfs, uint8 dstOfs)
 // Cr upsample and accumulate, 4x4 to 8x8
 static void upsampleCr(uint8 srcOfs, uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(1, srcOfs, dstOfs, 1, 1);
+      return;
+   }
+#endif
    // Cr - affects R and G
    uint8 x, y;
    int16* pSrc = gCoeffBuf + srcOfs;
@@ -1637,6 +1888,13 @@ static void upsampleCr(uint8 srcOfs, uint8 dstOfs)
 // Cr upsample and accumulate, 4x8 to 8x8
 static void upsampleCrH(uint8 srcOfs, uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(1, srcOfs, dstOfs, 1, 0);
+      return;
+   }
+#endif
    // Cr - affects R and G
    uint8 x, y;
    int16* pSrc = gCoeffBuf + srcOfs;
@@ -1668,6 +1926,13 @@ static void upsampleCrH(uint8 srcOfs, uint8 dstOfs)
 // Cr upsample and accumulate, 8x4 to 8x8
 static void upsampleCrV(uint8 srcOfs, uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(1, srcOfs, dstOfs, 0, 1);
+      return;
+   }
+#endif
    // Cr - affects R and G
    uint8 x, y;
    int16* pSrc = gCoeffBuf + srcOfs;
@@ -1700,6 +1965,13 @@ static void upsampleCrV(uint8 srcOfs, uint8 dstOfs)
 // Convert Y to RGB
 static void copyY(uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gCopyYSimd)
+   {
+      gCopyYSimd(dstOfs);
+      return;
+   }
+#endif
    uint8 i;
    uint8* pRDst = gMCUBufR + dstOfs;
    uint8* pGDst = gMCUBufG + dstOfs;
@@ -1719,6 +1991,13 @@ static void copyY(uint8 dstOfs)
 // Cb convert to RGB and accumulate
 static void convertCb(uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(0, 0, dstOfs, 0, 0);
+      return;
+   }
+#endif
    uint8 i;
    uint8* pDstG = gMCUBufG + dstOfs;
    uint8* pDstB = gMCUBufB + dstOfs;
@@ -1740,6 +2019,13 @@ static void convertCb(uint8 dstOfs)
 // Cr convert to RGB and accumulate
 static void convertCr(uint8 dstOfs)
 {
+#if PJPG_SIMD
+   if (gChromaSimd)
+   {
+      gChromaSimd(1, 0, dstOfs, 0, 0);
+      return;
+   }
+#endif
    uint8 i;
    uint8* pDstR = gMCUBufR + dstOfs;
    uint8* pDstG = gMCUBufG + dstOfs;
@@ -1760,8 +2046,15 @@ static void convertCr(uint8 dstOfs)
 /*----------------------------------------------------------------------------*/
 static void transformBlock(uint8 mcuBlock)
 {
-   idctRows();
-   idctCols();
+#if PJPG_SIMD
+   if (gIdctBlockSimd)
+      gIdctBlockSimd();
+   else
+#endif
+   {
+      idctRows();
+      idctCols();
+   }
    
    switch (gScanType)
    {
@@ -2193,7 +2486,8 @@ static uint8 decodeNextMCU(void)
             }
          }
 
-         transformBlockReduce(mcuBlock); 
+         if (!gSkipTransform)
+            transformBlockReduce(mcuBlock); 
       }
       else
       {
@@ -2249,10 +2543,13 @@ static uint8 decodeNextMCU(void)
             }
          }
          
-         while (k < 64)
-            gCoeffBuf[ZAG[k++]] = 0;
+         if (!gSkipTransform)
+         {
+            while (k < 64)
+               gCoeffBuf[ZAG[k++]] = 0;
 
-         transformBlock(mcuBlock); 
+            transformBlock(mcuBlock); 
+         }
       }
    }
          
@@ -2284,6 +2581,48 @@ unsigned char pjpeg_decode_mcu(void)
    return 0;
 }
 //------------------------------------------------------------------------------
+unsigned char pjpeg_skip_mcu(void)
+{
+   uint8 status;
+
+   gSkipTransform = 1;
+   status = pjpeg_decode_mcu();
+   gSkipTransform = 0;
+
+   return status;
+}
+//------------------------------------------------------------------------------
+void pjpeg_set_simd(unsigned char level)
+{
+#if PJPG_SIMD
+   gIdctBlockSimd = 0;
+   gCopyYSimd = 0;
+   gChromaSimd = 0;
+   if (level >= 1)
+   {
+      gIdctBlockSimd = idctBlockBase;
+      gCopyYSimd = copyYBase;
+      gChromaSimd = chromaBase;
+   }
+#if defined(__x86_64__)
+   if (level >= 2)
+   {
+      gIdctBlockSimd = idctBlockSSE41;
+      gCopyYSimd = copyYSSE41;
+      gChromaSimd = chromaSSE41;
+   }
+   if (level >= 3)
+   {
+      gIdctBlockSimd = idctBlockAVX2;
+      gCopyYSimd = copyYAVX2;
+      gChromaSimd = chromaAVX2;
+   }
+#endif
+#else
+   (void)level;
+#endif
+}
+//------------------------------------------------------------------------------
 unsigned char pjpeg_decode_init(pjpeg_image_info_t *pInfo, pjpeg_need_bytes_callback_t pNeed_bytes_callback, void *pCallback_data, unsigned char reduce)
 {
    uint8 status;
@@ -122,6 +122,16 @@ unsigned char pjpeg_decode_init(pjpeg_image_info_t *pInfo, pjpeg_need_bytes_call
 // Not thread safe.
 unsigned char pjpeg_decode_mcu(void);
 
+// Like pjpeg_decode_mcu, but only entropy decodes the MCU, skipping the IDCT and the color conversion.
+// The MCU buffers are left undefined. Use for MCUs whose pixels are not needed.
+// Not thread safe.
+unsigned char pjpeg_skip_mcu(void);
+
+// Selects the IDCT and color conversion code: 0 = C (the default), 1 = 16-byte vectors (SSE2),
+// 2 = SSE4.1, 3 = AVX2. Levels 1 to 3 are x86_64 only; 2 and 3 must be supported by the CPU; the output is the same for all levels.
+// Not thread safe.
+void pjpeg_set_simd(unsigned char level);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,127 @@
+/*
+QOI -- a streaming decoder for the "Quite OK Image" format
+Written for HackBGRT from the QOI specification 1.0 (https://qoiformat.org/).
+*/
+
+#include "qoi.h"
+
+#define QOI_OP_INDEX 0x00 /* 00xxxxxx */
+#define QOI_OP_DIFF  0x40 /* 01xxxxxx */
+#define QOI_OP_LUMA  0x80 /* 10xxxxxx */
+#define QOI_OP_RUN   0xc0 /* 11xxxxxx */
+#define QOI_OP_RGB   0xfe /* 11111110 */
+#define QOI_OP_RGBA  0xff /* 11111111 */
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+#define QOI_MAX_SIZE 0x8000
+
+#define QOI_HASH(p) (((p)[0] * 3 + (p)[1] * 5 + (p)[2] * 7 + (p)[3] * 11) & 63)
+
+static uint32_t read_be32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+int qoi_init(qoi_decoder* qoi, const void* data, size_t size)
+{
+	const uint8_t* bytes = data;
+	int i;
+
+	if (size < QOI_HEADER_SIZE + QOI_PADDING_SIZE
+	|| bytes[0] != 'q' || bytes[1] != 'o' || bytes[2] != 'i' || bytes[3] != 'f') {
+		return 0;
+	}
+	qoi->width = read_be32(bytes + 4);
+	qoi->height = read_be32(bytes + 8);
+	qoi->channels = bytes[12];
+	qoi->colorspace = bytes[13];
+	if (qoi->width == 0 || qoi->width > QOI_MAX_SIZE || qoi->height == 0 || qoi->height > QOI_MAX_SIZE
+	|| qoi->channels < 3 || qoi->channels > 4 || qoi->colorspace > 1) {
+		return 0;
+	}
+
+	/* The chunks end before the 8-byte end marker. */
+	qoi->pos = bytes + QOI_HEADER_SIZE;
+	qoi->end = bytes + size - QOI_PADDING_SIZE;
+	for (i = 0; i < 64 * 4; ++i) {
+		qoi->index[i / 4][i % 4] = 0;
+	}
+	qoi->px[0] = qoi->px[1] = qoi->px[2] = 0;
+	qoi->px[3] = 255;
+	qoi->run = 0;
+	qoi->row = 0;
+	return 1;
+}
+
+int qoi_decode_row(qoi_decoder* qoi, uint8_t* rgba)
+{
+	const uint8_t* pos = qoi->pos;
+	const uint8_t* const end = qoi->end;
+	uint8_t* const row_end = rgba + qoi->width * 4;
+	uint8_t px[4] = {qoi->px[0], qoi->px[1], qoi->px[2], qoi->px[3]};
+	unsigned run = qoi->run;
+
+	if (qoi->row == qoi->height) {
+		return 0;
+	}
+
+	while (rgba != row_end) {
+		if (run) {
+			/* Runs may continue on the next row. */
+			do {
+				rgba[0] = px[0]; rgba[1] = px[1]; rgba[2] = px[2]; rgba[3] = px[3];
+				rgba += 4;
+			} while (--run && rgba != row_end);
+			continue;
+		}
+		if (pos == end) {
+			return 0;
+		}
+		unsigned b1 = *pos++;
+		if (b1 == QOI_OP_RGB) {
+			if (end - pos < 3) {
+				return 0;
+			}
+			px[0] = pos[0]; px[1] = pos[1]; px[2] = pos[2];
+			pos += 3;
+		} else if (b1 == QOI_OP_RGBA) {
+			if (end - pos < 4) {
+				return 0;
+			}
+			px[0] = pos[0]; px[1] = pos[1]; px[2] = pos[2]; px[3] = pos[3];
+			pos += 4;
+		} else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+			const uint8_t* p = qoi->index[b1];
+			px[0] = p[0]; px[1] = p[1]; px[2] = p[2]; px[3] = p[3];
+		} else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+			px[0] += ((b1 >> 4) & 3) - 2;
+			px[1] += ((b1 >> 2) & 3) - 2;
+			px[2] += (b1 & 3) - 2;
+		} else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+			if (pos == end) {
+				return 0;
+			}
+			unsigned b2 = *pos++;
+			int vg = (b1 & 0x3f) - 32;
+			px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+			px[1] += vg;
+			px[2] += vg - 8 + (b2 & 0x0f);
+		} else {
+			/* QOI_OP_RUN: this pixel and b1 & 0x3f more. */
+			run = (b1 & 0x3f) + 1;
+			continue;
+		}
+		uint8_t* slot = qoi->index[QOI_HASH(px)];
+		slot[0] = px[0]; slot[1] = px[1]; slot[2] = px[2]; slot[3] = px[3];
+		rgba[0] = px[0]; rgba[1] = px[1]; rgba[2] = px[2]; rgba[3] = px[3];
+		rgba += 4;
+	}
+
+	qoi->pos = pos;
+	qoi->px[0] = px[0]; qoi->px[1] = px[1]; qoi->px[2] = px[2]; qoi->px[3] = px[3];
+	qoi->run = run;
+	++qoi->row;
+	return 1;
+}
@@ -0,0 +1,41 @@
+/*
+QOI -- a streaming decoder for the "Quite OK Image" format
+Written for HackBGRT from the QOI specification 1.0 (https://qoiformat.org/).
+
+The decoder needs no memory allocation: the caller decodes the image one
+row of RGBA pixels at a time, from top to bottom.
+*/
+
+#if !defined(QOI_H)
+#define QOI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct qoi_decoder {
+	unsigned width;
+	unsigned height;
+	unsigned channels;   /* 3 = RGB, 4 = RGBA; informative only */
+	unsigned colorspace; /* 0 = sRGB with linear alpha, 1 = all linear; informative only */
+
+	const uint8_t* pos;
+	const uint8_t* end;
+	uint8_t index[64][4];
+	uint8_t px[4];
+	unsigned run;
+	unsigned row;
+} qoi_decoder;
+
+/*
+Read the header and prepare for decoding.
+Returns 1 on success, 0 if the data is not a valid QOI image.
+*/
+int qoi_init(qoi_decoder* qoi, const void* data, size_t size);
+
+/*
+Decode the next row into width RGBA pixels (4 bytes each).
+Returns 1 on success, 0 if the data is truncated or all rows have been decoded.
+*/
+int qoi_decode_row(qoi_decoder* qoi, uint8_t* rgba);
+
+#endif /*defined(QOI_H)*/
@@ -0,0 +1,453 @@
+#include "bmp.h"
+#include "pixel.h"
+#include "writer.h"
+#include "util.h"
+#include "../my_efilib/my_efilib.h"
+
+#include <efilib.h>
+
+/**
+ * BMP compression types.
+ */
+enum {
+	BI_RGB = 0, BI_RLE8 = 1, BI_RLE4 = 2, BI_BITFIELDS = 3, BI_ALPHABITFIELDS = 6
+};
+
+/**
+ * Conversion from a bit field to an 8-bit channel.
+ */
+struct BMPChannel {
+	UINT32 mask;
+	int shift;
+	UINT8 table[256];
+};
+
+/**
+ * The pixel format of a source BMP.
+ */
+struct BMPFormat {
+	UINT32 width, height, bpp;
+	UINT32 out_bpp;
+	UINT32 palette[256];
+	struct BMPChannel red, green, blue;
+	BOOLEAN plain32;
+};
+
+/**
+ * Offset of the BMP header in its allocation, so that the pixel data is 64-byte aligned.
+ */
+#define BMP_HEADER_GAP (64 - sizeof(BMP))
+
+BMP* CreateBMP(UINT32 w, UINT32 h, UINT32 bpp) {
+	EFI_PHYSICAL_ADDRESS addr = 0;
+
+	LogDebug(L"HackBGRT: CreateBMP() (%d x %d x %d).\n", w, h, bpp);
+
+	if (!w || !h || BMPSize(w, h, bpp) > BMP_MAX_SIZE) {
+		LogDebug(L"HackBGRT: CreateBMP() size out of range.\n");
+		return 0;
+	}
+	const UINT32 size = (UINT32) BMPSize(w, h, bpp);
+	LogDebug(L"HackBGRT: CreateBMP() AllocatePages %ld.\n", size);
+	if (EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiBootServicesData, EFI_SIZE_TO_PAGES(size + BMP_HEADER_GAP), &addr))) {
+		return 0;
+	}
+	BMP* bmp = (BMP*) (UINTN) (addr + BMP_HEADER_GAP);
+
+	// BI_RGB, the bpp is set below
+	CopyMem(
+		bmp,
+		"\x42\x4d"
+		"\x00\x00\x00\x00"
+		"\x00\x00"
+		"\x00\x00"
+		"\x36\x00\x00\x00"
+		"\x28\x00\x00\x00"
+		"\x00\x00\x00\x00"
+		"\x00\x00\x00\x00"
+		"\x01\x00"
+		"\x18\x00"
+		"\x00\x00\x00\x00"
+		"\x00\x00\x00\x00"
+		"\x13\x0b\x00\x00"
+		"\x13\x0b\x00\x00"
+		"\x00\x00\x00\x00"
+		"\x00\x00\x00\x00",
+		sizeof(BMP)
+	);
+
+	// Windows Bitmap Byte Order = Little Endian
+	bmp->file_size = DWORD_TO_BYTES_LE(size);
+	bmp->width  = DWORD_TO_BYTES_LE(w);
+	bmp->height = DWORD_TO_BYTES_LE(h);
+	bmp->bpp = bpp;
+	bmp->biSizeImage = DWORD_TO_BYTES_LE(size - sizeof(BMP));
+
+	// The decoders only write the pixels; clear the row padding here.
+	const UINT32 stride = BMPStride(w, bpp), row_bytes = w * (bpp / 8);
+	if (stride != row_bytes) {
+		for (UINT32 y = 0; y < h; ++y) {
+			ZeroMem(BMPRow(bmp, y) + row_bytes, stride - row_bytes);
+		}
+	}
+
+	return bmp;
+}
+
+void FreeBMP(BMP* bmp) {
+	if (bmp) {
+		BS->FreePages((UINTN) bmp - BMP_HEADER_GAP, EFI_SIZE_TO_PAGES(bmp->file_size + BMP_HEADER_GAP));
+	}
+}
+
+/**
+ * Read a little-endian 32-bit value from any address.
+ */
+static inline UINT32 ReadLE32(const UINT8* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32) p[3] << 24);
+}
+
+BOOLEAN BMPIsBlack(const UINT8* row, UINT32 x0, UINT32 x1, UINT32 bpp) {
+	UINT32 bits = 0;
+	if (bpp == 32) {
+		// A BMP file used as is has its pixels at offset 54, so the loads must not assume alignment.
+		for (UINT32 x = x0; x < x1; ++x) {
+			bits |= ReadLE32(row + x * 4);
+		}
+		bits &= 0xffffff;
+	} else {
+		for (UINT32 i = x0 * 3; i < x1 * 3; ++i) {
+			bits |= row[i];
+		}
+	}
+	return !bits;
+}
+
+BOOLEAN BMPContentBox(BMP* bmp, UINT32* x, UINT32* y, UINT32* w, UINT32* h) {
+	UINT32 top = 0, bottom = bmp->height;
+	while (top < bottom && BMPIsBlack(BMPRow(bmp, top), 0, bmp->width, bmp->bpp)) {
+		++top;
+	}
+	if (top == bottom) {
+		return FALSE;
+	}
+	while (BMPIsBlack(BMPRow(bmp, bottom - 1), 0, bmp->width, bmp->bpp)) {
+		--bottom;
+	}
+	// Only the columns outside the box found so far need to be checked.
+	UINT32 left = bmp->width, right = 0;
+	for (UINT32 row_y = top; row_y < bottom; ++row_y) {
+		const UINT8* row = BMPRow(bmp, row_y);
+		if (!BMPIsBlack(row, 0, left, bmp->bpp)) {
+			for (left = 0; BMPIsBlack(row, left, left + 1, bmp->bpp); ++left) {
+			}
+		}
+		if (!BMPIsBlack(row, right, bmp->width, bmp->bpp)) {
+			for (right = bmp->width; BMPIsBlack(row, right - 1, right, bmp->bpp); --right) {
+			}
+		}
+	}
+	*x = left;
+	*y = top;
+	*w = right - left;
+	*h = bottom - top;
+	return TRUE;
+}
+
+void CropBMP(BMP* bmp, UINT32 x, UINT32 y, UINT32 w, UINT32 h, BOOLEAN created) {
+	const UINT32 bytes = bmp->bpp / 8, height = bmp->height;
+	const UINT32 old_size = bmp->file_size, old_stride = BMPStride(bmp->width, bmp->bpp);
+	const UINT32 stride = BMPStride(w, bmp->bpp);
+	UINT8* pixels = (UINT8*) bmp + bmp->pixel_data_offset;
+	// The rows are bottom-up and no new row is after its old place, so
+	// moving them from the bottom up never overwrites a row still to be moved.
+	for (UINT32 i = 0; i < h; ++i) {
+		UINT8* dst = pixels + i * stride;
+		memmove(dst, pixels + (height - y - h + i) * old_stride + x * bytes, w * bytes);
+		ZeroMem(dst + w * bytes, stride - w * bytes);
+	}
+	const UINT32 size = (UINT32) BMPSize(w, h, bmp->bpp);
+	bmp->file_size = DWORD_TO_BYTES_LE(size);
+	bmp->width = DWORD_TO_BYTES_LE(w);
+	bmp->height = DWORD_TO_BYTES_LE(h);
+	bmp->biSizeImage = DWORD_TO_BYTES_LE(size - sizeof(BMP));
+	if (created) {
+		const UINTN pages = EFI_SIZE_TO_PAGES(size + BMP_HEADER_GAP);
+		const UINTN old_pages = EFI_SIZE_TO_PAGES(old_size + BMP_HEADER_GAP);
+		if (pages < old_pages) {
+			BS->FreePages((UINTN) bmp - BMP_HEADER_GAP + pages * EFI_PAGE_SIZE, old_pages - pages);
+		}
+	}
+}
+
+/**
+ * Prepare the conversion of a bit field.
+ *
+ * @param c The channel to initialize.
+ * @param mask The bit mask; must be contiguous.
+ * @return TRUE if the mask is usable, FALSE otherwise.
+ */
+static BOOLEAN InitChannel(struct BMPChannel* c, UINT32 mask) {
+	int shift = 0, bits = 0;
+	if (mask) {
+		while (!((mask >> shift) & 1)) {
+			++shift;
+		}
+		while (shift + bits < 32 && ((mask >> (shift + bits)) & 1)) {
+			++bits;
+		}
+		if ((UINT32)(((1ULL << bits) - 1) << shift) != mask) {
+			return FALSE;
+		}
+	}
+	// Keep only the 8 most significant bits.
+	if (bits > 8) {
+		shift += bits - 8;
+		bits = 8;
+	}
+	c->mask = mask;
+	c->shift = shift;
+	UINT32 max = (1 << bits) - 1;
+	for (UINT32 v = 0; v <= max; ++v) {
+		c->table[v] = max ? v * 255 / max : 0;
+	}
+	return TRUE;
+}
+
+static inline UINT8 ReadChannel(const struct BMPChannel* c, UINT32 pixel) {
+	return c->table[(pixel & c->mask) >> c->shift];
+}
+
+/**
+ * Convert one row of pixels from a bit field format.
+ */
+static void ConvertBitFields(const struct BMPFormat* f, const UINT8* src, UINT32 n, UINT8* dst) {
+	const UINT32 out_bytes = f->out_bpp / 8;
+	for (UINT32 x = 0; x < n; ++x) {
+		UINT32 pixel = f->bpp == 16 ? src[0] | (src[1] << 8) : ReadLE32(src);
+		dst[0] = ReadChannel(&f->blue, pixel);
+		dst[1] = ReadChannel(&f->green, pixel);
+		dst[2] = ReadChannel(&f->red, pixel);
+		if (out_bytes == 4) {
+			dst[3] = 0;
+		}
+		src += f->bpp / 8;
+		dst += out_bytes;
+	}
+}
+
+/**
+ * Convert a part of a row of pixels to the output format.
+ *
+ * @param f The source format.
+ * @param src The source row.
+ * @param x0 The first pixel to convert.
+ * @param n The number of pixels to convert.
+ * @param dst The destination.
+ */
+static void ConvertRow(const struct BMPFormat* f, const UINT8* src, UINT32 x0, UINT32 n, UINT8* dst) {
+	switch (f->bpp) {
+		case 1:
+		case 4:
+		case 8:
+			PixelRowIndexed(dst, src, x0, n, f->bpp, f->palette, f->out_bpp);
+			break;
+		case 24:
+			PixelRowFunction(PIXEL_BGR8, f->out_bpp)(dst, src + x0 * 3, n);
+			break;
+		case 32:
+			if (f->plain32) {
+				PixelRowFunction(PIXEL_BGRX8, f->out_bpp)(dst, src + x0 * 4, n);
+				break;
+			}
+			// fall through
+		case 16:
+			ConvertBitFields(f, src + x0 * (f->bpp / 8), n, dst);
+			break;
+	}
+}
+
+/**
+ * Decode RLE4 or RLE8 data. Skipped pixels must already be black.
+ *
+ * @param f The source format.
+ * @param src The compressed data.
+ * @param size The size of the compressed data.
+ * @param pixels The pixel data of the destination.
+ */
+static void DecodeRLE(const struct BMPFormat* f, const UINT8* src, UINTN size, UINT8* pixels) {
+	const UINTN stride = BMPStride(f->width, f->out_bpp);
+	const UINTN out_bytes = f->out_bpp / 8;
+	UINT32 x = 0, y = 0;
+	UINTN i = 0;
+	while (i + 2 <= size && y < f->height) {
+		UINT8 n = src[i], c = src[i + 1];
+		i += 2;
+		if (n) {
+			// Encoded run: n pixels alternating between the two nibbles (RLE4) or one index (RLE8).
+			for (UINT32 k = 0; k < n && x < f->width; ++k, ++x) {
+				UINT8 index = f->bpp == 8 ? c : (k & 1) ? c & 0x0f : c >> 4;
+				CopyMem(pixels + y * stride + x * out_bytes, &f->palette[index], 3);
+			}
+		} else if (c == 0) {
+			// End of line.
+			x = 0;
+			++y;
+		} else if (c == 1) {
+			// End of bitmap.
+			break;
+		} else if (c == 2) {
+			// Delta.
+			if (i + 2 > size) {
+				break;
+			}
+			x += src[i];
+			y += src[i + 1];
+			i += 2;
+		} else {
+			// Absolute run of c pixels, padded to 16 bits.
+			UINTN bytes = f->bpp == 8 ? c : (c + 1) / 2;
+			if (i + bytes > size) {
+				break;
+			}
+			for (UINT32 k = 0; k < c; ++k, ++x) {
+				if (x >= f->width) {
+					continue;
+				}
+				UINT8 index = f->bpp == 8 ? src[i + k] : (k & 1) ? src[i + k / 2] & 0x0f : src[i + k / 2] >> 4;
+				CopyMem(pixels + y * stride + x * out_bytes, &f->palette[index], 3);
+			}
+			i += (bytes + 1) & ~(UINTN)1;
+		}
+	}
+}
+
+BMP* DecodeBMP(void* data, UINTN size, struct HackBGRT_writer* writer) {
+	BMP* src = data;
+	const UINT8* bytes = data;
+	if (size < sizeof(BMP) || src->magic_BM[0] != 'B' || src->magic_BM[1] != 'M') {
+		LogDebug(L"HackBGRT: Not a BMP file.\n");
+		return 0;
+	}
+
+	const UINT32 dib = src->dib_header_size;
+	if (dib != 40 && dib != 52 && dib != 56 && dib != 108 && dib != 124) {
+		LogDebug(L"HackBGRT: Unsupported BMP header size %d.\n", dib);
+		return 0;
+	}
+
+	struct BMPFormat f = {0};
+	const INT32 height = (INT32) src->height;
+	const BOOLEAN top_down = height < 0;
+	f.width = src->width;
+	f.height = top_down ? -height : height;
+	f.bpp = src->bpp;
+	f.out_bpp = writer->bpp;
+	const UINT32 compression = src->biCompression;
+	LogDebug(L"HackBGRT: BMP %d x %d, %d bpp, compression %d, header %d.\n", f.width, height, f.bpp, compression, dib);
+
+	if (!f.width || !f.height || f.width > 0x8000 || f.height > 0x8000 || src->planes != 1) {
+		LogDebug(L"HackBGRT: Invalid BMP size.\n");
+		return 0;
+	}
+	const BOOLEAN rle =
+		(compression == BI_RLE8 && f.bpp == 8) ||
+		(compression == BI_RLE4 && f.bpp == 4);
+	const BOOLEAN bitfields =
+		(compression == BI_BITFIELDS || compression == BI_ALPHABITFIELDS) &&
+		(f.bpp == 16 || f.bpp == 32);
+	const BOOLEAN plain =
+		compression == BI_RGB &&
+		(f.bpp == 1 || f.bpp == 4 || f.bpp == 8 || f.bpp == 16 || f.bpp == 24 || f.bpp == 32);
+	if (!rle && !bitfields && !plain) {
+		LogDebug(L"HackBGRT: Unsupported BMP format.\n");
+		return 0;
+	}
+	if (rle && top_down) {
+		LogDebug(L"HackBGRT: Invalid top-down RLE BMP.\n");
+		return 0;
+	}
+
+	const UINT32 offset = src->pixel_data_offset;
+	const UINT32 src_stride = BMPStride(f.width, f.bpp);
+	const UINT32 src_row_bytes = (f.width * f.bpp + 7) / 8;
+	if (offset < sizeof(BMP) || offset > size || (!rle && size - offset < (UINTN) src_stride * (f.height - 1) + src_row_bytes)) {
+		LogDebug(L"HackBGRT: Truncated BMP.\n");
+		return 0;
+	}
+
+	// Already in the BGRT format and not scaled or rotated? Use as is.
+	UINT32 scaled_w, scaled_h;
+	WriterScaledSize(writer, f.width, f.height, &scaled_w, &scaled_h);
+	const BOOLEAN scaled = scaled_w != f.width || scaled_h != f.height;
+	if (plain && (f.bpp == 24 || f.bpp == 32) && !top_down && dib == 40 && offset == sizeof(BMP) && !scaled && !writer->rotate && BMPSize(f.width, f.height, f.bpp) <= BMP_MAX_SIZE) {
+		LogDebug(L"HackBGRT: BMP is compatible, no conversion.\n");
+		return src;
+	}
+
+	// Palette.
+	if (f.bpp <= 8) {
+		UINTN colors = src->biClrUsed ? src->biClrUsed : 1 << f.bpp;
+		colors = min(colors, 256);
+		if (14 + dib + colors * 4 > offset) {
+			LogDebug(L"HackBGRT: Truncated BMP palette.\n");
+			return 0;
+		}
+		for (UINTN i = 0; i < colors; ++i) {
+			f.palette[i] = ReadLE32(bytes + 14 + dib + i * 4) & 0x00ffffff;
+		}
+	}
+
+	// Bit fields; the masks follow the 40-byte part of the header.
+	UINT32 masks[3] = {0x00ff0000, 0x0000ff00, 0x000000ff};
+	if (f.bpp == 16) {
+		masks[0] = 0x7c00, masks[1] = 0x03e0, masks[2] = 0x001f;
+	}
+	if (bitfields) {
+		if (14 + 40 + 12 > offset) {
+			LogDebug(L"HackBGRT: Truncated BMP bit fields.\n");
+			return 0;
+		}
+		for (int i = 0; i < 3; ++i) {
+			masks[i] = ReadLE32(bytes + 14 + 40 + 4 * i);
+		}
+	}
+	if (f.bpp == 16 || f.bpp == 32) {
+		if (!InitChannel(&f.red, masks[0]) || !InitChannel(&f.green, masks[1]) || !InitChannel(&f.blue, masks[2])) {
+			LogDebug(L"HackBGRT: Invalid BMP bit fields.\n");
+			return 0;
+		}
+		f.plain32 = f.bpp == 32 && masks[0] == 0x00ff0000 && masks[1] == 0x0000ff00 && masks[2] == 0x000000ff;
+	}
+
+	// RLE jumps around the image, so it's decoded whole and then fed to the writer.
+	BMP* rle_bmp = 0;
+	if (rle) {
+		rle_bmp = CreateBMP(f.width, f.height, f.out_bpp);
+		if (!rle_bmp) {
+			return 0;
+		}
+		UINT8* pixels = (UINT8*) rle_bmp + rle_bmp->pixel_data_offset;
+		ZeroMem(pixels, rle_bmp->biSizeImage);
+		DecodeRLE(&f, bytes + offset, size - offset, pixels);
+	}
+
+	if (!WriterBegin(writer, f.width, f.height)) {
+		FreeBMP(rle_bmp);
+		return 0;
+	}
+	// Only the region of interest is converted.
+	const UINT32 out_bytes = f.out_bpp / 8;
+	for (UINT32 y = writer->roi_y; y < writer->roi_y + writer->roi_h; ++y) {
+		UINT8* dst = WriterRow(writer, y);
+		if (rle_bmp) {
+			CopyMem(dst, BMPRow(rle_bmp, y) + writer->roi_x * out_bytes, writer->roi_w * out_bytes);
+		} else {
+			// The rows are counted from the top; a bottom-up file stores them in reverse.
+			ConvertRow(&f, bytes + offset + (top_down ? y : f.height - 1 - y) * src_stride, writer->roi_x, writer->roi_w, dst);
+		}
+		WriterCommit(writer, y);
+	}
+	FreeBMP(rle_bmp);
+	return WriterEnd(writer);
+}
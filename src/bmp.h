@@ -0,0 +1,106 @@
+#pragma once
+
+#include "types.h"
+
+struct HackBGRT_writer;
+
+/**
+ * The largest BMP that CreateBMP makes, in bytes, including the header.
+ * An 8192x8192 image with 32 bits per pixel fits; the sizes and row offsets
+ * of any BMP within the limit also fit in 32 bits.
+ */
+#define BMP_MAX_SIZE 0x20000000
+
+/**
+ * Allocate a new bottom-up BMP with a 54-byte header.
+ *
+ * The allocation is page-aligned and the header is placed so that the
+ * pixel data starts at a 64-byte boundary; rows are 4-byte aligned.
+ *
+ * @param w The width.
+ * @param h The height.
+ * @param bpp The bits per pixel: 24 (BGR) or 32 (BGRX).
+ * @return The new BMP (pixel data uninitialized), or 0 on failure or if the BMP would exceed BMP_MAX_SIZE.
+ */
+extern BMP* CreateBMP(UINT32 w, UINT32 h, UINT32 bpp);
+
+/**
+ * Free a BMP allocated with CreateBMP.
+ */
+extern void FreeBMP(BMP* bmp);
+
+/**
+ * Get the number of bytes in a pixel row of a BMP, including padding.
+ */
+static inline UINT32 BMPStride(UINT32 w, UINT32 bpp) {
+	return ((w * bpp + 31) / 32) * 4;
+}
+
+/**
+ * Get the size of a BMP made by CreateBMP, computed in 64 bits so that it can't wrap.
+ */
+static inline UINT64 BMPSize(UINT32 w, UINT32 h, UINT32 bpp) {
+	return ((UINT64) w * bpp + 31) / 32 * 4 * h + sizeof(BMP);
+}
+
+/**
+ * Get a pixel row of a bottom-up BMP.
+ *
+ * @param bmp The BMP.
+ * @param y The row number, counting from the top.
+ * @return Pointer to the pixel row.
+ */
+static inline UINT8* BMPRow(BMP* bmp, UINT32 y) {
+	return (UINT8*) bmp + bmp->pixel_data_offset + (bmp->height - 1 - y) * BMPStride(bmp->width, bmp->bpp);
+}
+
+/**
+ * Check whether a part of a pixel row is black. The reserved byte of
+ * 32-bit pixels is ignored. There is no early exit, so that the compiler
+ * can vectorize the loops.
+ *
+ * @param row The pixel row; needs no alignment.
+ * @param x0 The first pixel.
+ * @param x1 The end of the range.
+ * @param bpp The bits per pixel: 24 or 32.
+ * @return TRUE if all the pixels are black.
+ */
+extern BOOLEAN BMPIsBlack(const UINT8* row, UINT32 x0, UINT32 x1, UINT32 bpp);
+
+/**
+ * Find the bounding box of the pixels that are not black.
+ *
+ * @param bmp The BMP.
+ * @param x Returns the left edge.
+ * @param y Returns the top edge, counting from the top.
+ * @param w Returns the width.
+ * @param h Returns the height.
+ * @return FALSE if the whole BMP is black, TRUE otherwise.
+ */
+extern BOOLEAN BMPContentBox(BMP* bmp, UINT32* x, UINT32* y, UINT32* w, UINT32* h);
+
+/**
+ * Crop a bottom-up BMP in place to a part of it.
+ *
+ * @param bmp The BMP.
+ * @param x The left edge.
+ * @param y The top edge, counting from the top.
+ * @param w The width.
+ * @param h The height.
+ * @param created TRUE if the BMP is from CreateBMP; the pages after the cropped BMP are freed.
+ */
+extern void CropBMP(BMP* bmp, UINT32 x, UINT32 y, UINT32 w, UINT32 h, BOOLEAN created);
+
+/**
+ * Validate a BMP file and convert it to the format accepted by the BGRT.
+ *
+ * Accepts BITMAPINFOHEADER and the longer V2-V5 headers; 1, 4 and 8-bit
+ * palettes, RLE4 and RLE8, 16-bit and 32-bit (also with bit fields), and
+ * 24-bit images, both bottom-up and top-down.
+ *
+ * @param data The file contents.
+ * @param size The file size.
+ * @param writer The writer for a converted or scaled BMP; see writer.h.
+ * @return data itself, if it's already compatible; a new BMP if it was converted; 0 on failure.
+ */
+extern BMP* DecodeBMP(void* data, UINTN size, struct HackBGRT_writer* writer);
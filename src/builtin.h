@@ -0,0 +1,12 @@
+#pragma once
+
+/**
+ * The builtin image (path=builtin:), an HBI file compiled into the binary.
+ * The Makefile generates it from BUILTIN_IMAGE with tools/hbienc.
+ */
+extern const unsigned char builtin_image[];
+
+/**
+ * The size of the builtin image in bytes.
+ */
+extern const unsigned int builtin_image_size;
@@ -0,0 +1,365 @@
+#include "cache.h"
+#include "bmp.h"
+#include "util.h"
+
+#include <efilib.h>
+
+/**
+ * The cache directory.
+ */
+#define CACHE_DIR L"\\EFI\\HackBGRT\\cache"
+
+/**
+ * The temporary file for writing a new entry.
+ */
+#define CACHE_TMP L"new.tmp"
+
+/**
+ * The maximum file name length (16 hex digits and ".hbc") plus null.
+ */
+#define CACHE_NAME_SIZE 32
+
+/**
+ * Everything that affects the cached image.
+ */
+struct CacheKey {
+	UINT64 path_hash;
+	UINT64 file_size;
+	UINT64 file_time;
+	UINT32 screen_w, screen_h;
+	UINT32 bpp, scale;
+	INT32 pos_x, pos_y;
+	INT32 native_x, native_y;
+	UINT32 native_w, native_h;
+	UINT32 rotate;
+};
+
+/**
+ * The header of a cache entry. The BMP follows it.
+ */
+struct CacheHeader {
+	CHAR8 magic[8];
+	struct CacheKey key;
+	INT32 offset_x, offset_y;
+};
+
+static const CHAR8 cache_magic[8] = {'H', 'B', 'G', 'R', 'T', 'C', '0', '2'};
+
+/**
+ * Hash data with 64-bit FNV-1a.
+ *
+ * @param h The previous hash value, or FNV_INIT.
+ * @param data The data.
+ * @param size The data size.
+ * @return The new hash value.
+ */
+#define FNV_INIT 0xcbf29ce484222325ULL
+static UINT64 Hash(UINT64 h, const void* data, UINTN size) {
+	const UINT8* p = data;
+	for (UINTN i = 0; i < size; ++i) {
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/**
+ * Convert a time to a number that sorts in time order.
+ */
+static UINT64 TimeValue(const EFI_TIME* t) {
+	return ((UINT64) t->Year << 40) | ((UINT64) t->Month << 32) | ((UINT64) t->Day << 24)
+		| ((UINT64) t->Hour << 16) | ((UINT64) t->Minute << 8) | t->Second;
+}
+
+/**
+ * Read exactly the given number of bytes.
+ */
+static BOOLEAN ReadAll(EFI_FILE_HANDLE handle, void* buffer, UINTN size) {
+	UINTN n = size;
+	return !EFI_ERROR(handle->Read(handle, &n, buffer)) && n == size;
+}
+
+/**
+ * Write exactly the given number of bytes.
+ */
+static BOOLEAN WriteAll(EFI_FILE_HANDLE handle, const void* buffer, UINTN size) {
+	UINTN n = size;
+	return !EFI_ERROR(handle->Write(handle, &n, (void*) buffer)) && n == size;
+}
+
+/**
+ * Build the cache key for an image.
+ *
+ * @param root_dir The root directory.
+ * @param path The source image path.
+ * @param writer The writer with its settings.
+ * @param key Returns the key.
+ * @return TRUE on success, FALSE if the source file is not available.
+ */
+static BOOLEAN MakeKey(EFI_FILE_HANDLE root_dir, const CHAR16* path, const struct HackBGRT_writer* writer, struct CacheKey* key) {
+	EFI_FILE_HANDLE handle;
+	if (EFI_ERROR(root_dir->Open(root_dir, &handle, (CHAR16*) path, EFI_FILE_MODE_READ, 0))) {
+		return FALSE;
+	}
+	EFI_FILE_INFO* info = LibFileInfo(handle);
+	handle->Close(handle);
+	if (!info) {
+		return FALSE;
+	}
+	ZeroMem(key, sizeof(*key));
+	// The ESP is FAT, so the paths are case-insensitive.
+	key->path_hash = FNV_INIT;
+	for (const CHAR16* c = path; *c; ++c) {
+		CHAR16 lower = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+		key->path_hash = Hash(key->path_hash, &lower, sizeof(lower));
+	}
+	key->file_size = info->FileSize;
+	key->file_time = TimeValue(&info->ModificationTime);
+	FreePool(info);
+	key->screen_w = writer->screen_w;
+	key->screen_h = writer->screen_h;
+	key->bpp = writer->bpp;
+	key->scale = writer->scale;
+	key->pos_x = writer->pos_x;
+	key->pos_y = writer->pos_y;
+	key->native_x = writer->native_x;
+	key->native_y = writer->native_y;
+	key->native_w = writer->native_w;
+	key->native_h = writer->native_h;
+	key->rotate = writer->rotate;
+	return TRUE;
+}
+
+/**
+ * Get the file name of a cache entry: the key hash in hex and ".hbc".
+ *
+ * @param key The key.
+ * @param name Returns the name; CACHE_NAME_SIZE characters.
+ */
+static void EntryName(const struct CacheKey* key, CHAR16* name) {
+	UINT64 h = Hash(FNV_INIT, key, sizeof(*key));
+	for (int i = 0; i < 16; ++i) {
+		name[i] = L"0123456789abcdef"[(h >> (60 - 4 * i)) & 15];
+	}
+	StrCpy(name + 16, L".hbc");
+}
+
+/**
+ * Open the cache directory.
+ *
+ * @param root_dir The root directory.
+ * @param create Whether to create the directory if it doesn't exist.
+ * @return The directory handle, or 0 on failure.
+ */
+static EFI_FILE_HANDLE OpenCacheDir(EFI_FILE_HANDLE root_dir, BOOLEAN create) {
+	EFI_FILE_HANDLE dir;
+	UINT64 mode = EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | (create ? EFI_FILE_MODE_CREATE : 0);
+	if (EFI_ERROR(root_dir->Open(root_dir, &dir, CACHE_DIR, mode, create ? EFI_FILE_DIRECTORY : 0))) {
+		return 0;
+	}
+	return dir;
+}
+
+/**
+ * Delete a file from a directory, if it exists.
+ */
+static void DeleteFile(EFI_FILE_HANDLE dir, const CHAR16* name) {
+	EFI_FILE_HANDLE handle;
+	if (!EFI_ERROR(dir->Open(dir, &handle, (CHAR16*) name, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0))) {
+		handle->Delete(handle);
+	}
+}
+
+/**
+ * Set the modification time of a file to the current time.
+ * The modification time tells which entries were used least recently.
+ */
+static void Touch(EFI_FILE_HANDLE handle) {
+	EFI_TIME now;
+	if (EFI_ERROR(RT->GetTime(&now, 0))) {
+		return;
+	}
+	EFI_FILE_INFO* info = LibFileInfo(handle);
+	if (!info) {
+		return;
+	}
+	info->ModificationTime = now;
+	handle->SetInfo(handle, &GenericFileInfo, info->Size, info);
+	FreePool(info);
+}
+
+/**
+ * Rename an open file within its directory.
+ *
+ * @param handle The file.
+ * @param name The new name.
+ * @return TRUE on success, FALSE on failure.
+ */
+static BOOLEAN Rename(EFI_FILE_HANDLE handle, const CHAR16* name) {
+	EFI_FILE_INFO* info = LibFileInfo(handle);
+	if (!info) {
+		return FALSE;
+	}
+	UINTN size = SIZE_OF_EFI_FILE_INFO + (StrLen(name) + 1) * sizeof(CHAR16);
+	EFI_FILE_INFO* new_info = 0;
+	BS->AllocatePool(EfiBootServicesData, size, (void**) &new_info);
+	if (!new_info) {
+		FreePool(info);
+		return FALSE;
+	}
+	CopyMem(new_info, info, SIZE_OF_EFI_FILE_INFO);
+	new_info->Size = size;
+	StrCpy(new_info->FileName, name);
+	EFI_STATUS status = handle->SetInfo(handle, &GenericFileInfo, size, new_info);
+	FreePool(new_info);
+	FreePool(info);
+	return !EFI_ERROR(status);
+}
+
+/**
+ * Delete the least recently used entries until the cache fits in the limit.
+ *
+ * @param dir The cache directory.
+ * @param limit The size limit in bytes.
+ */
+static void Evict(EFI_FILE_HANDLE dir, UINT64 limit) {
+	UINT64 buffer[(SIZE_OF_EFI_FILE_INFO + 256 * sizeof(CHAR16)) / sizeof(UINT64) + 1];
+	EFI_FILE_INFO* info = (EFI_FILE_INFO*) buffer;
+	for (;;) {
+		UINT64 total = 0, oldest_time = ~(UINT64) 0;
+		CHAR16 oldest[CACHE_NAME_SIZE] = {0};
+		dir->SetPosition(dir, 0);
+		for (;;) {
+			UINTN size = sizeof(buffer);
+			if (EFI_ERROR(dir->Read(dir, &size, info)) || !size) {
+				break;
+			}
+			if (info->Attribute & EFI_FILE_DIRECTORY) {
+				continue;
+			}
+			total += info->FileSize;
+			UINT64 time = TimeValue(&info->ModificationTime);
+			if (time < oldest_time && StrLen(info->FileName) < CACHE_NAME_SIZE) {
+				oldest_time = time;
+				StrCpy(oldest, info->FileName);
+			}
+		}
+		if (total <= limit || !oldest[0]) {
+			return;
+		}
+		LogDebug(L"HackBGRT: Cache has %ld bytes, evicting %s.\n", total, oldest);
+		EFI_FILE_HANDLE handle;
+		if (EFI_ERROR(dir->Open(dir, &handle, oldest, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0))) {
+			return;
+		}
+		// Delete only warns if it fails; stop instead of trying the same file again.
+		if (handle->Delete(handle) != EFI_SUCCESS) {
+			return;
+		}
+	}
+}
+
+BMP* CacheLoad(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
+	struct CacheKey key;
+	if (!MakeKey(root_dir, path, writer, &key)) {
+		return 0;
+	}
+	CHAR16 name[CACHE_NAME_SIZE];
+	EntryName(&key, name);
+
+	EFI_FILE_HANDLE dir = OpenCacheDir(root_dir, FALSE);
+	if (!dir) {
+		return 0;
+	}
+	EFI_FILE_HANDLE handle;
+	EFI_STATUS status = dir->Open(dir, &handle, name, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+	dir->Close(dir);
+	if (EFI_ERROR(status)) {
+		LogDebug(L"HackBGRT: Cache miss for %s (%s).\n", path, name);
+		return 0;
+	}
+
+	struct CacheHeader header;
+	BMP bmp_header;
+	BMP* bmp = 0;
+	if (ReadAll(handle, &header, sizeof(header))
+	&& CompareMem(header.magic, cache_magic, sizeof(cache_magic)) == 0
+	&& CompareMem(&header.key, &key, sizeof(key)) == 0
+	&& ReadAll(handle, &bmp_header, sizeof(bmp_header))
+	&& bmp_header.width > 0 && bmp_header.width <= 0x8000
+	&& bmp_header.height > 0 && bmp_header.height <= 0x8000
+	&& (bmp_header.bpp == 24 || bmp_header.bpp == 32)
+	&& bmp_header.file_size == BMPSize(bmp_header.width, bmp_header.height, bmp_header.bpp)
+	&& bmp_header.file_size <= BMP_MAX_SIZE) {
+		bmp = CreateBMP(bmp_header.width, bmp_header.height, bmp_header.bpp);
+		// The header must be exactly what CreateBMP makes.
+		if (bmp && (CompareMem(bmp, &bmp_header, sizeof(BMP)) != 0
+		|| !ReadAll(handle, (UINT8*) bmp + sizeof(BMP), bmp->file_size - sizeof(BMP)))) {
+			FreeBMP(bmp);
+			bmp = 0;
+		}
+	}
+	if (!bmp) {
+		LogDebug(L"HackBGRT: Deleting invalid cache entry %s.\n", name);
+		handle->Delete(handle);
+		return 0;
+	}
+	Touch(handle);
+	handle->Close(handle);
+
+	LogDebug(L"HackBGRT: Cache hit for %s (%s).\n", path, name);
+	writer->bmp = bmp;
+	writer->offset_x = header.offset_x;
+	writer->offset_y = header.offset_y;
+	return bmp;
+}
+
+void CacheStore(EFI_FILE_HANDLE root_dir, const CHAR16* path, const struct HackBGRT_writer* writer, UINT64 limit) {
+	const BMP* bmp = writer->bmp;
+	struct CacheHeader header;
+	ZeroMem(&header, sizeof(header));
+	CopyMem(header.magic, cache_magic, sizeof(cache_magic));
+	if (!bmp || !MakeKey(root_dir, path, writer, &header.key)) {
+		return;
+	}
+	header.offset_x = writer->offset_x;
+	header.offset_y = writer->offset_y;
+	UINT64 size = sizeof(header) + bmp->file_size;
+	if (size > limit) {
+		LogDebug(L"HackBGRT: Image is too big for the cache (%ld bytes).\n", size);
+		return;
+	}
+	CHAR16 name[CACHE_NAME_SIZE];
+	EntryName(&header.key, name);
+
+	EFI_FILE_HANDLE dir = OpenCacheDir(root_dir, TRUE);
+	if (!dir) {
+		LogDebug(L"HackBGRT: Failed to open the cache directory.\n");
+		return;
+	}
+
+	// Make room first, so that the new entry is never the one evicted.
+	// A leftover temporary file from an interrupted write goes too.
+	DeleteFile(dir, CACHE_TMP);
+	Evict(dir, limit - size);
+
+	// Write to a temporary file and rename it only when it's complete,
+	// so that a reset in the middle can't leave a broken entry behind.
+	EFI_FILE_HANDLE handle;
+	if (EFI_ERROR(dir->Open(dir, &handle, CACHE_TMP, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0))) {
+		LogDebug(L"HackBGRT: Failed to create a cache entry.\n");
+		dir->Close(dir);
+		return;
+	}
+	DeleteFile(dir, name);
+	if (WriteAll(handle, &header, sizeof(header))
+	&& WriteAll(handle, bmp, bmp->file_size)
+	&& !EFI_ERROR(handle->Flush(handle))
+	&& Rename(handle, name)) {
+		handle->Close(handle);
+		LogDebug(L"HackBGRT: Cached %s as %s.\n", path, name);
+	} else {
+		handle->Delete(handle);
+		LogDebug(L"HackBGRT: Failed to write cache entry %s.\n", name);
+	}
+	dir->Close(dir);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.h"
+#include "writer.h"
+
+/*
+ * Cache of decoded images on the ESP, in \EFI\HackBGRT\cache\.
+ *
+ * An entry holds the finished BGRT bitmap and its position. It is keyed by
+ * the source path, size and modification time, and by the writer settings
+ * (resolution, bpp, scaling, position, rotation) that affect the result.
+ */
+
+/**
+ * Load a decoded image from the cache.
+ *
+ * On success, writer->bmp, offset_x and offset_y are set as if the writer
+ * had produced the image.
+ *
+ * @param root_dir The root directory.
+ * @param path The source image path.
+ * @param writer The writer with its settings.
+ * @return The BMP, or 0 if it's not in the cache.
+ */
+extern BMP* CacheLoad(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer);
+
+/**
+ * Store the image produced by a writer in the cache, then evict the least
+ * recently used entries until the cache fits in the size limit.
+ *
+ * @param root_dir The root directory.
+ * @param path The source image path.
+ * @param writer The writer after WriterEnd.
+ * @param limit The cache size limit in bytes.
+ */
+extern void CacheStore(EFI_FILE_HANDLE root_dir, const CHAR16* path, const struct HackBGRT_writer* writer, UINT64 limit);
@@ -3,24 +3,33 @@
 
 #include <efilib.h>
 
+#include "../my_efilib/my_efilib.h"
+
 BOOLEAN ReadConfigFile(struct HackBGRT_config* config, EFI_FILE_HANDLE root_dir, const CHAR16* path) {
 	void* data = 0;
 	UINTN data_bytes = 0;
 	data = LoadFileWithPadding(root_dir, path, &data_bytes, 4);
 	if (!data) {
-		Print(L"HackBGRT: Failed to load configuration (%s)!\n", path);
+		LogError(L"HackBGRT: Failed to load configuration (%s)!\n", path);
 		return FALSE;
 	}
 	CHAR16* str;
 	UINTN str_len;
 	if (*(CHAR16*)data == 0xfeff) {
 		// UCS-2
-		str = data;
 		str_len = data_bytes / sizeof(*str);
+		str = malloc((str_len + 1) * sizeof(*str));
+		if (!str) {
+			FreePool(data);
+			return FALSE;
+		}
+		CopyMem(str, data, str_len * sizeof(*str));
+		str[str_len] = 0;
+		FreePool(data);
 	} else {
 		// UTF-8 -> UCS-2
-		EFI_STATUS e = BS->AllocatePool(EfiBootServicesData, data_bytes * 2 + 2, (void**)&str);
-		if (EFI_ERROR(e)) {
+		str = malloc(data_bytes * 2 + 2);
+		if (!str) {
 			FreePool(data);
 			return FALSE;
 		}
@@ -66,22 +75,22 @@ BOOLEAN ReadConfigFile(struct HackBGRT_config* config, EFI_FILE_HANDLE root_dir,
 		ReadConfigLine(config, root_dir, &str[i]);
 		i = j;
 	}
-	// NOTICE: string is not freed, because paths are not copied.
+	// NOTICE: string is kept in the arena, because paths are not copied.
+	// efi_main takes its scratch mark after the config, so it stays.
 	return TRUE;
 }
 
-static void SetBMPWithRandom(struct HackBGRT_config* config, int weight, enum HackBGRT_action action, int x, int y, const CHAR16* path) {
-	config->image_weight_sum += weight;
+static void SetBMPWithRandom(struct HackBGRT_config* config, const struct HackBGRT_image* image) {
+	config->image_weight_sum += image->weight;
 	UINT32 random = Random();
-	UINT32 limit = 0xfffffffful / config->image_weight_sum * weight;
-	if (config->debug) {
-		Print(L"HackBGRT: weight %d, action %d, x %d, y %d, path %s, random = %08x, limit = %08x\n", weight, action, x, y, path, random, limit);
-	}
+	UINT32 limit = 0xfffffffful / config->image_weight_sum * image->weight;
+	LogDebug(L"HackBGRT: weight %d, action %d, x %d, y %d, rotate %d, path %s, random = %08x, limit = %08x\n", image->weight, image->action, image->x, image->y, image->rotate, image->path, random, limit);
 	if (!config->image_weight_sum || random <= limit) {
-		config->action = action;
-		config->image_path = path;
-		config->image_x = x;
-		config->image_y = y;
+		config->action = image->action;
+		config->image_path = image->path;
+		config->image_x = image->x;
+		config->image_y = image->y;
+		config->image_rotate = image->rotate;
 	}
 }
 
@@ -99,6 +108,8 @@ static void ReadConfigImage(struct HackBGRT_config* config, const CHAR16* line)
 	const CHAR16* n = StrStrAfter(line, L"n=");
 	const CHAR16* x = StrStrAfter(line, L"x=");
 	const CHAR16* y = StrStrAfter(line, L"y=");
+	const CHAR16* r = StrStrAfter(line, L"for=");
+	const CHAR16* rot = StrStrAfter(line, L"rotate=");
 	const CHAR16* f = StrStrAfter(line, L"path=");
 	enum HackBGRT_action action = HackBGRT_KEEP;
 	if (f) {
@@ -110,11 +121,65 @@ static void ReadConfigImage(struct HackBGRT_config* config, const CHAR16* line)
 	} else if (StrStr(line, L"keep")) {
 		action = HackBGRT_KEEP;
 	} else {
-		Print(L"HackBGRT: Invalid image line: %s\n", line);
+		LogError(L"HackBGRT: Invalid image line: %s\n", line);
 		return;
 	}
-	int weight = n && (!f || n < f) ? Atoi(n) : 1;
-	SetBMPWithRandom(config, weight, action, ParseCoordinate(x, action), ParseCoordinate(y, action), f);
+	if (config->image_count == HackBGRT_MAX_IMAGES) {
+		LogError(L"HackBGRT: Too many image lines: %s\n", line);
+		return;
+	}
+	struct HackBGRT_image* image = &config->images[config->image_count++];
+	image->weight = n && (!f || n < f) ? Atoi(n) : 1;
+	image->action = action;
+	image->x = ParseCoordinate(x, action);
+	image->y = ParseCoordinate(y, action);
+	image->path = f;
+	image->for_w = image->for_h = 0;
+	image->rotate = rot && (!f || rot < f) ? Atoi(rot) : 0;
+	if (image->rotate != 90 && image->rotate != 180 && image->rotate != 270) {
+		image->rotate = 0;
+	}
+	if (r && (!f || r < f)) {
+		const CHAR16* r_y = StrStrAfter(r, L"x");
+		image->for_w = Atoi(r);
+		image->for_h = r_y ? Atoi(r_y) : 0;
+	}
+}
+
+/**
+ * Calculate how far a target resolution is from the screen resolution,
+ * in the same order of preference as SetResolution: the sum of missing
+ * w/h first, then the sum of extra w/h.
+ */
+static UINT64 ResolutionDistance(int for_w, int for_h, int w, int h) {
+	UINT64 missing = max(w - for_w, 0) + max(h - for_h, 0);
+	UINT64 extra = max(for_w - w, 0) + max(for_h - h, 0);
+	return (missing << 32) | extra;
+}
+
+void SelectImage(struct HackBGRT_config* config, int w, int h) {
+	// Find the closest target resolution.
+	int best_w = 0, best_h = 0;
+	for (int i = 0; i < config->image_count; ++i) {
+		const struct HackBGRT_image* image = &config->images[i];
+		if (image->for_w && (!best_w || ResolutionDistance(image->for_w, image->for_h, w, h) < ResolutionDistance(best_w, best_h, w, h))) {
+			best_w = image->for_w;
+			best_h = image->for_h;
+		}
+	}
+	if (best_w) {
+		LogDebug(L"HackBGRT: Resolution %dx%d, using image variants for %dx%d.\n", w, h, best_w, best_h);
+	}
+
+	// Choose randomly among that variant and the images without a target resolution.
+	config->image_weight_sum = 0;
+	for (int i = 0; i < config->image_count; ++i) {
+		const struct HackBGRT_image* image = &config->images[i];
+		if (image->for_w && (image->for_w != best_w || image->for_h != best_h)) {
+			continue;
+		}
+		SetBMPWithRandom(config, image);
+	}
 }
 
 static void ReadConfigResolution(struct HackBGRT_config* config, const CHAR16* line) {
@@ -124,7 +189,7 @@ static void ReadConfigResolution(struct HackBGRT_config* config, const CHAR16* l
 		config->resolution_x = *x == '-' ? -(int)Atoi(x+1) : (int)Atoi(x);
 		config->resolution_y = *y == '-' ? -(int)Atoi(y+1) : (int)Atoi(y);
 	} else {
-		Print(L"HackBGRT: Invalid resolution line: %s\n", line);
+		LogError(L"HackBGRT: Invalid resolution line: %s\n", line);
 	}
 }
 
@@ -138,6 +203,19 @@ void ReadConfigLine(struct HackBGRT_config* config, EFI_FILE_HANDLE root_dir, co
 		config->debug = (StrCmp(line, L"debug=1") == 0);
 		return;
 	}
+	if (StrnCmp(line, L"log=", 4) == 0) {
+		config->log_level =
+			StrCmp(line, L"log=error") == 0 ? LOG_ERROR :
+			StrCmp(line, L"log=info") == 0 ? LOG_INFO :
+			StrCmp(line, L"log=debug") == 0 ? LOG_DEBUG :
+			StrCmp(line, L"log=trace") == 0 ? LOG_TRACE :
+			-1;
+		return;
+	}
+	if (StrnCmp(line, L"logfile=", 8) == 0) {
+		config->log_file = (StrCmp(line, L"logfile=1") == 0);
+		return;
+	}
 	if (StrnCmp(line, L"image=", 6) == 0) {
 		ReadConfigImage(config, line + 6);
 		return;
@@ -154,5 +232,32 @@ void ReadConfigLine(struct HackBGRT_config* config, EFI_FILE_HANDLE root_dir, co
 		ReadConfigResolution(config, line + 11);
 		return;
 	}
-	Print(L"Unknown configuration directive: %s\n", line);
+	if (StrnCmp(line, L"bpp=", 4) == 0) {
+		config->bpp = (StrCmp(line, L"bpp=32") == 0) ? 32 : 24;
+		return;
+	}
+	if (StrnCmp(line, L"scale=", 6) == 0) {
+		config->scale =
+			StrCmp(line, L"scale=fit") == 0 ? HackBGRT_SCALE_FIT :
+			StrCmp(line, L"scale=fill") == 0 ? HackBGRT_SCALE_FILL :
+			HackBGRT_SCALE_NONE;
+		return;
+	}
+	if (StrnCmp(line, L"autocrop=", 9) == 0) {
+		config->autocrop = (StrCmp(line, L"autocrop=1") == 0);
+		return;
+	}
+	if (StrnCmp(line, L"preview=", 8) == 0) {
+		config->preview = (StrCmp(line, L"preview=1") == 0);
+		return;
+	}
+	if (StrnCmp(line, L"simd=", 5) == 0) {
+		config->simd_off = (StrCmp(line, L"simd=off") == 0);
+		return;
+	}
+	if (StrnCmp(line, L"cache=", 6) == 0) {
+		config->cache_size = Atoi(line + 6);
+		return;
+	}
+	LogError(L"Unknown configuration directive: %s\n", line);
 }
@@ -18,18 +18,55 @@ enum HackBGRT_coordinate {
 	HackBGRT_coord_native = 0x10000002
 };
 
+/**
+ * Possible ways to scale the image to the screen.
+ */
+enum HackBGRT_scale {
+	HackBGRT_SCALE_NONE = 0, HackBGRT_SCALE_FIT, HackBGRT_SCALE_FILL
+};
+
+/**
+ * The maximum number of image lines in the configuration.
+ */
+#define HackBGRT_MAX_IMAGES 32
+
+/**
+ * An image line from the configuration.
+ */
+struct HackBGRT_image {
+	int weight;
+	enum HackBGRT_action action;
+	int x;
+	int y;
+	const CHAR16* path;
+	int for_w; // The target resolution (for=WxH), or 0 for any.
+	int for_h;
+	int rotate; // The clockwise rotation in degrees: 0, 90, 180 or 270.
+};
+
 /**
  * The configuration.
  */
 struct HackBGRT_config {
 	int debug;
+	int log_level; // The enum LogLevel from log=, or -1 to follow debug=.
+	int log_file; // Whether to write the log to \EFI\HackBGRT\log.txt.
+	struct HackBGRT_image images[HackBGRT_MAX_IMAGES];
+	int image_count;
 	enum HackBGRT_action action;
 	const CHAR16* image_path;
 	int image_x;
 	int image_y;
+	int image_rotate;
 	int image_weight_sum;
 	int resolution_x;
 	int resolution_y;
+	int bpp;
+	enum HackBGRT_scale scale;
+	int cache_size; // The size limit of the image cache in MiB, or 0 to disable it.
+	int preview; // Show the image on the screen right after loading it.
+	int autocrop; // Trim the black margins of the image.
+	int simd_off; // Use only the plain C kernels, for comparing the timings.
 	const CHAR16* boot_path;
 };
 
@@ -42,6 +79,17 @@ struct HackBGRT_config {
  */
 extern void ReadConfigLine(struct HackBGRT_config* config, EFI_FILE_HANDLE root_dir, const CHAR16* line);
 
+/**
+ * Select the image: the closest resolution variant (for=WxH) and the lines
+ * without a target resolution take part in a weighted random choice.
+ * Sets action, image_path, image_x, image_y and image_rotate.
+ *
+ * @param config The configuration to modify.
+ * @param w The current horizontal resolution.
+ * @param h The current vertical resolution.
+ */
+extern void SelectImage(struct HackBGRT_config* config, int w, int h);
+
 /**
  * Read a configuration file. (May recursively read more files.)
  *
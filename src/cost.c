@@ -0,0 +1,262 @@
+#include "cost.h"
+#include "util.h"
+
+#include <efilib.h>
+
+/**
+ * The UEFI variable for the model: HackBGRTCost in the HackBGRT namespace.
+ */
+#define COST_VARIABLE L"HackBGRTCost"
+#define HACKBGRT_VARIABLE_GUID \
+	{ 0x7c3a8f1e, 0x52d4, 0x4b9e, { 0x9a, 0x61, 0x3e, 0x0f, 0xc2, 0x8b, 0x44, 0xd7 } }
+
+/**
+ * The version of struct CostModel; a variable with another version is ignored.
+ */
+#define COST_VERSION 3
+
+/**
+ * Reads smaller than this are mostly overhead and don't tell the throughput.
+ */
+#define COST_MIN_READ 16384
+
+/**
+ * The number of saves while the averages are still converging. After that,
+ * only a change by more than a half (a new disk, firmware settings) is saved,
+ * so that noisy boots don't rewrite the variable over and over.
+ */
+#define COST_CONVERGING_SAVES 8
+
+/**
+ * The number of images whose sizes are kept.
+ */
+#define COST_FILES 8
+
+/**
+ * The sizes of a loaded image.
+ */
+struct CostFile {
+	UINT32 path_hash; // 0 for an unused entry.
+	UINT32 read_bytes; // The bytes read for decoding the image; 0 if not known.
+	UINT32 cached_bytes; // The size of the cache entry; 0 if not cached.
+};
+
+/**
+ * The measured costs. Zero means not measured yet.
+ */
+struct CostModel {
+	UINT32 version;
+	UINT32 read; // Ticks per KiB read.
+	UINT32 decode[COST_FORMATS]; // Ticks per 1024 pixels decoded.
+	UINT32 saves; // The number of times the model has been saved.
+	struct CostFile files[COST_FILES]; // The most recently added first.
+};
+
+static struct CostModel model, saved;
+static BOOLEAN loaded;
+static UINT64 read_ticks, read_bytes_total;
+
+/**
+ * Load the model from the UEFI variable on the first use.
+ */
+static void Load(void) {
+	if (loaded) {
+		return;
+	}
+	loaded = TRUE;
+	EFI_GUID guid = HACKBGRT_VARIABLE_GUID;
+	UINT32 attributes;
+	UINTN size = sizeof(saved);
+	if (EFI_ERROR(RT->GetVariable(COST_VARIABLE, &guid, &attributes, &size, &saved)) || size != sizeof(saved) || saved.version != COST_VERSION) {
+		ZeroMem(&saved, sizeof(saved));
+		saved.version = COST_VERSION;
+	}
+	model = saved;
+}
+
+/**
+ * Add a measurement to a moving average, so that the model follows
+ * changes (a new disk, firmware settings) but isn't thrown off by one
+ * unlucky boot.
+ *
+ * @param value The average, or 0 if there is none yet.
+ * @param sample The new measurement.
+ */
+static void Average(UINT32* value, UINT64 sample) {
+	if (sample > 0xffffffff) {
+		sample = 0xffffffff;
+	}
+	if (!sample) {
+		sample = 1;
+	}
+	*value = *value ? (UINT32) (((UINT64) *value * 3 + sample) / 4) : (UINT32) sample;
+}
+
+void CostRecordRead(UINT64 bytes, UINT64 ticks) {
+	read_ticks += ticks;
+	read_bytes_total += bytes;
+	if (bytes < COST_MIN_READ || !ticks) {
+		return;
+	}
+	Load();
+	Average(&model.read, ticks * 1024 / bytes);
+}
+
+void CostRecordWait(UINT64 bytes, UINT64 ticks) {
+	read_ticks += ticks;
+	read_bytes_total += bytes;
+}
+
+UINT64 CostReadTicks(void) {
+	return read_ticks;
+}
+
+UINT64 CostReadBytes(void) {
+	return read_bytes_total;
+}
+
+void CostRecordDecode(enum CostFormat format, UINT64 pixels, UINT64 ticks) {
+	if (format >= COST_FORMATS || !pixels || !ticks) {
+		return;
+	}
+	Load();
+	Average(&model.decode[format], ticks * 1024 / pixels);
+}
+
+/**
+ * Hash a path for struct CostFile. FAT is case-insensitive, so is the hash.
+ *
+ * @param path The path.
+ * @return The FNV-1a hash of the path, never 0.
+ */
+static UINT32 PathHash(const CHAR16* path) {
+	UINT32 hash = 2166136261u;
+	for (; *path; ++path) {
+		CHAR16 c = *path >= 'A' && *path <= 'Z' ? *path - 'A' + 'a' : *path;
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash ? hash : 1;
+}
+
+/**
+ * Find the recorded sizes of an image.
+ *
+ * @param path The image path.
+ * @return The entry, or 0 if the image is not in the model.
+ */
+static struct CostFile* FindFile(const CHAR16* path) {
+	Load();
+	const UINT32 hash = PathHash(path);
+	for (int i = 0; i < COST_FILES; ++i) {
+		if (model.files[i].path_hash == hash) {
+			return &model.files[i];
+		}
+	}
+	return 0;
+}
+
+void CostRecordFile(const CHAR16* path, UINT64 read_bytes, UINT64 cached_bytes) {
+	struct CostFile* file = FindFile(path);
+	if (!file) {
+		// A new image replaces the one that was added first.
+		for (int i = COST_FILES - 1; i > 0; --i) {
+			model.files[i] = model.files[i - 1];
+		}
+		file = &model.files[0];
+		ZeroMem(file, sizeof(*file));
+		file->path_hash = PathHash(path);
+	}
+	if (read_bytes) {
+		file->read_bytes = read_bytes < 0xffffffff ? (UINT32) read_bytes : 0xffffffff;
+	}
+	file->cached_bytes = cached_bytes < 0xffffffff ? (UINT32) cached_bytes : 0xffffffff;
+}
+
+BOOLEAN CostFileSizes(const CHAR16* path, UINT64* read_bytes, UINT64* cached_bytes) {
+	const struct CostFile* file = FindFile(path);
+	*read_bytes = file ? file->read_bytes : 0;
+	*cached_bytes = file ? file->cached_bytes : 0;
+	return file != 0;
+}
+
+BOOLEAN CostEstimate(enum CostFormat format, UINT64 read_bytes, UINT64 pixels, UINT64* estimate) {
+	Load();
+	*estimate = 0;
+	if (read_bytes) {
+		if (!model.read) {
+			return FALSE;
+		}
+		*estimate += read_bytes * model.read / 1024;
+	}
+	if (format < COST_FORMATS) {
+		if (!model.decode[format] || !pixels) {
+			return FALSE;
+		}
+		*estimate += pixels * model.decode[format] / 1024;
+	}
+	return TRUE;
+}
+
+UINT64 CostMicroseconds(UINT64 ticks) {
+	static UINT64 ticks_per_ms;
+	if (!ticks_per_ms) {
+		UINT64 t0 = CostTicks();
+		BS->Stall(1000);
+		ticks_per_ms = CostTicks() - t0;
+		if (!ticks_per_ms) {
+			ticks_per_ms = 1;
+		}
+	}
+	return ticks * 1000 / ticks_per_ms;
+}
+
+void CostDebugPrint(void) {
+	Load();
+	LogDebug(L"HackBGRT: Cost model (0 = not measured): read %ld us/MiB, saved %d times.\n",
+		CostMicroseconds((UINT64) model.read * 1024), (int) model.saves);
+	LogDebug(L"HackBGRT: Decoding us/Mpixel: BMP %ld, PNG %ld, JPEG %ld, WebP %ld, HBI %ld, QOI %ld.\n",
+		CostMicroseconds((UINT64) model.decode[COST_BMP] * 1024),
+		CostMicroseconds((UINT64) model.decode[COST_PNG] * 1024),
+		CostMicroseconds((UINT64) model.decode[COST_JPEG] * 1024),
+		CostMicroseconds((UINT64) model.decode[COST_WEBP] * 1024),
+		CostMicroseconds((UINT64) model.decode[COST_HBI] * 1024),
+		CostMicroseconds((UINT64) model.decode[COST_QOI] * 1024));
+}
+
+/**
+ * Check whether a value has changed by more than old_value >> shift or become known.
+ */
+static BOOLEAN Changed(UINT64 old_value, UINT64 new_value, int shift) {
+	UINT64 diff = old_value > new_value ? old_value - new_value : new_value - old_value;
+	return !old_value != !new_value || diff > old_value >> shift;
+}
+
+void CostSave(void) {
+	if (!loaded) {
+		return;
+	}
+	// Writing the variable wears the flash, so small changes are not saved:
+	// more than 1/8 while converging, more than 1/2 afterwards.
+	int shift = saved.saves < COST_CONVERGING_SAVES ? 3 : 1;
+	BOOLEAN changed = Changed(saved.read, model.read, shift);
+	for (int i = 0; i < COST_FORMATS; ++i) {
+		changed = changed || Changed(saved.decode[i], model.decode[i], shift);
+	}
+	for (int i = 0; i < COST_FILES; ++i) {
+		changed = changed || saved.files[i].path_hash != model.files[i].path_hash
+			|| Changed(saved.files[i].read_bytes, model.files[i].read_bytes, shift)
+			|| Changed(saved.files[i].cached_bytes, model.files[i].cached_bytes, shift);
+	}
+	if (!changed) {
+		return;
+	}
+	EFI_GUID guid = HACKBGRT_VARIABLE_GUID;
+	UINT32 attributes = EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS;
+	model.saves = saved.saves + 1;
+	if (EFI_ERROR(RT->SetVariable(COST_VARIABLE, &guid, attributes, sizeof(model), &model))) {
+		LogDebug(L"HackBGRT: Failed to save the cost model.\n");
+		return;
+	}
+	saved = model;
+	LogDebug(L"HackBGRT: Saved the cost model.\n");
+}
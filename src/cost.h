@@ -0,0 +1,122 @@
+#pragma once
+
+#include <efi.h>
+
+/*
+ * Cost model for choosing between encodings of the same image.
+ *
+ * The read throughput of the ESP and the decoding speed of each format are
+ * measured on every boot and kept in a non-volatile UEFI variable, with the
+ * sizes of the recently loaded images. When a path lists several encodings
+ * ("a.bmp;a.hbi;a.png"), the one predicted to be the fastest on this
+ * machine is loaded, without opening the others.
+ */
+
+/**
+ * The image formats, for the decoding costs.
+ */
+enum CostFormat {
+	COST_BMP, COST_PNG, COST_JPEG, COST_WEBP, COST_HBI, COST_QOI, COST_FORMATS
+};
+
+/**
+ * Read the CPU timestamp counter.
+ *
+ * @return The current time in ticks, or 0 if there is no usable counter.
+ */
+static inline UINT64 CostTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	UINT32 lo, hi;
+	__asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((UINT64) hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Record the time of a file read.
+ *
+ * @param bytes The number of bytes read.
+ * @param ticks The time in ticks.
+ */
+extern void CostRecordRead(UINT64 bytes, UINT64 ticks);
+
+/**
+ * Record the time spent waiting for a read that ran in the background.
+ * It counts as reading time, but it doesn't tell the throughput.
+ *
+ * @param bytes The number of bytes read.
+ * @param ticks The time in ticks.
+ */
+extern void CostRecordWait(UINT64 bytes, UINT64 ticks);
+
+/**
+ * Get the total time of the recorded reads, to separate them from decoding.
+ *
+ * @return The sum of the ticks given to CostRecordRead and CostRecordWait.
+ */
+extern UINT64 CostReadTicks(void);
+
+/**
+ * Get the total size of the recorded reads, to measure the reads of an image.
+ *
+ * @return The sum of the bytes given to CostRecordRead and CostRecordWait.
+ */
+extern UINT64 CostReadBytes(void);
+
+/**
+ * Record the time of decoding an image, not including reading the file.
+ *
+ * @param format The image format.
+ * @param pixels The number of pixels decoded.
+ * @param ticks The time in ticks.
+ */
+extern void CostRecordDecode(enum CostFormat format, UINT64 pixels, UINT64 ticks);
+
+/**
+ * Record the sizes of a loaded image, so that later boots can estimate its
+ * costs without opening its files.
+ *
+ * @param path The image path.
+ * @param read_bytes The bytes read for decoding it, or 0 to keep the recorded size (a cache hit).
+ * @param cached_bytes The size of its cache entry, or 0 if it's not cached.
+ */
+extern void CostRecordFile(const CHAR16* path, UINT64 read_bytes, UINT64 cached_bytes);
+
+/**
+ * Get the recorded sizes of an image.
+ *
+ * @param path The image path.
+ * @param read_bytes Returns the bytes read for decoding it, or 0 if not known.
+ * @param cached_bytes Returns the size of its cache entry, or 0 if it's not cached.
+ * @return TRUE if the image has been loaded before, FALSE otherwise.
+ */
+extern BOOLEAN CostFileSizes(const CHAR16* path, UINT64* read_bytes, UINT64* cached_bytes);
+
+/**
+ * Estimate the time of loading an image.
+ *
+ * @param format The image format, or COST_FORMATS for an image that needs no decoding.
+ * @param read_bytes The number of bytes to read from the disk.
+ * @param pixels The number of pixels to decode.
+ * @param estimate Returns the estimated time in ticks.
+ * @return TRUE on success, FALSE if the costs haven't been measured yet.
+ */
+extern BOOLEAN CostEstimate(enum CostFormat format, UINT64 read_bytes, UINT64 pixels, UINT64* estimate);
+
+/**
+ * Convert ticks to microseconds for debug output.
+ * The first call measures the tick rate, which takes a millisecond.
+ */
+extern UINT64 CostMicroseconds(UINT64 ticks);
+
+/**
+ * Print the model with LogDebug.
+ */
+extern void CostDebugPrint(void);
+
+/**
+ * Save the model in the UEFI variable, if it has changed noticeably.
+ */
+extern void CostSave(void);
@@ -0,0 +1,49 @@
+#include "cpu.h"
+
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+
+/**
+ * Read an extended control register.
+ */
+static uint64_t Xgetbv(uint32_t index) {
+	uint32_t lo, hi;
+	__asm__ volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (index));
+	return ((uint64_t) hi << 32) | lo;
+}
+#endif
+
+enum CpuLevel CpuDetect(void) {
+#if defined(__x86_64__)
+	unsigned a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3)) {
+		return CPU_SSE2;
+	}
+	if (!(c & bit_SSE4_1)) {
+		return CPU_SSSE3;
+	}
+	// XCR0 bits 1 and 2: the firmware saves and has enabled the SSE and AVX state.
+	if (!(c & bit_OSXSAVE) || !(c & bit_AVX) || (Xgetbv(0) & 6) != 6) {
+		return CPU_SSE41;
+	}
+	if (__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_AVX2)) {
+		return CPU_AVX2;
+	}
+	return CPU_SSE41;
+#else
+	return CPU_GENERIC;
+#endif
+}
+
+const char* CpuLevelName(enum CpuLevel level) {
+	static const char* const names[] = {
+		[CPU_GENERIC] = "generic",
+		[CPU_SSE2] = "SSE2",
+		[CPU_SSSE3] = "SSSE3",
+		[CPU_SSE41] = "SSE4.1",
+		[CPU_AVX2] = "AVX2",
+	};
+	return names[level];
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * CPU feature detection for choosing the SIMD kernels.
+ *
+ * The binary is built for plain x86_64 (SSE2), so faster instruction sets
+ * are used only in kernels that are compiled for them separately and
+ * selected at run time. This doesn't depend on UEFI, so that the
+ * benchmarks can select the same kernels on the host.
+ */
+
+/**
+ * The instruction set levels that have kernels. Each level includes the
+ * lower ones; CPUs with AVX2 have all of the SSE extensions.
+ */
+enum CpuLevel {
+	CPU_GENERIC, // Plain C only.
+	CPU_SSE2,
+	CPU_SSSE3,
+	CPU_SSE41,
+	CPU_AVX2,
+};
+
+/**
+ * Detect the highest usable level with CPUID. AVX2 is used only if the
+ * firmware has enabled the AVX register state (XCR0); otherwise the
+ * instructions would fault.
+ *
+ * @return The level; CPU_GENERIC on other architectures.
+ */
+extern enum CpuLevel CpuDetect(void);
+
+/**
+ * Get the name of a level, for debug output.
+ *
+ * @param level The level.
+ * @return The name as an ASCII string.
+ */
+extern const char* CpuLevelName(enum CpuLevel level);
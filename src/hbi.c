@@ -0,0 +1,58 @@
+#include "hbi.h"
+#include "lz4.h"
+#include "../my_efilib/my_string.h"
+
+/**
+ * Get the tile index that follows the header.
+ */
+static inline const uint32_t* TileOffsets(const struct hbi_header* header) {
+	return (const uint32_t*) (header + 1);
+}
+
+const struct hbi_header* HBIParse(const void* data, size_t size) {
+	const struct hbi_header* header = data;
+	if (size < sizeof(*header)) {
+		return 0;
+	}
+	for (int i = 0; i < 4; ++i) {
+		if (header->magic[i] != HBI_MAGIC[i]) {
+			return 0;
+		}
+	}
+	if (header->width == 0 || header->width > HBI_MAX_SIZE || header->height == 0 || header->height > HBI_MAX_SIZE) {
+		return 0;
+	}
+	if ((header->bpp != 24 && header->bpp != 32) || header->tile_rows == 0 || header->tile_rows > HBI_MAX_SIZE) {
+		return 0;
+	}
+	if (header->tile_count != (header->height - 1) / header->tile_rows + 1) {
+		return 0;
+	}
+	const size_t index_end = sizeof(*header) + (header->tile_count + 1) * sizeof(uint32_t);
+	if (index_end > size) {
+		return 0;
+	}
+	// The tiles must be in order and within the file.
+	const uint32_t* offsets = TileOffsets(header);
+	if (offsets[0] < index_end || offsets[header->tile_count] > size) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < header->tile_count; ++i) {
+		if (offsets[i + 1] < offsets[i]) {
+			return 0;
+		}
+	}
+	return header;
+}
+
+int HBIDecodeTile(const struct hbi_header* header, uint32_t tile, uint8_t* dst) {
+	const uint32_t* offsets = TileOffsets(header);
+	const uint8_t* src = (const uint8_t*) header + offsets[tile];
+	const size_t src_size = offsets[tile + 1] - offsets[tile];
+	const size_t dst_size = HBITileRows(header, tile) * HBIStride(header);
+	if (src_size == dst_size) {
+		my_memcpy(dst, src, dst_size);
+		return 1;
+	}
+	return LZ4Decompress(dst, dst_size, src, src_size) == dst_size;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * HBI, the HackBGRT image format.
+ *
+ * The image is stored as raw BGR or BGRX rows, top to bottom, in tiles of
+ * a few rows. Each tile is compressed separately with LZ4, so the tiles
+ * can be decompressed in parallel and only the tiles with visible rows
+ * need to be decompressed at all.
+ *
+ * Layout, all numbers little-endian:
+ *  - struct hbi_header
+ *  - tile_count + 1 offsets (uint32_t) from the start of the file;
+ *    tile i is stored in the bytes from offset[i] to offset[i + 1].
+ *  - the tiles. A tile whose stored size equals its decompressed size
+ *    is stored uncompressed.
+ *
+ * This doesn't depend on UEFI, so that it can also be used by the host
+ * tools (see tools/hbienc.c).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HBI_MAGIC "HBI1"
+
+/**
+ * The maximum width and height.
+ */
+#define HBI_MAX_SIZE 0x8000
+
+/**
+ * The file header.
+ */
+struct hbi_header {
+	uint8_t magic[4];   // HBI_MAGIC
+	uint32_t width;
+	uint32_t height;
+	uint16_t bpp;       // 24 (BGR) or 32 (BGRX)
+	uint16_t reserved;  // 0
+	uint32_t tile_rows; // The number of rows in a tile; the last tile may have fewer.
+	uint32_t tile_count;
+};
+
+/**
+ * Get the number of bytes in a row.
+ */
+static inline size_t HBIStride(const struct hbi_header* header) {
+	return (size_t) header->width * (header->bpp / 8);
+}
+
+/**
+ * Get the number of rows in a tile.
+ */
+static inline uint32_t HBITileRows(const struct hbi_header* header, uint32_t tile) {
+	uint32_t y = tile * header->tile_rows;
+	return header->height - y < header->tile_rows ? header->height - y : header->tile_rows;
+}
+
+/**
+ * Check the header and the tile index of an HBI file.
+ *
+ * @param data The file contents; should be 4-byte aligned.
+ * @param size The file size.
+ * @return The header, or 0 if the file is not valid.
+ */
+extern const struct hbi_header* HBIParse(const void* data, size_t size);
+
+/**
+ * Decompress a tile.
+ *
+ * @param header The header returned by HBIParse.
+ * @param tile The tile number.
+ * @param dst The destination for HBITileRows() * HBIStride() bytes.
+ * @return 1 on success, 0 if the tile is corrupted.
+ */
+extern int HBIDecodeTile(const struct hbi_header* header, uint32_t tile, uint8_t* dst);
@@ -0,0 +1,136 @@
+#include "log.h"
+#include "cost.h"
+
+#include <efilib.h>
+
+enum LogLevel log_level = LOG_ERROR;
+
+/**
+ * The size of the ring buffer in characters. When it's full, the oldest
+ * characters are overwritten.
+ */
+#define LOG_BUFFER_SIZE 32768
+
+/**
+ * The longest message; longer messages are truncated.
+ */
+#define LOG_MESSAGE_SIZE 512
+
+static CHAR16 log_buffer[LOG_BUFFER_SIZE];
+
+// Counts of characters since the start; the buffer position is the count modulo the size.
+static UINTN log_end;
+static UINTN log_shown;
+
+static BOOLEAN log_line_start = TRUE;
+static UINT64 log_start_ticks;
+static UINT64 log_ticks_per_ms; // 0 until LogSetLevel has measured it.
+
+void LogInit(void) {
+	log_start_ticks = CostTicks();
+}
+
+void LogSetLevel(enum LogLevel level) {
+	log_level = level;
+	// Measuring the tick rate stalls for a millisecond, which is paid only
+	// when more than errors are logged, and before anything is timed.
+	if (level > LOG_ERROR && !log_ticks_per_ms) {
+		UINT64 t0 = CostTicks();
+		BS->Stall(1000);
+		log_ticks_per_ms = CostTicks() - t0;
+		log_ticks_per_ms = log_ticks_per_ms ? log_ticks_per_ms : 1;
+	}
+}
+
+/**
+ * Get the count of the oldest character still in the buffer.
+ */
+static UINTN LogBegin(void) {
+	return log_end > LOG_BUFFER_SIZE ? log_end - LOG_BUFFER_SIZE : 0;
+}
+
+/**
+ * Append a character to the buffer.
+ */
+static inline void Append(CHAR16 c) {
+	log_buffer[log_end++ % LOG_BUFFER_SIZE] = c;
+}
+
+void LogPrint(const CHAR16* fmt, ...) {
+	CHAR16 message[LOG_MESSAGE_SIZE];
+	va_list args;
+	va_start(args, fmt);
+	VSPrint(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	// Each line starts with the time since LogInit, like [   0.012345], once
+	// the tick rate is known. The console needs CR LF; so does Notepad for the log file.
+	CHAR16 stamp[24];
+	for (const CHAR16* s = message; *s; ++s) {
+		if (log_line_start && log_ticks_per_ms) {
+			UINT64 us = (CostTicks() - log_start_ticks) * 1000 / log_ticks_per_ms;
+			SPrint(stamp, sizeof(stamp), L"[%4ld.%06ld] ", us / 1000000, us % 1000000);
+			for (const CHAR16* t = stamp; *t; ++t) {
+				Append(*t);
+			}
+		}
+		log_line_start = FALSE;
+		if (*s == L'\n') {
+			Append(L'\r');
+			log_line_start = TRUE;
+		}
+		Append(*s);
+	}
+}
+
+void LogFlush(void) {
+	if (log_shown < LogBegin()) {
+		Print(L"HackBGRT: Log buffer full, %d characters lost.\n", (int) (LogBegin() - log_shown));
+		log_shown = LogBegin();
+	}
+	// OutputString needs null-terminated strings; a few big pieces are
+	// much faster than a call per message.
+	CHAR16 chunk[1024];
+	while (log_shown < log_end) {
+		UINTN n = 0;
+		for (; n < 1023 && log_shown < log_end; ++n, ++log_shown) {
+			chunk[n] = log_buffer[log_shown % LOG_BUFFER_SIZE];
+		}
+		chunk[n] = 0;
+		ST->ConOut->OutputString(ST->ConOut, chunk);
+	}
+}
+
+/**
+ * Write characters from the buffer up to the wrapping point.
+ */
+static BOOLEAN WriteRange(EFI_FILE_HANDLE handle, UINTN begin, UINTN end) {
+	UINTN offset = begin % LOG_BUFFER_SIZE;
+	UINTN count = end - begin;
+	if (offset + count > LOG_BUFFER_SIZE) {
+		count = LOG_BUFFER_SIZE - offset;
+	}
+	UINTN size = count * sizeof(CHAR16);
+	return !EFI_ERROR(handle->Write(handle, &size, &log_buffer[offset])) && size == count * sizeof(CHAR16);
+}
+
+BOOLEAN LogSave(EFI_FILE_HANDLE dir, const CHAR16* path) {
+	EFI_FILE_HANDLE handle;
+	// Opening doesn't truncate, so delete the old log first.
+	if (!EFI_ERROR(dir->Open(dir, &handle, (CHAR16*) path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0))) {
+		handle->Delete(handle);
+	}
+	if (EFI_ERROR(dir->Open(dir, &handle, (CHAR16*) path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0))) {
+		return FALSE;
+	}
+	CHAR16 bom = 0xfeff;
+	UINTN size = sizeof(bom);
+	UINTN begin = LogBegin();
+	UINTN middle = begin + (LOG_BUFFER_SIZE - begin % LOG_BUFFER_SIZE);
+	BOOLEAN ok = !EFI_ERROR(handle->Write(handle, &size, &bom));
+	ok = ok && WriteRange(handle, begin, middle < log_end ? middle : log_end);
+	ok = ok && (middle >= log_end || WriteRange(handle, middle, log_end));
+	ok = ok && !EFI_ERROR(handle->Flush(handle));
+	handle->Close(handle);
+	return ok;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+/*
+ * Leveled logging.
+ *
+ * A message is logged if its level is enabled both at run time (log= or
+ * debug= in the configuration) and at compile time (LOG_MAX_LEVEL, set in
+ * the Makefile). The macros check the level before evaluating the
+ * arguments, so a disabled message costs one comparison, and a message
+ * above LOG_MAX_LEVEL is removed by the compiler altogether.
+ *
+ * The messages go to a ring buffer with timestamps, not directly to the
+ * console, because firmware consoles can take milliseconds per line and
+ * would distort the timings. LogFlush shows them; it must be called
+ * before waiting for a key and before booting.
+ */
+
+/**
+ * The log levels, from the most to the least important.
+ */
+enum LogLevel {
+	LOG_ERROR, // Failures; always shown.
+	LOG_INFO, // What is loaded and booted.
+	LOG_DEBUG, // Details for finding problems (debug=1).
+	LOG_TRACE, // Per-row and per-read messages from the decoding loops.
+};
+
+/**
+ * The highest level that is compiled in. Trace messages are left out of
+ * normal builds; build with make LOG_MAX_LEVEL=LOG_TRACE to get them.
+ */
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_DEBUG
+#endif
+
+/**
+ * The highest level that is shown at run time.
+ */
+extern enum LogLevel log_level;
+
+/**
+ * Check whether messages of a level are shown.
+ */
+static inline BOOLEAN LogEnabled(enum LogLevel level) {
+	return level <= LOG_MAX_LEVEL && level <= log_level;
+}
+
+/**
+ * Start the clock for the timestamps.
+ */
+extern void LogInit(void);
+
+/**
+ * Set the highest level that is shown at run time. Above LOG_ERROR, this
+ * also measures the tick rate for the timestamps; only errors are logged
+ * without timestamps.
+ */
+extern void LogSetLevel(enum LogLevel level);
+
+/**
+ * Add a message to the log buffer. Use the Log macros instead.
+ *
+ * @param fmt The format string, as for Print.
+ */
+extern void LogPrint(const CHAR16* fmt, ...);
+
+/**
+ * Show the messages that haven't been shown yet on the console.
+ */
+extern void LogFlush(void);
+
+/**
+ * Write the messages in the buffer to a file, as UCS-2 text.
+ *
+ * @param dir The directory.
+ * @param path The file path within the directory. An old file is replaced.
+ * @return TRUE on success, FALSE on failure.
+ */
+extern BOOLEAN LogSave(EFI_FILE_HANDLE dir, const CHAR16* path);
+
+/**
+ * Log a message, if the level is enabled.
+ */
+#define Log(level, ...) do { \
+	if (LogEnabled(level)) { \
+		LogPrint(__VA_ARGS__); \
+	} \
+} while (0)
+
+#define LogError(...) Log(LOG_ERROR, __VA_ARGS__)
+#define LogInfo(...) Log(LOG_INFO, __VA_ARGS__)
+#define LogDebug(...) Log(LOG_DEBUG, __VA_ARGS__)
+#define LogTrace(...) Log(LOG_TRACE, __VA_ARGS__)
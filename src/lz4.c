@@ -0,0 +1,101 @@
+#include "lz4.h"
+
+/*
+ * Each sequence is a token (literal length << 4 | match length - 4),
+ * the literals and a 16-bit match offset. A length of 15 continues in the
+ * following bytes, each adding up to 255. The last sequence has no match.
+ *
+ * Far enough from the ends of the buffers, the literals and the matches
+ * are copied 8 bytes at a time, possibly writing a few bytes too many;
+ * those are overwritten by the next sequence.
+ */
+
+/**
+ * Copy 8 bytes; compiles to a single load and store.
+ */
+static inline void Copy8(uint8_t* dst, const uint8_t* src) {
+	uint64_t v;
+	__builtin_memcpy(&v, src, 8);
+	__builtin_memcpy(dst, &v, 8);
+}
+
+/**
+ * Read the rest of a length that continues after the token.
+ *
+ * @return The length, or LZ4_ERROR if the data ends.
+ */
+static inline size_t ReadLength(const uint8_t** ip, const uint8_t* iend, size_t len) {
+	unsigned b;
+	do {
+		if (*ip == iend) {
+			return LZ4_ERROR;
+		}
+		b = *(*ip)++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+size_t LZ4Decompress(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size) {
+	const uint8_t* ip = src;
+	const uint8_t* const iend = src + src_size;
+	uint8_t* op = dst;
+	uint8_t* const oend = dst + dst_size;
+
+	while (ip != iend) {
+		const unsigned token = *ip++;
+
+		// Literals.
+		size_t len = token >> 4;
+		if (len == 15 && (len = ReadLength(&ip, iend, len)) == LZ4_ERROR) {
+			return LZ4_ERROR;
+		}
+		if (len > (size_t) (iend - ip) || len > (size_t) (oend - op)) {
+			return LZ4_ERROR;
+		}
+		if (len + 8 <= (size_t) (iend - ip) && len + 8 <= (size_t) (oend - op)) {
+			for (size_t i = 0; i < len; i += 8) {
+				Copy8(op + i, ip + i);
+			}
+		} else {
+			for (size_t i = 0; i < len; ++i) {
+				op[i] = ip[i];
+			}
+		}
+		ip += len;
+		op += len;
+		if (ip == iend) {
+			break;
+		}
+
+		// Match.
+		if (iend - ip < 2) {
+			return LZ4_ERROR;
+		}
+		const size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (!offset || offset > (size_t) (op - dst)) {
+			return LZ4_ERROR;
+		}
+		len = (token & 15) + 4;
+		if (len == 19 && (len = ReadLength(&ip, iend, len)) == LZ4_ERROR) {
+			return LZ4_ERROR;
+		}
+		if (len > (size_t) (oend - op)) {
+			return LZ4_ERROR;
+		}
+		const uint8_t* match = op - offset;
+		if (offset >= 8 && len + 8 <= (size_t) (oend - op)) {
+			for (size_t i = 0; i < len; i += 8) {
+				Copy8(op + i, match + i);
+			}
+		} else {
+			// Overlapping matches repeat the last offset bytes.
+			for (size_t i = 0; i < len; ++i) {
+				op[i] = match[i];
+			}
+		}
+		op += len;
+	}
+	return op - dst;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+/*
+ * LZ4 block decompression.
+ *
+ * This doesn't depend on UEFI, so that it can also be used by the host
+ * tools (see tools/).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The return value of LZ4Decompress for invalid data.
+ */
+#define LZ4_ERROR ((size_t) -1)
+
+/**
+ * Decompress an LZ4 block (the raw block format, without the frame).
+ *
+ * @param dst The destination buffer.
+ * @param dst_size The size of the destination buffer.
+ * @param src The compressed data.
+ * @param src_size The size of the compressed data.
+ * @return The decompressed size, or LZ4_ERROR if the data is invalid or doesn't fit.
+ */
+extern size_t LZ4Decompress(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size);
@@ -4,22 +4,26 @@
 #include "types.h"
 #include "config.h"
 #include "util.h"
-
-/**
- * The Print function signature.
- */
-typedef UINTN print_t(IN CONST CHAR16 *fmt, ...);
-
-/**
- * The function for debug printing; either Print or NullPrint.
- */
-print_t* Debug = NullPrint;
+#include "bmp.h"
+#include "pixel.h"
+#include "resample.h"
+#include "cpu.h"
+#include "writer.h"
+#include "cache.h"
+#include "hbi.h"
+#include "mp.h"
+#include "builtin.h"
+#include "cost.h"
+#include "stream.h"
+#include "prefetch.h"
 
 /**
  * The configuration.
  */
 static struct HackBGRT_config config = {
-	.action = HackBGRT_KEEP
+	.action = HackBGRT_KEEP,
+	.log_level = -1,
+	.bpp = 24
 };
 
 /**
@@ -43,7 +47,7 @@ static EFI_GRAPHICS_OUTPUT_PROTOCOL* GOP(void) {
 static void SetResolution(int w, int h) {
 	EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = GOP();
 	if (!gop) {
-		Debug(L"GOP not found!\n");
+		LogDebug(L"GOP not found!\n");
 		return;
 	}
 	UINTN best_i = gop->Mode->Mode;
@@ -52,7 +56,7 @@ static void SetResolution(int w, int h) {
 	w = (w <= 0 ? w < 0 ? best_w : 0x7fffffff : w);
 	h = (h <= 0 ? h < 0 ? best_h : 0x7fffffff : h);
 
-	Debug(L"Looking for resolution %dx%d...\n", w, h);
+	LogDebug(L"Looking for resolution %dx%d...\n", w, h);
 	for (UINT32 i = gop->Mode->MaxMode; i--;) {
 		int new_w = 0, new_h = 0;
 
@@ -85,30 +89,12 @@ static void SetResolution(int w, int h) {
 		best_h = new_h;
 		best_i = i;
 	}
-	Debug(L"Found resolution %dx%d.\n", best_w, best_h);
+	LogDebug(L"Found resolution %dx%d.\n", best_w, best_h);
 	if (best_i != gop->Mode->Mode) {
 		gop->SetMode(gop, best_i);
 	}
 }
 
-/**
- * Select the correct coordinate (manual, automatic, native)
- *
- * @param value The configured coordinate value; has special values for automatic and native.
- * @param automatic The automatically calculated alternative.
- * @param native The original coordinate.
- * @see enum HackBGRT_coordinate
- */
-static int SelectCoordinate(int value, int automatic, int native) {
-	if (value == HackBGRT_coord_auto) {
-		return automatic;
-	}
-	if (value == HackBGRT_coord_native) {
-		return native;
-	}
-	return value;
-}
-
 /**
  * Create a new XSDT with the given number of entries.
  *
@@ -121,7 +107,7 @@ ACPI_SDT_HEADER* CreateXsdt(ACPI_SDT_HEADER* xsdt0, UINTN entries) {
 	UINT32 xsdt_len = sizeof(ACPI_SDT_HEADER) + entries * sizeof(UINT64);
 	BS->AllocatePool(EfiACPIReclaimMemory, xsdt_len, (void**)&xsdt);
 	if (!xsdt) {
-		Print(L"HackBGRT: Failed to allocate memory for XSDT.\n");
+		LogError(L"HackBGRT: Failed to allocate memory for XSDT.\n");
 		return 0;
 	}
 	ZeroMem(xsdt, xsdt_len);
@@ -153,17 +139,17 @@ static ACPI_BGRT* HandleAcpiTables(enum HackBGRT_action action, ACPI_BGRT* bgrt)
 		if (CompareMem(rsdp->signature, "RSD PTR ", 8) != 0 || rsdp->revision < 2 || !VerifyAcpiRsdp2Checksums(rsdp)) {
 			continue;
 		}
-		Debug(L"RSDP: revision = %d, OEM ID = %s\n", rsdp->revision, TmpStr(rsdp->oem_id, 6));
+		LogDebug(L"RSDP: revision = %d, OEM ID = %s\n", rsdp->revision, TmpStr(rsdp->oem_id, 6));
 
 		ACPI_SDT_HEADER* xsdt = (ACPI_SDT_HEADER *) (UINTN) rsdp->xsdt_address;
 		if (!xsdt || CompareMem(xsdt->signature, "XSDT", 4) != 0 || !VerifyAcpiSdtChecksum(xsdt)) {
-			Debug(L"* XSDT: missing or invalid\n");
+			LogDebug(L"* XSDT: missing or invalid\n");
 			continue;
 		}
 		UINT64* entry_arr = (UINT64*)&xsdt[1];
 		UINT32 entry_arr_length = (xsdt->length - sizeof(*xsdt)) / sizeof(UINT64);
 
-		Debug(L"* XSDT: OEM ID = %s, entry count = %d\n", TmpStr(xsdt->oem_id, 6), entry_arr_length);
+		LogDebug(L"* XSDT: OEM ID = %s, entry count = %d\n", TmpStr(xsdt->oem_id, 6), entry_arr_length);
 
 		int bgrt_count = 0;
 		for (int j = 0; j < entry_arr_length; j++) {
@@ -171,16 +157,16 @@ static ACPI_BGRT* HandleAcpiTables(enum HackBGRT_action action, ACPI_BGRT* bgrt)
 			if (CompareMem(entry->signature, "BGRT", 4) != 0) {
 				continue;
 			}
-			Debug(L" - ACPI table: %s, revision = %d, OEM ID = %s\n", TmpStr(entry->signature, 4), entry->revision, TmpStr(entry->oem_id, 6));
+			LogDebug(L" - ACPI table: %s, revision = %d, OEM ID = %s\n", TmpStr(entry->signature, 4), entry->revision, TmpStr(entry->oem_id, 6));
 			switch (action) {
 				case HackBGRT_KEEP:
 					if (!bgrt) {
-						Debug(L" -> Returning this one for later use.\n");
+						LogDebug(L" -> Returning this one for later use.\n");
 						bgrt = (ACPI_BGRT*) entry;
 					}
 					break;
 				case HackBGRT_REMOVE:
-					Debug(L" -> Deleting.\n");
+					LogDebug(L" -> Deleting.\n");
 					for (int k = j+1; k < entry_arr_length; ++k) {
 						entry_arr[k-1] = entry_arr[k];
 					}
@@ -190,13 +176,13 @@ static ACPI_BGRT* HandleAcpiTables(enum HackBGRT_action action, ACPI_BGRT* bgrt)
 					--j;
 					break;
 				case HackBGRT_REPLACE:
-					Debug(L" -> Replacing.\n");
+					LogDebug(L" -> Replacing.\n");
 					entry_arr[j] = (UINTN) bgrt;
 			}
 			bgrt_count += 1;
 		}
 		if (!bgrt_count && action == HackBGRT_REPLACE && bgrt) {
-			Debug(L" - Adding missing BGRT.\n");
+			LogDebug(L" - Adding missing BGRT.\n");
 			xsdt = CreateXsdt(xsdt, entry_arr_length + 1);
 			entry_arr = (UINT64*)&xsdt[1];
 			entry_arr[entry_arr_length++] = (UINTN) bgrt;
@@ -209,33 +195,177 @@ static ACPI_BGRT* HandleAcpiTables(enum HackBGRT_action action, ACPI_BGRT* bgrt)
 }
 
 /**
- * Plot Dot pixel
+ * Image loading errors, collected to be printed once after all alternatives.
  */
-static void plot_dot(const uint32_t x, const uint32_t y, const UINT8 r, const UINT8 g, const UINT8 b)
+static struct {
+	const CHAR16* message;
+	const CHAR16* path;
+} load_errors[16];
+static int load_error_count;
+
+/**
+ * Record an image loading error. The strings must stay valid until PrintLoadErrors.
+ *
+ * @param message The error message.
+ * @param path The path of the failed image.
+ */
+static void LoadError(const CHAR16* message, const CHAR16* path) {
+	if (load_error_count < sizeof(load_errors) / sizeof(load_errors[0])) {
+		load_errors[load_error_count].message = message;
+		load_errors[load_error_count].path = path;
+		load_error_count += 1;
+	}
+}
+
+/**
+ * Print and clear the collected image loading errors.
+ * Stall only in debug mode, so that a failing image never delays a normal boot.
+ */
+static void PrintLoadErrors(void) {
+	if (!load_error_count) {
+		return;
+	}
+	for (int i = 0; i < load_error_count; ++i) {
+		LogError(L"HackBGRT: %s (%s)!\n", load_errors[i].message, load_errors[i].path);
+	}
+	if (config.debug) {
+		LogFlush();
+		BS->Stall(1000000);
+	}
+	load_error_count = 0;
+}
+
+/**
+ * Plot a row of pixels, for watching the decoding (preview=1 with debug=1).
+ * The row goes to the screen with one Blt; the conversion buffer is kept for the next row.
+ *
+ * @param row The converted source row, in the BMP pixel format.
+ * @param width The row width.
+ * @param y The row number, counting from the top.
+ */
+static void plot_row(const UINT8* row, UINT32 width, UINT32 y)
 {
+	static EFI_GRAPHICS_OUTPUT_BLT_PIXEL* pixels;
+	static UINT32 capacity;
+	EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = GOP();
+	if (!gop || y >= gop->Mode->Info->VerticalResolution) {
+		return;
+	}
+	width = min(width, gop->Mode->Info->HorizontalResolution);
+	if (width > capacity) {
+		if (pixels) {
+			FreePool(pixels);
+		}
+		pixels = 0;
+		BS->AllocatePool(EfiBootServicesData, width * sizeof(*pixels), (void**) &pixels);
+		capacity = pixels ? width : 0;
+	}
+	if (!width || !pixels) {
+		return;
+	}
+	PixelRowFunction(config.bpp == 32 ? PIXEL_BGRX8 : PIXEL_BGR8, 32)((uint8_t*) pixels, row, width);
+	gop->Blt(gop, pixels, EfiBltBufferToVideo, 0, 0, 0, y, width, 1, 0);
+}
+
+/**
+ * Show the BMP on the screen as the OS will show it: on black, at the BGRT position.
+ *
+ * The rows are written straight to the frame buffer if its pixel format is
+ * known; otherwise the image is converted and drawn with a single Blt.
+ *
+ * @param bmp The BMP.
+ * @param x The horizontal position.
+ * @param y The vertical position.
+ */
+static void PreviewBMP(BMP* bmp, int x, int y) {
 	EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = GOP();
 	if (!gop) {
-		// Debug(L"GOP not found!\n");
 		return;
 	}
+	const EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* info = gop->Mode->Info;
+	int x0 = max(x, 0), x1 = min(x + (int) bmp->width, info->HorizontalResolution);
+	int y0 = max(y, 0), y1 = min(y + (int) bmp->height, info->VerticalResolution);
 
-	const uint32_t w = 1, h = 1;
-	const UINTN delta = w * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL black = {0};
+	gop->Blt(gop, &black, EfiBltVideoFill, 0, 0, 0, 0, info->HorizontalResolution, info->VerticalResolution, 0);
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+	UINTN w = x1 - x0, h = y1 - y0;
+	UINTN src_offset = (x0 - x) * (bmp->bpp / 8);
+
+	// Swapping R and B in the kernel gives RGBX for the other frame buffer format.
+	BOOLEAN direct = gop->Mode->FrameBufferBase && (info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor || info->PixelFormat == PixelRedGreenBlueReserved8BitPerColor);
+	BOOLEAN swap = direct && info->PixelFormat == PixelRedGreenBlueReserved8BitPerColor;
+	pixel_row_t* convert = PixelRowFunction(bmp->bpp == 32 ? (swap ? PIXEL_RGBA8 : PIXEL_BGRX8) : (swap ? PIXEL_RGB8 : PIXEL_BGR8), 32);
+
+	if (direct) {
+		LogDebug(L"HackBGRT: Preview %dx%d at (%d, %d) in the frame buffer.\n", (int) w, (int) h, x0, y0);
+		UINT8* fb = (UINT8*) (UINTN) gop->Mode->FrameBufferBase;
+		for (UINTN i = 0; i < h; ++i) {
+			UINT8* dst = fb + ((y0 + i) * info->PixelsPerScanLine + x0) * 4;
+			convert(dst, BMPRow(bmp, y0 - y + i) + src_offset, w);
+		}
+		return;
+	}
 
-	EFI_GRAPHICS_OUTPUT_BLT_PIXEL pixel;
-	pixel.Blue  = b;
-	pixel.Green = g;
-	pixel.Red   = r;
-	pixel.Reserved = 0x00;
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL* pixels = 0;
+	BS->AllocatePool(EfiBootServicesData, w * h * sizeof(*pixels), (void**) &pixels);
+	if (!pixels) {
+		LogDebug(L"HackBGRT: Failed to allocate memory for the preview.\n");
+		return;
+	}
+	for (UINTN i = 0; i < h; ++i) {
+		convert((UINT8*) (pixels + i * w), BMPRow(bmp, y0 - y + i) + src_offset, w);
+	}
+	LogDebug(L"HackBGRT: Preview %dx%d at (%d, %d) with Blt.\n", (int) w, (int) h, x0, y0);
+	gop->Blt(gop, pixels, EfiBltBufferToVideo, 0, 0, x0, y0, w, h, 0);
+	FreePool(pixels);
+}
 
-	gop->Blt(gop,
-		&pixel,					// Dot data
-		EfiBltBufferToVideo,	// Draw dot
-		0, 0,					// UINTN SourceX, SourceY
-		x, y,					// UINTN DestinationX, DestinationY
-		w, h,					// UINTN Width, Height
-		delta					// UINTN Delta
-		);
+/**
+ * Prepare a writer for the configured output format, scaling and position.
+ *
+ * @param writer The writer to initialize.
+ */
+static void InitWriter(struct HackBGRT_writer* writer) {
+	ZeroMem(writer, sizeof(*writer));
+	writer->bpp = config.bpp;
+	writer->scale = config.scale;
+	writer->pos_x = config.image_x;
+	writer->pos_y = config.image_y;
+	writer->rotate = config.image_rotate;
+	writer->autocrop = config.autocrop;
+	EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = GOP();
+	if (gop) {
+		writer->screen_w = gop->Mode->Info->HorizontalResolution;
+		writer->screen_h = gop->Mode->Info->VerticalResolution;
+	}
+}
+
+/**
+ * Debug output for a converted row: plot the row with preview=1, and trace sample pixels.
+ *
+ * @param row The converted source row, in the BMP pixel format.
+ * @param width The row width.
+ * @param y The row number, counting from the top.
+ */
+static void DebugRow(const UINT8* row, UINT32 width, UINT32 y) {
+	if (config.debug && config.preview) {
+		plot_row(row, width, y);
+	}
+	if (!LogEnabled(LOG_TRACE) || (y % 32) || (y > 256)) {
+		return;
+	}
+	const UINT32 bytes = config.bpp / 8;
+	for (UINT32 x = 0; x < width && x <= 256; x += 32) {
+		// B,G,R
+		UINT8 r = row[x * bytes + 2];
+		UINT8 g = row[x * bytes + 1];
+		UINT8 b = row[x * bytes + 0];
+
+		LogTrace(L"HackBGRT: bmp (%4d, %4d) #%02x%02x%02x.\n", x, y, r, g, b);
+	}
 }
 
 /**
@@ -248,297 +378,415 @@ static void plot_dot(const uint32_t x, const uint32_t y, const UINT8 r, const UI
 #include "../my_efilib/my_efilib.h"
 #include "../upng/upng.h"
 
-static void* init_bmp(uint32_t w, uint32_t h)
-{
-	BMP* bmp = 0;
-
-	Debug(L"HackBGRT: init_bmp() (%d x %d).\n", w, h);
-
-	// 3 = RGB 3byte
-	// 54 = 24bit BMP has 54byte header
-	// Padding for 4 byte alignment
-	// const int pad = (w & 3);
-	const UINT32 size = ((w * 3) + (w & 3)) * h + 54;
-	Debug(L"HackBGRT: init_bmp() AllocatePool %ld.\n", size);
-	BS->AllocatePool(EfiBootServicesData, size, (void*)&bmp);
-	if (!bmp) return 0;
-
-	// BI_RGB 24bit
-	CopyMem(
-		bmp,
-		"\x42\x4d"
-		"\x00\x00\x00\x00"
-		"\x00\x00"
-		"\x00\x00"
-		"\x36\x00\x00\x00"
-		"\x28\x00\x00\x00"
-		"\x00\x00\x00\x00"
-		"\x00\x00\x00\x00"
-		"\x01\x00"
-		"\x18\x00"
-		"\x00\x00\x00\x00"
-		"\x00\x00\x00\x00"
-		"\x13\x0b\x00\x00"
-		"\x13\x0b\x00\x00"
-		"\x00\x00\x00\x00"
-		"\x00\x00\x00\x00",
-		54
-	);
-
-	// Windows Bitmap Byte Order = Little Endian
-	bmp->file_size = DWORD_TO_BYTES_LE(size);
-	bmp->width  = DWORD_TO_BYTES_LE(w);
-	bmp->height = DWORD_TO_BYTES_LE(h);
-	bmp->biSizeImage = DWORD_TO_BYTES_LE(size - 54);
-
-	return bmp;
+/**
+ * The upng read callback for a stream.
+ */
+static unsigned long png_read(void* stream, unsigned char* buffer, unsigned long size) {
+	return StreamRead(stream, buffer, size);
 }
 
-
-static void* decode_png(void* buffer, UINTN size)
+static void* decode_png(struct Stream* stream, struct HackBGRT_writer* writer)
 {
 	// upng
 	upng_t* upng;
-	unsigned width, height, depth;
-	unsigned x, y, d;
+	unsigned width, height;
+	unsigned y;
 
-	upng = upng_new_from_bytes(buffer, size);
+	upng = upng_new_from_callback(png_read, stream);
 	if (!upng) {
-		Print(L"HackBGRT: Failed to upng NULL\n");
+		LogDebug(L"HackBGRT: Failed to upng NULL\n");
 		return 0;
 	}
 
 	if (upng_get_error(upng) != UPNG_EOK) {
-		Print(L"HackBGRT: Failed to upng %u %u\n", upng_get_error(upng), upng_get_error_line(upng));
+		LogDebug(L"HackBGRT: Failed to upng %u %u\n", upng_get_error(upng), upng_get_error_line(upng));
 		upng_free(upng);
 		return 0;
 	}
 
 	// Reads just the header, sets image properties
 	if (upng_header(upng) != UPNG_EOK) {
-		Print(L"HackBGRT: Failed to upng_header %u %u\n", upng_get_error(upng), upng_get_error_line(upng));
+		LogDebug(L"HackBGRT: Failed to upng_header %u %u\n", upng_get_error(upng), upng_get_error_line(upng));
+		upng_free(upng);
+		return 0;
+	}
+
+	width  = upng_get_width(upng);
+	height = upng_get_height(upng);
+
+	LogDebug(L"size: %ux%ux%u\n", width, height, upng_get_bpp(upng));
+	LogDebug(L"format: %u\n", upng_get_format(upng));
+
+	// Select the row conversion; indexed and low bit depth formats go through a palette.
+	pixel_row_t* convert = 0;
+	int index_bits = 0;
+	int is_index_color = 0;
+	switch (upng_get_format(upng)) {
+		case UPNG_RGB8: convert = PixelRowFunction(PIXEL_RGB8, config.bpp); break;
+		case UPNG_RGBA8: convert = PixelRowFunction(PIXEL_RGBA8, config.bpp); break;
+		case UPNG_RGB16: convert = PixelRowFunction(PIXEL_RGB16, config.bpp); break;
+		case UPNG_RGBA16: convert = PixelRowFunction(PIXEL_RGBA16, config.bpp); break;
+		case UPNG_LUMINANCE8: convert = PixelRowFunction(PIXEL_GRAY8, config.bpp); break;
+		case UPNG_LUMINANCE_ALPHA8: convert = PixelRowFunction(PIXEL_GRAYA8, config.bpp); break;
+		case UPNG_INDEX8: index_bits = 8; is_index_color = 1; break;
+		case UPNG_INDEX4: index_bits = 4; is_index_color = 1; break;
+		case UPNG_INDEX2: index_bits = 2; is_index_color = 1; break;
+		case UPNG_INDEX1: index_bits = 1; is_index_color = 1; break;
+		case UPNG_LUMINANCE4: index_bits = 4; break;
+		case UPNG_LUMINANCE2: index_bits = 2; break;
+		case UPNG_LUMINANCE1: index_bits = 1; break;
+		default: break;
+	}
+
+	if (!convert && !index_bits) {
+		LogDebug(L"HackBGRT: No Support PNG format %u\n", upng_get_format(upng));
+		upng_free(upng);
+		return 0;
+	}
+
+	if (!WriterBegin(writer, width, height)) {
+		LogDebug(L"HackBGRT: Failed to CreateBMP\n");
 		upng_free(upng);
 		return 0;
 	}
 
-	// Decodes image data
+	// Decodes image data; the rows below the region of interest are only inflated.
+	upng_set_row_limit(upng, writer->roi_y + writer->roi_h);
 	if (upng_decode(upng) != UPNG_EOK) {
-		Print(L"HackBGRT: Failed to upng_decode %u %u\n", upng_get_error(upng), upng_get_error_line(upng));
+		LogDebug(L"HackBGRT: Failed to upng_decode %u %u\n", upng_get_error(upng), upng_get_error_line(upng));
+		WriterAbort(writer);
 		upng_free(upng);
 		return 0;
 	}
 
-	width  = upng_get_width(upng);
-	height = upng_get_height(upng);
-	depth  = upng_get_bpp(upng) / 8;
-	if (depth < 1) depth = 1;
+	UINT32 palette[256] = {0};
+	if (is_index_color) {
+		const unsigned char* upng_palette = upng_get_palette(upng);
+		if (!upng_palette) {
+			LogDebug(L"HackBGRT: Error No PLTE chunk Index Color Palette\n");
+			WriterAbort(writer);
+			upng_free(upng);
+			return 0;
+		}
+		// B,G,R Palette; missing entries are black.
+		unsigned entries = min(upng_get_palette_entries(upng), 1 << index_bits);
+		for (unsigned i = 0; i < entries; ++i) {
+			palette[i] = (upng_palette[i * 3] << 16) | (upng_palette[i * 3 + 1] << 8) | upng_palette[i * 3 + 2];
+		}
+	} else if (index_bits) {
+		// B,G,R Grayscale 4bit, 2bit, B/W
+		const UINT32 levels = (1 << index_bits) - 1;
+		for (unsigned i = 0; i <= levels; ++i) {
+			palette[i] = (i * 0xff / levels) * 0x010101;
+		}
+	}
+
+	const unsigned char* upng_buffer = upng_get_buffer(upng);
+	const UINTN png_pixel_bytes = upng_get_bpp(upng) / 8;
+	const UINTN png_row_bytes = (UINTN) width * upng_get_bpp(upng) / 8;
+	for (y = writer->roi_y; y != writer->roi_y + writer->roi_h; ++y) {
+		UINT8* row = WriterRow(writer, y);
+		if (convert) {
+			convert(row, &upng_buffer[y * png_row_bytes + writer->roi_x * png_pixel_bytes], writer->roi_w);
+		} else {
+			// Low bit depths are packed without padding between the rows.
+			PixelRowIndexed(row, upng_buffer, (UINTN) y * width + writer->roi_x, writer->roi_w, index_bits, palette, config.bpp);
+		}
+		DebugRow(row, writer->roi_w, y);
+		WriterCommit(writer, y);
+	}
+
+	// Frees the resources attached to a upng_t object
+	upng_free(upng);
+
+	return WriterEnd(writer);
+}
 
-	BMP* bmp = init_bmp(width, height);
+static BMP* LoadPNG(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
+	LogDebug(L"HackBGRT: Loading PNG %s.\n", path);
+	struct Stream stream;
+	if (!StreamOpen(&stream, root_dir, path)) {
+		LoadError(L"Failed to load PNG", path);
+		return 0;
+	}
+
+	BMP* bmp = decode_png(&stream, writer);
+	StreamClose(&stream);
 	if (!bmp) {
-		Print(L"HackBGRT: Failed to init_bmp\n");
-		upng_free(upng);
+		LoadError(L"Failed to decode PNG", path);
 		return 0;
 	}
 
-	Debug(L"size: %ux%ux%u (%u)\n", width, height, upng_get_bpp(upng), upng_get_size(upng));
-	Debug(L"format: %u\n", upng_get_format(upng));
+	return bmp;
+}
 
-	int decode_type = 0;
-	int is_index_color = 0;
-	if (upng_get_format(upng) == UPNG_RGB8 || upng_get_format(upng) == UPNG_RGBA8) {
-		// 8-bit RGB
-		decode_type = 1;
-	} else
-	if (upng_get_format(upng) == UPNG_RGB16 || upng_get_format(upng) == UPNG_RGBA16) {
-		// 16-bit RGB
-		decode_type = 2;
-	} else
-	if (upng_get_format(upng) == UPNG_LUMINANCE8 || upng_get_format(upng) == UPNG_LUMINANCE_ALPHA8) {
-		// 8-bit Greyscale
-		decode_type = 3;
-	} else
-	if (upng_get_format(upng) == UPNG_INDEX8) {
-		// 8-bit Index Color
-		decode_type = 3;
-		is_index_color = 1;
-	} else
-	if (upng_get_format(upng) == UPNG_INDEX4) {
-		// 4-bit Index Color
-		decode_type = 4;
-		is_index_color = 1;
-	} else
-	if (upng_get_format(upng) == UPNG_INDEX2) {
-		// 2-bit Index Color
-		decode_type = 5;
-		is_index_color = 1;
-	} else
-	if (upng_get_format(upng) == UPNG_INDEX1) {
-		// 1-bit Index Color
-		decode_type = 6;
-		is_index_color = 1;
-	} else
-	if (upng_get_format(upng) == UPNG_LUMINANCE4) {
-		// 4-bit Greyscale
-		decode_type = 4;
-	} else
-	if (upng_get_format(upng) == UPNG_LUMINANCE2) {
-		// 2-bit Greyscale
-		decode_type = 5;
-	} else
-	if (upng_get_format(upng) == UPNG_LUMINANCE1) {
-		// 1-bit Greyscale B/W
-		decode_type = 6;
-	}
-
-	if (!decode_type) {
-		Print(L"HackBGRT: No Support PNG format %u\n", upng_get_format(upng));
-		upng_free(upng);
+/**
+ * A batch of HBI tiles to decompress in parallel.
+ */
+struct hbi_batch {
+	const struct hbi_header* header;
+	UINT32 first_tile;
+	UINT8* buffer;
+	UINTN tile_size;
+	volatile UINT32 failed;
+};
+
+/**
+ * Decompress one tile of a batch. Runs on any processor; see ParallelFor.
+ */
+static void decode_hbi_tile(void* arg, UINTN i) {
+	struct hbi_batch* batch = arg;
+	if (!HBIDecodeTile(batch->header, batch->first_tile + i, batch->buffer + i * batch->tile_size)) {
+		batch->failed = 1;
+	}
+}
+
+/**
+ * Decode an HBI image. Only the tiles with rows in the region of interest
+ * are decompressed, in parallel batches; the rows are then written in order.
+ */
+static BMP* decode_hbi(void* buffer, UINTN size, struct HackBGRT_writer* writer)
+{
+	const struct hbi_header* header = HBIParse(buffer, size);
+	if (!header) {
+		LogDebug(L"HackBGRT: Invalid HBI header\n");
 		return 0;
 	}
+	LogDebug(L"size: %ux%ux%u, %u tiles of %u rows\n", header->width, header->height, header->bpp, header->tile_count, header->tile_rows);
 
-	const unsigned char* upng_palette = upng_get_palette(upng);
-	if (is_index_color && !upng_palette) {
-		Print(L"HackBGRT: Error No PLTE chunk Index Color Palette\n");
-		upng_free(upng);
+	if (!WriterBegin(writer, header->width, header->height)) {
+		LogDebug(L"HackBGRT: Failed to CreateBMP\n");
 		return 0;
 	}
 
-	const int shift_4bit[] = {4, 0};
-	const int shift_2bit[] = {6, 4, 2, 0};
-	const int shift_1bit[] = {7, 6, 5, 4, 3, 2, 1, 0};
-	int shift = 0;
-	UINT8 c = 0;
-	UINT16 u16 = 0;
+	const UINTN stride = HBIStride(header);
+	const UINTN pixel_bytes = header->bpp / 8;
+	pixel_row_t* convert = PixelRowFunction(header->bpp == 32 ? PIXEL_BGRX8 : PIXEL_BGR8, config.bpp);
+	const UINT32 first_tile = writer->roi_y / header->tile_rows;
+	const UINT32 end_tile = (writer->roi_y + writer->roi_h - 1) / header->tile_rows + 1;
+
+	// Up to 8 MiB of tiles at a time.
+	struct hbi_batch batch = { .header = header, .tile_size = header->tile_rows * stride };
+	UINTN batch_tiles = (8 << 20) / batch.tile_size;
+	batch_tiles = batch_tiles < 1 ? 1 : batch_tiles > end_tile - first_tile ? end_tile - first_tile : batch_tiles;
+	batch.buffer = malloc(batch_tiles * batch.tile_size);
+	if (!batch.buffer) {
+		LogDebug(L"HackBGRT: Failed to allocate HBI tiles\n");
+		WriterAbort(writer);
+		return 0;
+	}
+	LogDebug(L"HackBGRT: Decoding %u tiles on %u processors\n", end_tile - first_tile, (UINT32) ProcessorCount());
+
+	for (UINT32 tile = first_tile; tile < end_tile; tile += batch_tiles) {
+		const UINT32 n = min(batch_tiles, end_tile - tile);
+		batch.first_tile = tile;
+		ParallelFor(n, decode_hbi_tile, &batch);
+		if (batch.failed) {
+			break;
+		}
+		const UINT32 y0 = tile * header->tile_rows;
+		const UINT32 y_begin = max(y0, writer->roi_y);
+		const UINT32 y_end = min(y0 + n * header->tile_rows, writer->roi_y + writer->roi_h);
+		for (UINT32 y = y_begin; y < y_end; ++y) {
+			UINT8* row = WriterRow(writer, y);
+			convert(row, &batch.buffer[(y - y0) * stride + writer->roi_x * pixel_bytes], writer->roi_w);
+			DebugRow(row, writer->roi_w, y);
+			WriterCommit(writer, y);
+		}
+	}
+	free(batch.buffer);
 
-	const unsigned char* upng_buffer = upng_get_buffer(upng);
-	UINT32 bmp_width = ((width * 3) + (width & 3));
-	for (y = 0; y != height; ++y) {
-		for (x = 0; x != width; ++x) {
-			UINT32 bmp_pos = bmp_width * (height - y - 1) + (x * 3) + 54;
-			UINT32 png_pos = (y * width + x) * depth;
-
-			if (decode_type == 1) {
-				// 8-bit RGB
-				for (d = 0; d < 3; ++d) {
-					// B,G,R
-					c = upng_buffer[png_pos + (3 - d - 1)];
-					((UINT8*)bmp)[bmp_pos] = c;
-					++bmp_pos;
-				}
-			} else
-			if (decode_type == 2) {
-				// 16-bit RGB
-				for (d = 0; d < 3; ++d) {
-					// // B,G,R Upper 8bit
-					// c = upng_buffer[png_pos + (6 - (d*2) - 2)];
-					// B,G,R 16bit to 8bit Nearest-Neighbor method
-					u16 = upng_buffer[png_pos + (6 - (d*2) - 2)];
-					u16 <<= 8;
-					u16 |= upng_buffer[png_pos + (6 - (d*2) - 1)];
-					if (u16 >= 0xFF7F) {
-						c = 0xFF;
-					} else {
-						c = (u16 + 0x80) / 0x101;
-					}
-					((UINT8*)bmp)[bmp_pos] = c;
-					++bmp_pos;
-				}
-			} else
-			if (decode_type >= 3) {
-				if (decode_type == 3) {
-					// 8-bit
-					c = upng_buffer[png_pos];
-				} else
-				if (decode_type == 4) {
-					// 4-bit
-					shift = png_pos & 1;
-					png_pos >>= 1;
-					c = upng_buffer[png_pos] >> shift_4bit[shift];
-					c = (c & 0x0F);
-					if (!is_index_color) {
-						// B,G,R Grayscale 4bit
-						c = c * 0x11;
-					}
-				} else
-				if (decode_type == 5) {
-					// 2-bit
-					shift = png_pos & 3;
-					png_pos >>= 2;
-					c = upng_buffer[png_pos] >> shift_2bit[shift];
-					c = (c & 0x03);
-					if (!is_index_color) {
-						// B,G,R Grayscale 2bit
-						c = c * 0x55;
-					}
-				} else
-				if (decode_type == 6) {
-					// 1-bit
-					shift = png_pos & 7;
-					png_pos >>= 3;
-					c = upng_buffer[png_pos] >> shift_1bit[shift];
-					c = (c & 0x01);
-					if (!is_index_color) {
-						// B,G,R Grayscale B/W
-						c = c * 0xFF;
-					}
-				}
-
-				if (is_index_color) {
-					// B,G,R Palette
-					((UINT8*)bmp)[bmp_pos]   = upng_palette[c * 3 + 2];
-					((UINT8*)bmp)[++bmp_pos] = upng_palette[c * 3 + 1];
-					((UINT8*)bmp)[++bmp_pos] = upng_palette[c * 3];
-				} else {
-					// B,G,R Grayscale 8bit
-					((UINT8*)bmp)[bmp_pos]   = c;
-					((UINT8*)bmp)[++bmp_pos] = c;
-					((UINT8*)bmp)[++bmp_pos] = c;
-				}
-				++bmp_pos;
-			}
+	if (batch.failed) {
+		LogDebug(L"HackBGRT: Corrupted HBI tile\n");
+		WriterAbort(writer);
+		return 0;
+	}
+	return WriterEnd(writer);
+}
 
-			// Debug Plot Dot pixel
-			if (config.debug && 0) {
-				UINT8 r = ((UINT8*)bmp)[bmp_pos - 1];
-				UINT8 g = ((UINT8*)bmp)[bmp_pos - 2];
-				UINT8 b = ((UINT8*)bmp)[bmp_pos - 3];
-				plot_dot(x, y, r, g, b);
-			}
+/**
+ * Load an HBI image file.
+ *
+ * @param root_dir The root directory for loading the image.
+ * @param path The image path within the root directory.
+ * @param writer The writer for decoding the image.
+ * @return The loaded BMP, or 0 if not available.
+ */
+static BMP* LoadHBI(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
+	LogDebug(L"HackBGRT: Loading HBI %s.\n", path);
+	UINTN size;
+	void* buffer = LoadFile(root_dir, path, &size);
+	if (!buffer) {
+		LoadError(L"Failed to load HBI", path);
+		return 0;
+	}
 
-			// Debug
-			if ((x % 32) || (y % 32) || (x > 256) || (y > 256))
-				continue;
+	BMP* bmp = decode_hbi(buffer, size, writer);
+	FreePool(buffer);
+	if (!bmp) {
+		LoadError(L"Failed to decode HBI", path);
+		return 0;
+	}
 
-			// B,G,R
-			UINT8 r = ((UINT8*)bmp)[--bmp_pos];
-			UINT8 g = ((UINT8*)bmp)[--bmp_pos];
-			UINT8 b = ((UINT8*)bmp)[--bmp_pos];
-			Debug(L"HackBGRT: bmp (%4d, %4d) #%02x%02x%02x.\n", x, y, r, g, b);
+	return bmp;
+}
+
+/**
+ * Decode the builtin image, which needs no file access.
+ *
+ * @param writer The writer for decoding the image.
+ * @return The decoded BMP, or 0 on failure.
+ */
+static BMP* LoadBuiltin(struct HackBGRT_writer* writer) {
+	LogDebug(L"HackBGRT: Loading the builtin image (%d bytes).\n", (int) builtin_image_size);
+	BMP* bmp = decode_hbi((void*) builtin_image, builtin_image_size, writer);
+	if (!bmp) {
+		LoadError(L"Failed to decode the builtin image", L"builtin:");
+	}
+	return bmp;
+}
+
+#include "../qoi/qoi.h"
+
+/**
+ * Decode a QOI image. The rows are decoded one at a time, and decoding
+ * stops after the region of interest.
+ */
+static BMP* decode_qoi(void* buffer, UINTN size, struct HackBGRT_writer* writer)
+{
+	qoi_decoder qoi;
+	if (!qoi_init(&qoi, buffer, size)) {
+		LogDebug(L"HackBGRT: Invalid QOI header\n");
+		return 0;
+	}
+	LogDebug(L"size: %ux%u, %u channels\n", qoi.width, qoi.height, qoi.channels);
+
+	UINT8* rgba = malloc(qoi.width * 4);
+	if (!rgba) {
+		LogDebug(L"HackBGRT: Failed to allocate QOI row\n");
+		return 0;
+	}
+	if (!WriterBegin(writer, qoi.width, qoi.height)) {
+		LogDebug(L"HackBGRT: Failed to CreateBMP\n");
+		free(rgba);
+		return 0;
+	}
+
+	pixel_row_t* convert = PixelRowFunction(PIXEL_RGBA8, config.bpp);
+	for (UINT32 y = 0; y != writer->roi_y + writer->roi_h; ++y) {
+		if (!qoi_decode_row(&qoi, rgba)) {
+			LogDebug(L"HackBGRT: Truncated QOI data at row %u\n", y);
+			free(rgba);
+			WriterAbort(writer);
+			return 0;
+		}
+		if (y < writer->roi_y) {
+			continue;
 		}
+		UINT8* row = WriterRow(writer, y);
+		convert(row, &rgba[writer->roi_x * 4], writer->roi_w);
+		DebugRow(row, writer->roi_w, y);
+		WriterCommit(writer, y);
 	}
+	free(rgba);
 
-	// Frees the resources attached to a upng_t object
-	upng_free(upng);
+	return WriterEnd(writer);
+}
+
+/**
+ * Load a QOI image file.
+ *
+ * @param root_dir The root directory for loading the image.
+ * @param path The image path within the root directory.
+ * @param writer The writer for decoding the image.
+ * @return The loaded BMP, or 0 if not available.
+ */
+static BMP* LoadQOI(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
+	LogDebug(L"HackBGRT: Loading QOI %s.\n", path);
+	UINTN size;
+	void* buffer = LoadFile(root_dir, path, &size);
+	if (!buffer) {
+		LoadError(L"Failed to load QOI", path);
+		return 0;
+	}
+
+	BMP* bmp = decode_qoi(buffer, size, writer);
+	FreePool(buffer);
+	if (!bmp) {
+		LoadError(L"Failed to decode QOI", path);
+		return 0;
+	}
 
 	return bmp;
 }
 
-static BMP* LoadPNG(EFI_FILE_HANDLE root_dir, const CHAR16* path) {
-	void* buffer = 0;
-	Debug(L"HackBGRT: Loading PNG %s.\n", path);
+#include "../webp/vp8l.h"
+
+/**
+ * Decode a lossless WebP image. The rows are decoded one at a time, and
+ * decoding stops after the region of interest.
+ */
+static BMP* decode_webp(void* buffer, UINTN size, struct HackBGRT_writer* writer)
+{
+	vp8l_decoder* webp = vp8l_new_from_bytes(buffer, size);
+	if (!webp) {
+		LogDebug(L"HackBGRT: Invalid or unsupported WebP\n");
+		return 0;
+	}
+	const UINT32 width = vp8l_get_width(webp);
+	const UINT32 height = vp8l_get_height(webp);
+	LogDebug(L"size: %ux%u\n", width, height);
+
+	if (!WriterBegin(writer, width, height)) {
+		LogDebug(L"HackBGRT: Failed to CreateBMP\n");
+		vp8l_free(webp);
+		return 0;
+	}
+
+	// The ARGB words are B, G, R, A in memory.
+	pixel_row_t* convert = PixelRowFunction(PIXEL_BGRX8, config.bpp);
+	for (UINT32 y = 0; y != writer->roi_y + writer->roi_h; ++y) {
+		const UINT32* argb = vp8l_next_row(webp);
+		if (!argb) {
+			LogDebug(L"HackBGRT: Corrupted WebP data at row %u\n", y);
+			vp8l_free(webp);
+			WriterAbort(writer);
+			return 0;
+		}
+		if (y < writer->roi_y) {
+			continue;
+		}
+		UINT8* row = WriterRow(writer, y);
+		convert(row, (const UINT8*) &argb[writer->roi_x], writer->roi_w);
+		DebugRow(row, writer->roi_w, y);
+		WriterCommit(writer, y);
+	}
+	vp8l_free(webp);
+
+	return WriterEnd(writer);
+}
+
+/**
+ * Load a WebP image file.
+ *
+ * @param root_dir The root directory for loading the image.
+ * @param path The image path within the root directory.
+ * @param writer The writer for decoding the image.
+ * @return The loaded BMP, or 0 if not available.
+ */
+static BMP* LoadWebP(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
+	LogDebug(L"HackBGRT: Loading WebP %s.\n", path);
 	UINTN size;
-	buffer = LoadFile(root_dir, path, &size);
+	void* buffer = LoadFile(root_dir, path, &size);
 	if (!buffer) {
-		Print(L"HackBGRT: Failed to load PNG (%s)!\n", path);
-		BS->Stall(1000000);
+		LoadError(L"Failed to load WebP", path);
 		return 0;
 	}
 
-	BMP* bmp = decode_png(buffer, size);
+	BMP* bmp = decode_webp(buffer, size, writer);
+	FreePool(buffer);
 	if (!bmp) {
-		FreePool(buffer);
-		Print(L"HackBGRT: Failed to decoce PNG (%s)!\n", path);
-		BS->Stall(1000000);
+		LoadError(L"Failed to decode WebP", path);
 		return 0;
 	}
 
@@ -623,46 +871,60 @@ static CHAR16* stringtoC16(const char * const str) {
 typedef unsigned char uint8;
 typedef unsigned int uint;
 //------------------------------------------------------------------------------
-static unsigned char *g_pInFile;
-static uint g_nInFileSize;
-static uint g_nInFileOfs;
-//------------------------------------------------------------------------------
+// The callback data is the struct Stream of the file.
 unsigned char pjpeg_need_bytes_callback(unsigned char* pBuf, unsigned char buf_size, unsigned char *pBytes_actually_read, void *pCallback_data)
 {
-   uint n;
-   pCallback_data;
+   struct Stream* stream = pCallback_data;
+   uint ofs = (uint)stream->pos;
+   uint n = (uint)StreamRead(stream, pBuf, buf_size);
 
-   n = min(g_nInFileSize - g_nInFileOfs, buf_size);
-
-   if ((g_nInFileOfs < 2048) || ((g_nInFileSize - g_nInFileOfs) < 2048)) {
-      Debug(L"pjpeg_need_bytes_callback: buf_size %d, n %d, %d, %d\n", buf_size, n, g_nInFileOfs, g_nInFileSize);
+   if ((ofs < 2048) || ((stream->size - ofs) < 2048)) {
+      LogTrace(L"pjpeg_need_bytes_callback: buf_size %d, n %d, %d, %d\n", buf_size, n, ofs, (uint)stream->size);
    } else {
-      Debug(L".");
+      LogTrace(L".");
    }
 
-   memcpy(pBuf, &g_pInFile[g_nInFileOfs], n);
    *pBytes_actually_read = (unsigned char)(n);
-   g_nInFileOfs += n;
-   return 0;
+   return stream->error ? PJPG_STREAM_READ_ERROR : 0;
 }
 //------------------------------------------------------------------------------
-// Loads JPEG image from specified file. Returns NULL on failure.
+// Reads the image header from the beginning of the stream without decoding.
+// Returns 0 on failure. On success, the size of the decoded image (see reduce
+// below) is written to *ix and *iy.
+static int pjpeg_get_size(struct Stream* stream, int reduce, int *ix, int *iy)
+{
+   pjpeg_image_info_t image_info;
+
+   if (!StreamRewind(stream) || pjpeg_decode_init(&image_info, pjpeg_need_bytes_callback, stream, 0))
+      return 0;
+
+   // In reduce mode output 1 pixel per 8x8 block.
+   *ix = reduce ? (image_info.m_MCUSPerRow * image_info.m_MCUWidth) / 8 : image_info.m_width;
+   *iy = reduce ? (image_info.m_MCUSPerCol * image_info.m_MCUHeight) / 8 : image_info.m_height;
+   return 1;
+}
+//------------------------------------------------------------------------------
+// Loads JPEG image from the beginning of the stream. Returns NULL on failure.
 // On success, the malloc()'d image's width/height is written to *x and *y, and
 // the number of components (1 or 3) is written to *comps.
+// Only the rectangle (roi_x, roi_y, roi_w, roi_h) of the decoded image is
+// stored. The MCUs outside it are entropy decoded (the stream has to be read
+// anyway) but not transformed, and decoding stops at the bottom of it.
 // pScan_type can be NULL, if not it'll be set to the image's pjpeg_scan_type_t.
 // Not thread safe.
 // If reduce is non-zero, the image will be more quickly decoded at approximately
 // 1/8 resolution (the actual returned resolution will depend on the JPEG
 // subsampling factor).
-uint8 *pjpeg_load_from_file(void* buffer, UINTN size, int *ix, int *iy, int *comps, pjpeg_scan_type_t *pScan_type, int reduce)
+uint8 *pjpeg_load_from_file(struct Stream* stream, int *ix, int *iy, int *comps, pjpeg_scan_type_t *pScan_type, int reduce, int roi_x, int roi_y, int roi_w, int roi_h)
 {
    pjpeg_image_info_t image_info;
    int mcu_x = 0;
    int mcu_y = 0;
+   int mcu_w, mcu_h, block_size;
    uint row_pitch;
    uint8 *pImage;
    uint8 status;
-   uint decoded_width, decoded_height;
+   int decoded_width, decoded_height;
    uint row_blocks_per_mcu, col_blocks_per_mcu;
 
    *ix = 0;
@@ -670,22 +932,17 @@ uint8 *pjpeg_load_from_file(void* buffer, UINTN size, int *ix, int *iy, int *com
    *comps = 0;
    if (pScan_type) *pScan_type = PJPG_GRAYSCALE;
 
-   g_pInFile = (void*)buffer;
-   g_nInFileOfs = 0;
-   g_nInFileSize = size;
-
-   Debug(L"pjpeg_load_from_file: Size %d.\n", size);
-   status = pjpeg_decode_init(&image_info, pjpeg_need_bytes_callback, NULL, (unsigned char)reduce);
+   LogDebug(L"pjpeg_load_from_file: Size %d.\n", (uint)stream->size);
+   status = StreamRewind(stream) ? pjpeg_decode_init(&image_info, pjpeg_need_bytes_callback, stream, (unsigned char)reduce) : PJPG_STREAM_READ_ERROR;
    if (status)
    {
-      Print(L"pjpeg_decode_init() failed with status %u(%s)\n", status, stringtoC16(PJPG_ERROR_MESSAGE[status]));
+      LogDebug(L"pjpeg_decode_init() failed with status %u(%s)\n", status, stringtoC16(PJPG_ERROR_MESSAGE[status]));
 
       if (status == PJPG_UNSUPPORTED_MODE)
       {
-         Print(L"Progressive JPEG files are not supported.\n");
+         LogDebug(L"Progressive JPEG files are not supported.\n");
       }
 
-      free(g_pInFile);
       return NULL;
    }
 
@@ -696,33 +953,46 @@ uint8 *pjpeg_load_from_file(void* buffer, UINTN size, int *ix, int *iy, int *com
    decoded_width = reduce ? (image_info.m_MCUSPerRow * image_info.m_MCUWidth) / 8 : image_info.m_width;
    decoded_height = reduce ? (image_info.m_MCUSPerCol * image_info.m_MCUHeight) / 8 : image_info.m_height;
 
+   if (roi_x < 0 || roi_y < 0 || roi_w <= 0 || roi_h <= 0 || roi_x + roi_w > decoded_width || roi_y + roi_h > decoded_height)
+   {
+      LogDebug(L"pjpeg_load_from_file: Invalid region %dx%d at (%d, %d).\n", roi_w, roi_h, roi_x, roi_y);
+      return NULL;
+   }
+
    // row_pitch = width byte size
-   row_pitch = decoded_width * image_info.m_comps;
-   pImage = (uint8 *)malloc(row_pitch * decoded_height);
+   row_pitch = roi_w * image_info.m_comps;
+   pImage = (uint8 *)malloc(row_pitch * roi_h);
    if (!pImage)
    {
-      free(g_pInFile);
       return NULL;
    }
 
    row_blocks_per_mcu = image_info.m_MCUWidth >> 3;
    col_blocks_per_mcu = image_info.m_MCUHeight >> 3;
 
+   // Decoded pixels per block and per MCU.
+   block_size = reduce ? 1 : 8;
+   mcu_w = row_blocks_per_mcu * block_size;
+   mcu_h = col_blocks_per_mcu * block_size;
+
    for ( ; ; )
    {
-      int y, x;
-      uint8 *pDst_row;
+      int y, x, bx, by;
+      const int inside = mcu_x * mcu_w < roi_x + roi_w && (mcu_x + 1) * mcu_w > roi_x && (mcu_y + 1) * mcu_h > roi_y;
+
+      // The rest of the image is below the rectangle.
+      if (mcu_y * mcu_h >= roi_y + roi_h)
+         break;
 
-      status = pjpeg_decode_mcu();
+      status = inside ? pjpeg_decode_mcu() : pjpeg_skip_mcu();
 
       if (status)
       {
          if (status != PJPG_NO_MORE_BLOCKS)
          {
-            Print(L"pjpeg_decode_mcu() failed with status %u\n", status);
+            LogDebug(L"pjpeg_decode_mcu() failed with status %u\n", status);
 
             free(pImage);
-            free(g_pInFile);
             return NULL;
          }
 
@@ -732,98 +1002,38 @@ uint8 *pjpeg_load_from_file(void* buffer, UINTN size, int *ix, int *iy, int *com
       if (mcu_y >= image_info.m_MCUSPerCol)
       {
          free(pImage);
-         free(g_pInFile);
          return NULL;
       }
 
-      if (reduce)
+      if (inside)
       {
+         // Copy the MCU's pixels within the rectangle into the destination bitmap.
          // In reduce mode, only the first pixel of each 8x8 block is valid.
-         pDst_row = pImage + mcu_y * col_blocks_per_mcu * row_pitch + mcu_x * row_blocks_per_mcu * image_info.m_comps;
-         if (image_info.m_scanType == PJPG_GRAYSCALE)
-         {
-            *pDst_row = image_info.m_pMCUBufR[0];
-         }
-         else
-         {
-            // uint y, x;
-            for (y = 0; y < col_blocks_per_mcu; y++)
-            {
-               uint src_ofs = (y * 128U);
-               for (x = 0; x < row_blocks_per_mcu; x++)
-               {
-                  pDst_row[0] = image_info.m_pMCUBufR[src_ofs];
-                  pDst_row[1] = image_info.m_pMCUBufG[src_ofs];
-                  pDst_row[2] = image_info.m_pMCUBufB[src_ofs];
-                  pDst_row += 3;
-                  src_ofs += 64;
-               }
-
-               pDst_row += row_pitch - 3 * row_blocks_per_mcu;
-            }
-         }
-      }
-      else
-      {
-         // Copy MCU's pixel blocks into the destination bitmap.
-         pDst_row = pImage + (mcu_y * image_info.m_MCUHeight) * row_pitch + (mcu_x * image_info.m_MCUWidth * image_info.m_comps);
-
-         for (y = 0; y < image_info.m_MCUHeight; y += 8)
+         for (y = 0; y < col_blocks_per_mcu; y++)
          {
-            const int by_limit = min(8, image_info.m_height - (mcu_y * image_info.m_MCUHeight + y));
-
-            for (x = 0; x < image_info.m_MCUWidth; x += 8)
+            for (x = 0; x < row_blocks_per_mcu; x++)
             {
-               uint8 *pDst_block = pDst_row + x * image_info.m_comps;
-
                // Compute source byte offset of the block in the decoder's MCU buffer.
-               uint src_ofs = (x * 8U) + (y * 16U);
-               const uint8 *pSrcR = image_info.m_pMCUBufR + src_ofs;
-               const uint8 *pSrcG = image_info.m_pMCUBufG + src_ofs;
-               const uint8 *pSrcB = image_info.m_pMCUBufB + src_ofs;
+               const uint src_ofs = (y * 128U) + (x * 64U);
+               const int px = mcu_x * mcu_w + x * block_size - roi_x;
+               const int py = mcu_y * mcu_h + y * block_size - roi_y;
 
-               const int bx_limit = min(8, image_info.m_width - (mcu_x * image_info.m_MCUWidth + x));
-
-               if (image_info.m_scanType == PJPG_GRAYSCALE)
+               for (by = max(0, -py); by < min(block_size, roi_h - py); by++)
                {
-                  int bx, by;
-                  for (by = 0; by < by_limit; by++)
+                  for (bx = max(0, -px); bx < min(block_size, roi_w - px); bx++)
                   {
-                     uint8 *pDst = pDst_block;
-
-                     for (bx = 0; bx < bx_limit; bx++)
-                        *pDst++ = *pSrcR++;
-
-                     pSrcR += (8 - bx_limit);
+                     const uint ofs = src_ofs + by * 8 + bx;
+                     uint8 *pDst = pImage + (py + by) * row_pitch + (px + bx) * image_info.m_comps;
 
-                     pDst_block += row_pitch;
-                  }
-               }
-               else
-               {
-                  int bx, by;
-                  for (by = 0; by < by_limit; by++)
-                  {
-                     uint8 *pDst = pDst_block;
-
-                     for (bx = 0; bx < bx_limit; bx++)
+                     pDst[0] = image_info.m_pMCUBufR[ofs];
+                     if (image_info.m_scanType != PJPG_GRAYSCALE)
                      {
-                        pDst[0] = *pSrcR++;
-                        pDst[1] = *pSrcG++;
-                        pDst[2] = *pSrcB++;
-                        pDst += 3;
+                        pDst[1] = image_info.m_pMCUBufG[ofs];
+                        pDst[2] = image_info.m_pMCUBufB[ofs];
                      }
-
-                     pSrcR += (8 - bx_limit);
-                     pSrcG += (8 - bx_limit);
-                     pSrcB += (8 - bx_limit);
-
-                     pDst_block += row_pitch;
                   }
                }
             }
-
-            pDst_row += (row_pitch * 8);
          }
       }
 
@@ -835,53 +1045,51 @@ uint8 *pjpeg_load_from_file(void* buffer, UINTN size, int *ix, int *iy, int *com
       }
    }
 
-   free(g_pInFile);
-
-   *ix = decoded_width;
-   *iy = decoded_height;
+   *ix = roi_w;
+   *iy = roi_h;
    *comps = image_info.m_comps;
 
    return pImage;
 }
-//------------------------------------------------------------------------------
-static void get_pixel(int* pDst, const uint8 *pSrc, int luma_only, int num_comps)
-{
-   int r, g, b;
-   if (num_comps == 1)
-   {
-      r = g = b = pSrc[0];
-   }
-   else if (luma_only)
-   {
-      const int YR = 19595, YG = 38470, YB = 7471;
-      r = g = b = (pSrc[0] * YR + pSrc[1] * YG + pSrc[2] * YB + 32768) / 65536;
-   }
-   else
-   {
-      r = pSrc[0]; g = pSrc[1]; b = pSrc[2];
-   }
-   pDst[0] = r; pDst[1] = g; pDst[2] = b;
-}
-
 //------------------------------------------------------------------------------
 #define EXIT_FAILURE NULL
 
-static void* decode_jpeg(void* buffer, UINTN size)
+static void* decode_jpeg(struct Stream* stream, struct HackBGRT_writer* writer)
 {
    int width, height, comps;
    pjpeg_scan_type_t scan_type;
    uint8 *pImage;
    int reduce = 0;
    UINT16 *p = L"";
+   UINT32 scaled_w, scaled_h;
 
-   pImage = pjpeg_load_from_file(buffer, size, &width, &height, &comps, &scan_type, reduce);
+   if (!pjpeg_get_size(stream, 0, &width, &height))
+   {
+      LogDebug(L"Failed reading the JPEG header!\n");
+      return EXIT_FAILURE;
+   }
+
+   // Decode at 1/8 resolution, if the image is going to be scaled down that much anyway.
+   WriterScaledSize(writer, width, height, &scaled_w, &scaled_h);
+   reduce = scaled_w * 8 <= (UINT32)width && scaled_h * 8 <= (UINT32)height;
+   LogDebug(L"Reduce: %d (%dx%d -> %dx%d)\n", reduce, width, height, scaled_w, scaled_h);
+   if (reduce)
+      pjpeg_get_size(stream, reduce, &width, &height);
+
+	if (!WriterBegin(writer, width, height)) {
+		LogDebug(L"HackBGRT: Failed to CreateBMP\n");
+		return 0;
+	}
+
+   pImage = pjpeg_load_from_file(stream, &width, &height, &comps, &scan_type, reduce, writer->roi_x, writer->roi_y, writer->roi_w, writer->roi_h);
    if (!pImage)
    {
-      Print(L"Failed loading source image!\n");
+      LogDebug(L"Failed loading source image!\n");
+      WriterAbort(writer);
       return EXIT_FAILURE;
    }
 
-   Debug(L"Width: %d, Height: %d, Comps: %d\n", width, height, comps);
+   LogDebug(L"Width: %d, Height: %d, Comps: %d\n", width, height, comps);
 
    switch (scan_type)
    {
@@ -891,132 +1099,364 @@ static void* decode_jpeg(void* buffer, UINTN size)
       case PJPG_YH1V2: p = L"H1V2"; break;
       case PJPG_YH2V2: p = L"H2V2"; break;
    }
-   Debug(L"Scan type: %s\n", p);
-
-	BMP* bmp = init_bmp(width, height);
-	if (!bmp) {
-		Print(L"HackBGRT: Failed to init_bmp\n");
-		free(pImage);
-		return 0;
-	}
-
-	int x, y, d;
-	int a[3];
-	UINT32 bmp_width = ((width * 3) + (width & 3));
-	for (y = 0; y != height; ++y) {
-        int pImagePos = (y * width) * comps;
-		for (x = 0; x != width; ++x) {
-			get_pixel(a, &pImage[pImagePos], (scan_type == PJPG_GRAYSCALE), comps);
-            pImagePos += comps;
-
-			// Debug(L"HackBGRT: bmp (%4d, %4d) #%04x.\n", x, y, a[0]);
-
-			UINT32 bmp_pos = bmp_width * (height - y - 1) + (x * 3) + 54;
-			for (d = 2; d >= 0; --d) {
-				// B,G,R
-				UINT8 c = (UINT8)(a[d] & 0xFF);
-				((UINT8*)bmp)[bmp_pos] = c;
-				++bmp_pos;
-			}
-
-			// Debug Plot Dot pixel
-			if (config.debug && 0) {
-				UINT8 r = ((UINT8*)bmp)[bmp_pos - 1];
-				UINT8 g = ((UINT8*)bmp)[bmp_pos - 2];
-				UINT8 b = ((UINT8*)bmp)[bmp_pos - 3];
-				plot_dot(x, y, r, g, b);
-			}
-
-			// Debug
-			if ((x % 32) || (y % 32) || (x > 256) || (y > 256))
-				continue;
-
-			// B,G,R
-			UINT8 r = ((UINT8*)bmp)[--bmp_pos];
-			UINT8 g = ((UINT8*)bmp)[--bmp_pos];
-			UINT8 b = ((UINT8*)bmp)[--bmp_pos];
-			Debug(L"HackBGRT: bmp (%4d, %4d) #%02x%02x%02x.\n", x, y, r, g, b);
-		}
+   LogDebug(L"Scan type: %s\n", p);
+
+	pixel_row_t* convert = PixelRowFunction(comps == 1 ? PIXEL_GRAY8 : PIXEL_RGB8, config.bpp);
+	for (int y = 0; y != height; ++y) {
+		UINT8* row = WriterRow(writer, writer->roi_y + y);
+		convert(row, &pImage[y * width * comps], width);
+		DebugRow(row, width, writer->roi_y + y);
+		WriterCommit(writer, writer->roi_y + y);
 	}
 
    free(pImage);
 
-   return bmp;
+   return WriterEnd(writer);
 }
 
-static BMP* LoadJPEG(EFI_FILE_HANDLE root_dir, const CHAR16* path) {
-    void* buffer = 0;
-    Debug(L"HackBGRT: Loading JPEG %s.\n", path);
-    UINTN size;
-    buffer = LoadFile(root_dir, path, &size);
-    if (!buffer) {
-        Print(L"HackBGRT: Failed to load JPEG (%s)!\n", path);
-        BS->Stall(1000000);
+static BMP* LoadJPEG(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
+    LogDebug(L"HackBGRT: Loading JPEG %s.\n", path);
+    struct Stream stream;
+    if (!StreamOpen(&stream, root_dir, path)) {
+        LoadError(L"Failed to load JPEG", path);
         return 0;
     }
 
-    BMP* bmp = decode_jpeg(buffer, size);
+    BMP* bmp = decode_jpeg(&stream, writer);
+    StreamClose(&stream);
     if (!bmp) {
-        FreePool(buffer);
-        Print(L"HackBGRT: Failed to decoce JPEG (%s)!\n", path);
-        BS->Stall(1000000);
+        LoadError(L"Failed to decode JPEG", path);
         return 0;
     }
 
     return bmp;
 }
 
+/**
+ * Load a BMP file and convert it to the BGRT format if needed.
+ *
+ * @param root_dir The root directory for loading a BMP.
+ * @param path The BMP path within the root directory.
+ * @param writer The writer for converting the BMP.
+ * @return The loaded BMP, or 0 if not available.
+ */
+static BMP* LoadBMPFile(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
+	LogDebug(L"HackBGRT: Loading BMP %s.\n", path);
+	UINTN size;
+	void* buffer = LoadFile(root_dir, path, &size);
+	if (!buffer) {
+		LoadError(L"Failed to load BMP", path);
+		return 0;
+	}
+
+	BMP* bmp = DecodeBMP(buffer, size, writer);
+	if (bmp != buffer) {
+		FreePool(buffer);
+	}
+	if (!bmp) {
+		LoadError(L"Failed to decode BMP", path);
+		return 0;
+	}
+
+	return bmp;
+}
+
+/**
+ * The image formats by file name extension, in lower case.
+ */
+static const struct {
+	const CHAR16* extension;
+	enum CostFormat format;
+} image_formats[] = {
+	{L".bmp", COST_BMP},
+	{L".png", COST_PNG},
+	{L".jpg", COST_JPEG},
+	{L".jpeg", COST_JPEG},
+	{L".webp", COST_WEBP},
+	{L".hbi", COST_HBI},
+	{L".qoi", COST_QOI},
+};
+
+/**
+ * Get the image format from the file name extension.
+ *
+ * @param path The image path.
+ * @return The image format, or COST_FORMATS if the extension is unknown.
+ */
+static enum CostFormat PathFormat(const CHAR16* path) {
+	UINTN len = StrLen(path);
+	for (int i = 0; i < sizeof(image_formats) / sizeof(image_formats[0]); ++i) {
+		const CHAR16* extension = image_formats[i].extension;
+		UINTN ext_len = StrLen(extension);
+		// A name is needed before the extension.
+		if (len <= ext_len) {
+			continue;
+		}
+		const CHAR16* end = path + len - ext_len;
+		UINTN j = 0;
+		while (j < ext_len && (end[j] == extension[j] || (end[j] >= 'A' && end[j] <= 'Z' && end[j] - 'A' + 'a' == extension[j]))) {
+			++j;
+		}
+		if (j == ext_len) {
+			return image_formats[i].format;
+		}
+	}
+	return COST_FORMATS;
+}
+
 /**
  * Load a bitmap or generate a black one.
  *
  * @param root_dir The root directory for loading a BMP.
  * @param path The BMP path within the root directory; NULL for a black BMP.
+ * @param writer The writer for decoding the image.
  * @return The loaded BMP, or 0 if not available.
  */
-static BMP* LoadBMP(EFI_FILE_HANDLE root_dir, const CHAR16* path) {
+static BMP* LoadBMP(EFI_FILE_HANDLE root_dir, const CHAR16* path, struct HackBGRT_writer* writer) {
 	BMP* bmp = 0;
 	if (!path) {
-		bmp = init_bmp(1, 1);
+		bmp = CreateBMP(1, 1, config.bpp);
 		if (!bmp) {
-			Print(L"HackBGRT: Failed to allocate a blank BMP!\n");
-			BS->Stall(1000000);
+			LoadError(L"Failed to allocate a blank BMP", L"black");
 			return 0;
 		}
 		// Black dot
-		CopyMem(
-			((UINT8*)bmp)+54,
-			"\x00\x00\x00\x00",
-			4
-		);
+		ZeroMem(BMPRow(bmp, 0), 4);
 		return bmp;
 	}
-	Debug(L"HackBGRT: Loading %s.\n", path);
+	LogInfo(L"HackBGRT: Loading %s.\n", path);
 
-	UINTN len = StrLen(path);
-	CHAR16 last_char_2 = path[len - 2];
-	Debug(L"HackBGRT: Filename Len %d, Last Char %c.\n", (int)len, last_char_2);
-	if (last_char_2 == 'm' || last_char_2 == 'M') {
-		// xxx.BMP
-		bmp = LoadFile(root_dir, path, 0);
-	} else if (last_char_2 == 'n' || last_char_2 == 'N') {
-		// xxx.PNG
-		bmp = LoadPNG(root_dir, path);
-	} else {
-		// xxx.JPG
-		// xxx.JPEG
-		bmp = LoadJPEG(root_dir, path);
+	BOOLEAN builtin = StrCmp(path, L"builtin:") == 0;
+	enum CostFormat format = builtin ? COST_HBI : PathFormat(path);
+	if (format == COST_FORMATS) {
+		LoadError(L"Unknown image format", path);
+		return 0;
 	}
+	if (config.cache_size && !builtin) {
+		UINT64 cache_t0 = CostTicks();
+		if ((bmp = CacheLoad(root_dir, path, writer))) {
+			// A cache hit is a plain read with nothing to decode.
+			CostRecordRead(bmp->file_size, CostTicks() - cache_t0);
+			CostRecordFile(path, 0, bmp->file_size);
+			return bmp;
+		}
+	}
+
+	LogDebug(L"HackBGRT: Filename Len %d, Format %d.\n", (int) StrLen(path), (int) format);
+	UINT64 t0 = CostTicks(), read_t0 = CostReadTicks(), read_bytes0 = CostReadBytes();
+	// The decoders' malloc scratch is freed in one go; the bitmap has its own pages.
+	arena_mark scratch = arena_get_mark();
+	arena_stats mem0, mem1;
+	arena_reset_peak();
+	arena_get_stats(&mem0);
+	switch (format) {
+		case COST_BMP: bmp = LoadBMPFile(root_dir, path, writer); break;
+		case COST_PNG: bmp = LoadPNG(root_dir, path, writer); break;
+		case COST_WEBP: bmp = LoadWebP(root_dir, path, writer); break;
+		case COST_HBI: bmp = builtin ? LoadBuiltin(writer) : LoadHBI(root_dir, path, writer); break;
+		case COST_QOI: bmp = LoadQOI(root_dir, path, writer); break;
+		case COST_JPEG: bmp = LoadJPEG(root_dir, path, writer); break;
+		default: break;
+	}
+	arena_get_stats(&mem1);
+	LogDebug(L"HackBGRT: Decoder memory: peak %d KiB; %d malloc, %d calloc, %d realloc (%d in place), %d free, %d new blocks.\n",
+		(int) ((mem1.peak - mem0.current + 1023) / 1024),
+		(int) (mem1.mallocs - mem0.mallocs), (int) (mem1.callocs - mem0.callocs),
+		(int) (mem1.reallocs - mem0.reallocs), (int) (mem1.in_place - mem0.in_place),
+		(int) (mem1.frees - mem0.frees), (int) (mem1.blocks - mem0.blocks));
+	arena_release(scratch);
 	if (!bmp) {
-		Print(L"HackBGRT: Failed to load BMP (%s)!\n", path);
-		BS->Stall(1000000);
 		return 0;
 	}
 
-	Debug(L"HackBGRT: Load Success %s.\n", path);
+	// The decoding time is the total minus the file reads.
+	UINT64 pixels = bmp == writer->bmp ? (UINT64) writer->roi_w * writer->roi_h : (UINT64) bmp->width * bmp->height;
+	CostRecordDecode(format, pixels, CostTicks() - t0 - (CostReadTicks() - read_t0));
+
+	LogInfo(L"HackBGRT: Load Success %s.\n", path);
+
+	// Images used as is (uncompressed BMP files) are not worth caching.
+	BOOLEAN cache = config.cache_size && !builtin && bmp == writer->bmp;
+	if (cache) {
+		CacheStore(root_dir, path, writer, (UINT64) config.cache_size << 20);
+	}
+	if (!builtin) {
+		CostRecordFile(path, CostReadBytes() - read_bytes0, cache ? bmp->file_size : 0);
+	}
+
+	return bmp;
+}
+
+/**
+ * Estimate the time of loading an image with the cost model. The files are
+ * not opened; the sizes are those recorded when the image was last loaded.
+ *
+ * @param path The image path.
+ * @param writer The writer for decoding the image.
+ * @return The estimate in ticks; 0 if not measured yet, the maximum if the format is unknown.
+ */
+static UINT64 EstimateCost(const CHAR16* path, struct HackBGRT_writer* writer) {
+	BOOLEAN builtin = StrCmp(path, L"builtin:") == 0;
+	enum CostFormat format = builtin ? COST_HBI : PathFormat(path);
+	if (format == COST_FORMATS) {
+		// Try it last; LoadBMP reports the error.
+		return ~(UINT64) 0;
+	}
+	UINT64 size = 0, cached_size = 0;
+	if (!builtin && !CostFileSizes(path, &size, &cached_size)) {
+		LogDebug(L"HackBGRT: Estimate for %s: not loaded yet.\n", path);
+		return 0;
+	}
+	// The image fills at most the screen; all encodings of it have the same size, so the
+	// screen size is enough for comparing them. Without a GOP, assume 1024x768.
+	UINT64 pixels = (UINT64) writer->screen_w * writer->screen_h;
+	pixels = pixels ? pixels : 1024 * 768;
+	UINT64 estimate, cached_estimate;
+	BOOLEAN known = (builtin || size) && CostEstimate(format, size, pixels, &estimate);
+
+	// A cache entry is only read; it may beat decoding the file.
+	cached_size = config.cache_size ? cached_size : 0;
+	BOOLEAN cached = cached_size && CostEstimate(COST_FORMATS, cached_size, 0, &cached_estimate) && (!known || cached_estimate < estimate);
+	if (cached) {
+		estimate = cached_estimate;
+	} else if (!known) {
+		LogDebug(L"HackBGRT: Estimate for %s: not measured yet.\n", path);
+		return 0;
+	}
+	LogDebug(L"HackBGRT: Estimate for %s: %ld us%s.\n", path, CostMicroseconds(estimate), cached ? L" (cached)" : L"");
+	return estimate;
+}
+
+/**
+ * The maximum number of encodings of one image; see LoadFastestEncoding.
+ */
+#define MAX_ENCODINGS 8
+
+/**
+ * Load an image from the encoding that is predicted to be the fastest.
+ *
+ * The encodings are separated by ';'. They are tried in the order of the
+ * estimates of the cost model. An encoding whose costs haven't been measured
+ * yet goes first, so that it gets measured.
+ *
+ * @param root_dir The root directory for loading a BMP.
+ * @param paths The encodings; the string is split in place.
+ * @param writer The writer for decoding the image.
+ * @return The loaded BMP, or 0 if none of the encodings is available.
+ */
+static BMP* LoadFastestEncoding(EFI_FILE_HANDLE root_dir, CHAR16* paths, struct HackBGRT_writer* writer) {
+	if (!StrStr(paths, L";")) {
+		return LoadBMP(root_dir, paths, writer);
+	}
+	if (LogEnabled(LOG_DEBUG)) {
+		CostDebugPrint();
+	}
+	CHAR16* path[MAX_ENCODINGS];
+	UINT64 estimate[MAX_ENCODINGS];
+	int n = 0;
+	while (paths && n < MAX_ENCODINGS) {
+		CHAR16* next = (CHAR16*) StrStr(paths, L";");
+		if (next) {
+			*next++ = 0;
+		}
+		path[n] = Trim(paths);
+		paths = next;
+		if (!*path[n]) {
+			continue;
+		}
+		estimate[n] = EstimateCost(path[n], writer);
+		// Insertion sort; equal estimates keep the configured order.
+		for (int i = n++; i > 0 && estimate[i] < estimate[i - 1]; --i) {
+			UINT64 e = estimate[i];
+			CHAR16* p = path[i];
+			estimate[i] = estimate[i - 1];
+			path[i] = path[i - 1];
+			estimate[i - 1] = e;
+			path[i - 1] = p;
+		}
+	}
+	for (int i = 0; i < n; ++i) {
+		BMP* bmp = LoadBMP(root_dir, path[i], writer);
+		if (bmp) {
+			return bmp;
+		}
+	}
+	return 0;
+}
 
+/**
+ * Load the first working image from a list of alternatives.
+ *
+ * The alternatives are separated by '|'. Each one is a path, "black" for a
+ * black BMP or "remove" to stop trying. A failed alternative does not stall;
+ * the errors are printed together after the list has been processed.
+ *
+ * @param root_dir The root directory for loading a BMP.
+ * @param paths The list of alternatives; NULL for a black BMP.
+ * @param writer The writer for decoding the images.
+ * @return The loaded BMP, or 0 if none of the alternatives is available.
+ */
+static BMP* LoadBMPWithFallback(EFI_FILE_HANDLE root_dir, const CHAR16* paths, struct HackBGRT_writer* writer) {
+	if (!paths) {
+		BMP* bmp = LoadBMP(root_dir, 0, writer);
+		PrintLoadErrors();
+		return bmp;
+	}
+	CHAR16* list = StrDuplicate(paths);
+	if (!list) {
+		LogError(L"HackBGRT: Failed to allocate memory for image list.\n");
+		return 0;
+	}
+	BMP* bmp = 0;
+	for (CHAR16* path = list; path && !bmp;) {
+		CHAR16* next = (CHAR16*) StrStr(path, L"|");
+		if (next) {
+			*next++ = 0;
+		}
+		path = Trim(path);
+		if (!*path) {
+			path = next;
+			continue;
+		}
+		if (StrCmp(path, L"remove") == 0) {
+			LogDebug(L"HackBGRT: Fallback list ends with remove.\n");
+			break;
+		}
+		bmp = StrCmp(path, L"black") == 0 ? LoadBMP(root_dir, 0, writer) : LoadFastestEncoding(root_dir, path, writer);
+		if (!bmp && next) {
+			LogDebug(L"HackBGRT: Trying next alternative.\n");
+		}
+		path = next;
+	}
+	PrintLoadErrors();
+	FreePool(list);
 	return bmp;
 }
 
+/**
+ * Trim the black margins of the image and move it so that it stays in the
+ * same place on the screen. The OS shows the BGRT image on black, so the
+ * result looks the same, but the bitmap is smaller.
+ *
+ * The image is cropped in place, so this needs no memory.
+ *
+ * @param bmp The image.
+ * @param writer The writer with the BGRT offsets of the image, updated for the result.
+ */
+static void AutoCrop(BMP* bmp, struct HackBGRT_writer* writer) {
+	// The writer found the box while converting; other images need a scan.
+	const BOOLEAN written = bmp == writer->bmp && writer->content_known;
+	UINT32 x, y, w, h;
+	if (!(written ? WriterContentBox(writer, &x, &y, &w, &h) : BMPContentBox(bmp, &x, &y, &w, &h)) || (w == bmp->width && h == bmp->height)) {
+		return;
+	}
+	LogDebug(L"HackBGRT: Cropped %dx%d to %dx%d at (%d, %d).\n", (int) bmp->width, (int) bmp->height, (int) w, (int) h, (int) x, (int) y);
+	// Only the writer's BMP is known to be from CreateBMP; a BMP file used as is stays in its pool buffer.
+	CropBMP(bmp, x, y, w, h, bmp == writer->bmp);
+	writer->offset_x += x;
+	writer->offset_y += y;
+}
+
 /**
  * The main logic for BGRT modification.
  *
@@ -1050,7 +1490,7 @@ void HackBgrt(EFI_FILE_HANDLE root_dir) {
 		// Replace missing = allocate new.
 		BS->AllocatePool(EfiACPIReclaimMemory, sizeof(*bgrt), (void**)&bgrt);
 		if (!bgrt) {
-			Print(L"HackBGRT: Failed to allocate memory for BGRT.\n");
+			LogError(L"HackBGRT: Failed to allocate memory for BGRT.\n");
 			return;
 		}
 	}
@@ -1062,10 +1502,21 @@ void HackBgrt(EFI_FILE_HANDLE root_dir) {
 		"\x01\x00" "\x00" "\x00";
 	CopyMem(bgrt, data, sizeof(data));
 
+	// The writer decodes, crops and places the image.
+	struct HackBGRT_writer writer;
+	InitWriter(&writer);
+	writer.native_x = old_x;
+	writer.native_y = old_y;
+	if (old_bmp) {
+		writer.native_w = old_bmp->width;
+		writer.native_h = old_bmp->height;
+	}
+
 	// Get the image (either old or new).
 	BMP* new_bmp = old_bmp;
 	if (config.action == HackBGRT_REPLACE) {
-		new_bmp = LoadBMP(root_dir, config.image_path);
+		new_bmp = LoadBMPWithFallback(root_dir, config.image_path, &writer);
+		CostSave();
 	}
 
 	// No image = no need for BGRT.
@@ -1074,37 +1525,57 @@ void HackBgrt(EFI_FILE_HANDLE root_dir) {
 		return;
 	}
 
+	// Images that didn't go through the writer (used as is) still need a position.
+	if (new_bmp != writer.bmp) {
+		WriterPlace(&writer, new_bmp->width, new_bmp->height);
+	}
+	if (config.autocrop && new_bmp != old_bmp) {
+		AutoCrop(new_bmp, &writer);
+	}
+
 	bgrt->image_address = (UINTN) new_bmp;
+	bgrt->image_offset_x = writer.offset_x;
+	bgrt->image_offset_y = writer.offset_y;
+	LogDebug(L"HackBGRT: BMP at (%d, %d).\n", (int) bgrt->image_offset_x, (int) bgrt->image_offset_y);
 
-	// Calculate the automatically centered position for the image.
-	int auto_x = 0, auto_y = 0;
-	if (GOP()) {
-		auto_x = max(0, ((int)GOP()->Mode->Info->HorizontalResolution - (int)new_bmp->width) / 2);
-		auto_y = max(0, ((int)GOP()->Mode->Info->VerticalResolution * 2/3 - (int)new_bmp->height) / 2);
-	} else if (old_bmp) {
-		auto_x = max(0, old_x + ((int)old_bmp->width - (int)new_bmp->width) / 2);
-		auto_y = max(0, old_y + ((int)old_bmp->height - (int)new_bmp->height) / 2);
+	// Show the image now, before the boot loader starts.
+	if (config.preview) {
+		PreviewBMP(new_bmp, writer.offset_x, writer.offset_y);
 	}
 
-	// Set the position (manual, automatic, original).
-	bgrt->image_offset_x = SelectCoordinate(config.image_x, auto_x, old_x);
-	bgrt->image_offset_y = SelectCoordinate(config.image_y, auto_y, old_y);
-	Debug(L"HackBGRT: BMP at (%d, %d).\n", (int) bgrt->image_offset_x, (int) bgrt->image_offset_y);
-
 	// Store this BGRT in the ACPI tables.
 	SetAcpiSdtChecksum(bgrt);
 	HandleAcpiTables(HackBGRT_REPLACE, bgrt);
 }
 
+/**
+ * Detect the CPU once and select the SIMD kernels for the pixel conversion,
+ * the scaling, the PNG unfilter and the JPEG IDCT and color conversion.
+ */
+static void SelectKernels(void) {
+	enum CpuLevel cpu = CpuDetect();
+	enum CpuLevel allowed = config.simd_off ? CPU_GENERIC : cpu;
+	enum CpuLevel pixel = PixelSetCpuLevel(allowed);
+	enum CpuLevel resample = ResampleSetCpuLevel(allowed);
+	enum CpuLevel png = allowed >= CPU_SSE2 ? CPU_SSE2 : CPU_GENERIC;
+	enum CpuLevel jpeg = allowed >= CPU_AVX2 ? CPU_AVX2 : allowed >= CPU_SSE41 ? CPU_SSE41 : png;
+	upng_set_simd(png != CPU_GENERIC);
+	pjpeg_set_simd(jpeg == CPU_AVX2 ? 3 : jpeg == CPU_SSE41 ? 2 : jpeg == CPU_SSE2 ? 1 : 0);
+	LogDebug(L"HackBGRT: CPU %a%s; kernels: pixels %a, scaling %a, PNG %a, JPEG %a.\n",
+		CpuLevelName(cpu), config.simd_off ? L" (simd=off)" : L"",
+		CpuLevelName(pixel), CpuLevelName(resample), CpuLevelName(png), CpuLevelName(jpeg));
+}
+
 /**
  * The main program.
  */
 EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *ST_) {
 	InitializeLib(image_handle, ST_);
+	LogInit();
 
 	EFI_LOADED_IMAGE* image;
 	if (EFI_ERROR(BS->HandleProtocol(image_handle, &LoadedImageProtocol, (void**) &image))) {
-		Debug(L"HackBGRT: LOADED_IMAGE_PROTOCOL failed.\n");
+		LogDebug(L"HackBGRT: LOADED_IMAGE_PROTOCOL failed.\n");
 		goto fail;
 	}
 
@@ -1116,36 +1587,57 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *ST_) {
 	if (argc <= 1) {
 		const CHAR16* config_path = L"\\EFI\\HackBGRT\\config.txt";
 		if (!ReadConfigFile(&config, root_dir, config_path)) {
-			Print(L"HackBGRT: No config, no command line!\n", config_path);
+			LogError(L"HackBGRT: No config, no command line!\n", config_path);
 			goto fail;
 		}
 	}
 	for (int i = 1; i < argc; ++i) {
 		ReadConfigLine(&config, root_dir, argv[i]);
 	}
-	Debug = config.debug ? Print : NullPrint;
+	LogSetLevel(config.log_level >= 0 ? config.log_level : config.debug ? LOG_DEBUG : LOG_ERROR);
+	SelectKernels();
+
+	// The config strings stay in the arena below this mark.
+	arena_mark scratch = arena_get_mark();
+
+	// Read the boot loader while the image is being decoded.
+	struct Prefetch boot_prefetch;
+	BOOLEAN prefetching = config.boot_path && PrefetchStart(&boot_prefetch, root_dir, config.boot_path);
 
 	SetResolution(config.resolution_x, config.resolution_y);
+	if (GOP()) {
+		SelectImage(&config, GOP()->Mode->Info->HorizontalResolution, GOP()->Mode->Info->VerticalResolution);
+	} else {
+		SelectImage(&config, 0, 0);
+	}
 	HackBgrt(root_dir);
 
 	EFI_HANDLE next_image_handle = 0;
 	if (!config.boot_path) {
-		Print(L"HackBGRT: Boot path not specified.\n");
+		LogError(L"HackBGRT: Boot path not specified.\n");
 	} else {
-		Debug(L"HackBGRT: Loading application %s.\n", config.boot_path);
+		LogInfo(L"HackBGRT: Loading application %s.\n", config.boot_path);
 		EFI_DEVICE_PATH* boot_dp = FileDevicePath(image->DeviceHandle, (CHAR16*) config.boot_path);
-		if (EFI_ERROR(BS->LoadImage(0, image_handle, boot_dp, 0, 0, &next_image_handle))) {
-			Print(L"HackBGRT: Failed to load application %s.\n", config.boot_path);
+		// The device path is still given, for the LoadedImage information.
+		UINTN boot_size = 0;
+		void* boot_data = prefetching ? PrefetchFinish(&boot_prefetch, &boot_size) : 0;
+		EFI_STATUS e = BS->LoadImage(0, image_handle, boot_dp, boot_data, boot_size, &next_image_handle);
+		if (boot_data) {
+			FreePool(boot_data);
+		}
+		if (EFI_ERROR(e)) {
+			LogError(L"HackBGRT: Failed to load application %s.\n", config.boot_path);
 		}
 	}
 	if (!next_image_handle) {
 		static CHAR16 default_boot_path[] = L"\\EFI\\HackBGRT\\bootmgfw-original.efi";
-		Debug(L"HackBGRT: Loading application %s.\n", default_boot_path);
+		LogInfo(L"HackBGRT: Loading application %s.\n", default_boot_path);
 		EFI_DEVICE_PATH* boot_dp = FileDevicePath(image->DeviceHandle, default_boot_path);
 		if (EFI_ERROR(BS->LoadImage(0, image_handle, boot_dp, 0, 0, &next_image_handle))) {
-			Print(L"HackBGRT: Also failed to load application %s.\n", default_boot_path);
+			LogError(L"HackBGRT: Also failed to load application %s.\n", default_boot_path);
 			goto fail;
 		}
+		LogFlush();
 		Print(L"HackBGRT: Reverting to %s.\n", default_boot_path);
 		Print(L"Press escape to cancel, any other key to boot.\n");
 		if (ReadKey().ScanCode == SCAN_ESC) {
@@ -1153,20 +1645,28 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *ST_) {
 		}
 		config.boot_path = default_boot_path;
 	}
+	if (config.log_file && !LogSave(root_dir, L"\\EFI\\HackBGRT\\log.txt")) {
+		LogError(L"HackBGRT: Failed to write the log file.\n");
+	}
+	// All messages at once, so that the slow console doesn't skew the timings.
+	LogFlush();
 	if (config.debug) {
 		Print(L"HackBGRT: Ready to boot.\nPress escape to cancel, any other key to boot.\n");
 		if (ReadKey().ScanCode == SCAN_ESC) {
+			arena_free_all();
 			return 0;
 		}
 	}
+	arena_release(scratch);
 	if (EFI_ERROR(BS->StartImage(next_image_handle, 0, 0))) {
-		Print(L"HackBGRT: Failed to start %s.\n", config.boot_path);
+		LogError(L"HackBGRT: Failed to start %s.\n", config.boot_path);
 		goto fail;
 	}
-	Print(L"HackBGRT: Started %s. Why are we still here?!\n", config.boot_path);
+	LogError(L"HackBGRT: Started %s. Why are we still here?!\n", config.boot_path);
 	goto fail;
 
 	fail: {
+		LogFlush();
 		Print(L"HackBGRT has failed. Use parameter debug=1 for details.\n");
 		Print(L"Get a Windows install disk or a recovery disk to fix your boot.\n");
 		#ifdef GIT_DESCRIBE
@@ -1176,6 +1676,7 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *ST_) {
 		#endif
 		Print(L"Press any key to exit.\n");
 		ReadKey();
+		arena_free_all();
 		return 1;
 	}
 }
@@ -0,0 +1,89 @@
+#include "mp.h"
+#include "util.h"
+
+#include <efilib.h>
+
+/*
+ * The MP services protocol is defined in the PI specification, not in
+ * UEFI, so gnu-efi doesn't have it. Only the needed functions are typed.
+ */
+
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+	{ 0x3fdda605, 0xa76e, 0x4f46, { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } }
+
+typedef VOID (EFIAPI *EFI_AP_PROCEDURE)(VOID* arg);
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+struct _EFI_MP_SERVICES_PROTOCOL {
+	EFI_STATUS (EFIAPI *GetNumberOfProcessors)(EFI_MP_SERVICES_PROTOCOL* This, UINTN* NumberOfProcessors, UINTN* NumberOfEnabledProcessors);
+	VOID* GetProcessorInfo;
+	EFI_STATUS (EFIAPI *StartupAllAPs)(EFI_MP_SERVICES_PROTOCOL* This, EFI_AP_PROCEDURE Procedure, BOOLEAN SingleThread, EFI_EVENT WaitEvent, UINTN TimeoutInMicroSeconds, VOID* ProcedureArgument, UINTN** FailedCpuList);
+	VOID* StartupThisAP;
+	VOID* SwitchBSP;
+	VOID* EnableDisableAP;
+	VOID* WhoAmI;
+};
+
+/**
+ * Get the MP services protocol pointer.
+ */
+static EFI_MP_SERVICES_PROTOCOL* MP(void) {
+	static EFI_MP_SERVICES_PROTOCOL* mp;
+	static BOOLEAN located;
+	if (!located) {
+		EFI_GUID MpServicesProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+		LibLocateProtocol(&MpServicesProtocolGuid, (VOID **)&mp);
+		located = TRUE;
+	}
+	return mp;
+}
+
+UINTN ProcessorCount(void) {
+	UINTN total, enabled;
+	EFI_MP_SERVICES_PROTOCOL* mp = MP();
+	if (!mp || EFI_ERROR(mp->GetNumberOfProcessors(mp, &total, &enabled)) || !enabled) {
+		return 1;
+	}
+	return enabled;
+}
+
+/**
+ * The shared state of a ParallelFor call.
+ */
+struct parallel_job {
+	parallel_func_t* func;
+	void* arg;
+	UINTN count;
+	volatile UINTN next;
+};
+
+/**
+ * Take work items until there are none left. Runs on every processor.
+ */
+static VOID EFIAPI ParallelWorker(VOID* arg) {
+	struct parallel_job* job = arg;
+	for (UINTN i; (i = __sync_fetch_and_add(&job->next, 1)) < job->count;) {
+		job->func(job->arg, i);
+	}
+}
+
+void ParallelFor(UINTN count, parallel_func_t* func, void* arg) {
+	struct parallel_job job = { .func = func, .arg = arg, .count = count, .next = 0 };
+	EFI_MP_SERVICES_PROTOCOL* mp = count > 1 ? MP() : 0;
+	EFI_EVENT done = 0;
+	if (mp && EFI_ERROR(BS->CreateEvent(0, 0, 0, 0, &done))) {
+		done = 0;
+	}
+	// Start the other processors without waiting, and work on this one too.
+	if (done && EFI_ERROR(mp->StartupAllAPs(mp, ParallelWorker, FALSE, done, 0, &job, 0))) {
+		BS->CloseEvent(done);
+		done = 0;
+	}
+	ParallelWorker(&job);
+	if (done) {
+		UINTN index;
+		BS->WaitForEvent(1, &done, &index);
+		BS->CloseEvent(done);
+	}
+	__sync_synchronize();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <efi.h>
+
+/**
+ * A function to run in parallel; see ParallelFor.
+ *
+ * @param arg The argument given to ParallelFor.
+ * @param i The index of the work item.
+ */
+typedef void parallel_func_t(void* arg, UINTN i);
+
+/**
+ * Get the number of enabled processors, including the current one.
+ *
+ * @return The number of processors; 1 if the firmware has no MP services.
+ */
+extern UINTN ProcessorCount(void);
+
+/**
+ * Run func for indices 0 to count - 1, spread over all processors with the
+ * MP services of the firmware, or on the current processor if that fails.
+ *
+ * The other processors can't use boot services, so func must only compute
+ * (no allocation, printing or file access).
+ *
+ * @param count The number of work items.
+ * @param func The function to run for each index.
+ * @param arg The argument for func.
+ */
+extern void ParallelFor(UINTN count, parallel_func_t* func, void* arg);
@@ -0,0 +1,303 @@
+#include "pixel.h"
+
+/*
+ * The 32-bit kernels store whole 0x00RRGGBB words to the 4-byte aligned
+ * BGRX rows, which the compiler can turn into wide vector stores.
+ * The 24-bit kernels have to store the odd 3-byte pixels one byte at a time.
+ */
+
+/**
+ * Convert a big-endian 16-bit sample to 8 bits, rounding to nearest.
+ */
+static inline uint8_t Sample16(const uint8_t* p) {
+	uint32_t u16 = (p[0] << 8) | p[1];
+	return u16 >= 0xff7f ? 0xff : (u16 + 0x80) / 0x101;
+}
+
+static void RGB8ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < n; ++i, src += 3, dst += 3) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+}
+
+static void RGB8ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i, src += 3) {
+		d[i] = ((uint32_t) src[0] << 16) | (src[1] << 8) | src[2];
+	}
+}
+
+static void RGBA8ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < n; ++i, src += 4, dst += 3) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+}
+
+static void RGBA8ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i, src += 4) {
+		d[i] = ((uint32_t) src[0] << 16) | (src[1] << 8) | src[2];
+	}
+}
+
+static void RGB16ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < n; ++i, src += 6, dst += 3) {
+		dst[0] = Sample16(src + 4);
+		dst[1] = Sample16(src + 2);
+		dst[2] = Sample16(src + 0);
+	}
+}
+
+static void RGB16ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i, src += 6) {
+		d[i] = ((uint32_t) Sample16(src + 0) << 16) | (Sample16(src + 2) << 8) | Sample16(src + 4);
+	}
+}
+
+static void RGBA16ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < n; ++i, src += 8, dst += 3) {
+		dst[0] = Sample16(src + 4);
+		dst[1] = Sample16(src + 2);
+		dst[2] = Sample16(src + 0);
+	}
+}
+
+static void RGBA16ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i, src += 8) {
+		d[i] = ((uint32_t) Sample16(src + 0) << 16) | (Sample16(src + 2) << 8) | Sample16(src + 4);
+	}
+}
+
+static void Gray8ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < n; ++i, dst += 3) {
+		dst[0] = dst[1] = dst[2] = src[i];
+	}
+}
+
+static void Gray8ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i) {
+		d[i] = src[i] * 0x010101u;
+	}
+}
+
+static void GrayA8ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < n; ++i, dst += 3) {
+		dst[0] = dst[1] = dst[2] = src[2 * i];
+	}
+}
+
+static void GrayA8ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i) {
+		d[i] = src[2 * i] * 0x010101u;
+	}
+}
+
+static void BGR8ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < 3 * n; ++i) {
+		dst[i] = src[i];
+	}
+}
+
+static void BGR8ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i, src += 3) {
+		d[i] = ((uint32_t) src[2] << 16) | (src[1] << 8) | src[0];
+	}
+}
+
+static void BGRX8ToBGR(uint8_t* dst, const uint8_t* src, size_t n) {
+	for (size_t i = 0; i < n; ++i, src += 4, dst += 3) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+	}
+}
+
+static void BGRX8ToBGRX(uint8_t* dst, const uint8_t* src, size_t n) {
+	uint32_t* d = (uint32_t*) dst;
+	for (size_t i = 0; i < n; ++i, src += 4) {
+		d[i] = ((uint32_t) src[2] << 16) | (src[1] << 8) | src[0];
+	}
+}
+
+#if defined(__x86_64__)
+/*
+ * SIMD kernels for the 8-bit formats. Each output byte is picked from the
+ * input with pshufb, 4 pixels at a time with SSSE3 or 8 pixels with AVX2,
+ * and the rest of the row goes through the C kernel. Only these functions
+ * are compiled for SSSE3 or AVX2, and PixelRowFunction returns them only
+ * if PixelSetCpuLevel allows it.
+ */
+
+typedef char v16qi __attribute__((vector_size(16)));
+typedef char v16qu __attribute__((vector_size(16), aligned(1), may_alias));
+typedef char v32qi __attribute__((vector_size(32)));
+typedef char v32qu __attribute__((vector_size(32), aligned(1), may_alias));
+typedef int v4si __attribute__((vector_size(16)));
+typedef int v8si __attribute__((vector_size(32)));
+typedef long long v2di __attribute__((vector_size(16)));
+typedef long long v4di __attribute__((vector_size(32)));
+
+/**
+ * A mask byte with the top bit set gives 0.
+ */
+#define Z -1
+
+/**
+ * Shuffle 4 pixels at a time, loading and storing 16 bytes.
+ *
+ * @param in The source bytes per pixel.
+ * @param out The destination bytes per pixel.
+ * @param mask The pshufb mask for 4 pixels.
+ * @return The number of pixels converted.
+ */
+__attribute__((target("ssse3"), always_inline))
+static inline size_t Shuffle4(uint8_t* dst, const uint8_t* src, size_t n, size_t in, size_t out, v16qi mask) {
+	size_t i = 0;
+	for (; (n - i) * in >= 16 && (n - i) * out >= 16; i += 4) {
+		v16qi v = *(const v16qu*) (src + i * in);
+		*(v16qu*) (dst + i * out) = __builtin_ia32_pshufb128(v, mask);
+	}
+	return i;
+}
+
+/**
+ * Put two 128-bit vectors in the lanes of a 256-bit vector (vinserti128).
+ */
+__attribute__((target("avx2"), always_inline))
+static inline v32qi Join(v16qi lo, v16qi hi) {
+	return (v32qi) __builtin_ia32_insert128i256((v4di) __builtin_ia32_si256_si((v4si) lo), (v2di) hi, 1);
+}
+
+/**
+ * Shuffle 8 pixels at a time: 4 pixels in each 128-bit lane, and for
+ * 3-byte output the two 12-byte results are joined with vpermd.
+ * The parameters are as for Shuffle4.
+ */
+__attribute__((target("avx2"), always_inline))
+static inline size_t Shuffle8(uint8_t* dst, const uint8_t* src, size_t n, size_t in, size_t out, v16qi mask) {
+	const v32qi mask2 = Join(mask, mask);
+	size_t i = 0;
+	for (; (n - i) * in >= 16 + 4 * in && (n - i) * out >= 32; i += 8) {
+		v16qi lo = *(const v16qu*) (src + i * in);
+		v16qi hi = *(const v16qu*) (src + (i + 4) * in);
+		v32qi v = __builtin_ia32_pshufb256(Join(lo, hi), mask2);
+		if (out == 3) {
+			v = (v32qi) __builtin_ia32_permvarsi256((v8si) v, (v8si) {0, 1, 2, 4, 5, 6, 7, 7});
+		}
+		*(v32qu*) (dst + i * out) = v;
+	}
+	return i;
+}
+
+/**
+ * Define the SSSE3 and AVX2 versions of a C kernel.
+ */
+#define SHUFFLE_KERNELS(name, in, out, ...) \
+	__attribute__((target("ssse3"))) \
+	static void name##_SSSE3(uint8_t* dst, const uint8_t* src, size_t n) { \
+		size_t i = Shuffle4(dst, src, n, in, out, (v16qi) {__VA_ARGS__}); \
+		name(dst + i * out, src + i * in, n - i); \
+	} \
+	__attribute__((target("avx2"))) \
+	static void name##_AVX2(uint8_t* dst, const uint8_t* src, size_t n) { \
+		size_t i = Shuffle8(dst, src, n, in, out, (v16qi) {__VA_ARGS__}); \
+		i += Shuffle4(dst + i * out, src + i * in, n - i, in, out, (v16qi) {__VA_ARGS__}); \
+		name(dst + i * out, src + i * in, n - i); \
+	}
+
+SHUFFLE_KERNELS(RGB8ToBGR, 3, 3, 2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, Z, Z, Z, Z)
+SHUFFLE_KERNELS(RGB8ToBGRX, 3, 4, 2, 1, 0, Z, 5, 4, 3, Z, 8, 7, 6, Z, 11, 10, 9, Z)
+SHUFFLE_KERNELS(RGBA8ToBGR, 4, 3, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, Z, Z, Z, Z)
+SHUFFLE_KERNELS(RGBA8ToBGRX, 4, 4, 2, 1, 0, Z, 6, 5, 4, Z, 10, 9, 8, Z, 14, 13, 12, Z)
+SHUFFLE_KERNELS(Gray8ToBGR, 1, 3, 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, Z, Z, Z, Z)
+SHUFFLE_KERNELS(Gray8ToBGRX, 1, 4, 0, 0, 0, Z, 1, 1, 1, Z, 2, 2, 2, Z, 3, 3, 3, Z)
+SHUFFLE_KERNELS(BGR8ToBGRX, 3, 4, 0, 1, 2, Z, 3, 4, 5, Z, 6, 7, 8, Z, 9, 10, 11, Z)
+SHUFFLE_KERNELS(BGRX8ToBGR, 4, 3, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z, Z, Z, Z)
+SHUFFLE_KERNELS(BGRX8ToBGRX, 4, 4, 0, 1, 2, Z, 4, 5, 6, Z, 8, 9, 10, Z, 12, 13, 14, Z)
+
+#undef Z
+
+static pixel_row_t* const functions_ssse3[PIXEL_BGRX8 + 1][2] = {
+	[PIXEL_RGB8] = {RGB8ToBGR_SSSE3, RGB8ToBGRX_SSSE3},
+	[PIXEL_RGBA8] = {RGBA8ToBGR_SSSE3, RGBA8ToBGRX_SSSE3},
+	[PIXEL_GRAY8] = {Gray8ToBGR_SSSE3, Gray8ToBGRX_SSSE3},
+	[PIXEL_BGR8] = {0, BGR8ToBGRX_SSSE3},
+	[PIXEL_BGRX8] = {BGRX8ToBGR_SSSE3, BGRX8ToBGRX_SSSE3},
+};
+
+static pixel_row_t* const functions_avx2[PIXEL_BGRX8 + 1][2] = {
+	[PIXEL_RGB8] = {RGB8ToBGR_AVX2, RGB8ToBGRX_AVX2},
+	[PIXEL_RGBA8] = {RGBA8ToBGR_AVX2, RGBA8ToBGRX_AVX2},
+	[PIXEL_GRAY8] = {Gray8ToBGR_AVX2, Gray8ToBGRX_AVX2},
+	[PIXEL_BGR8] = {0, BGR8ToBGRX_AVX2},
+	[PIXEL_BGRX8] = {BGRX8ToBGR_AVX2, BGRX8ToBGRX_AVX2},
+};
+#endif
+
+static enum CpuLevel pixel_level = CPU_GENERIC;
+
+enum CpuLevel PixelSetCpuLevel(enum CpuLevel level) {
+#if defined(__x86_64__)
+	pixel_level = level >= CPU_AVX2 ? CPU_AVX2 : level >= CPU_SSSE3 ? CPU_SSSE3 : CPU_GENERIC;
+#endif
+	return pixel_level;
+}
+
+pixel_row_t* PixelRowFunction(enum HackBGRT_pixel_format format, int bpp) {
+	static pixel_row_t* const functions[][2] = {
+		[PIXEL_RGB8] = {RGB8ToBGR, RGB8ToBGRX},
+		[PIXEL_RGBA8] = {RGBA8ToBGR, RGBA8ToBGRX},
+		[PIXEL_RGB16] = {RGB16ToBGR, RGB16ToBGRX},
+		[PIXEL_RGBA16] = {RGBA16ToBGR, RGBA16ToBGRX},
+		[PIXEL_GRAY8] = {Gray8ToBGR, Gray8ToBGRX},
+		[PIXEL_GRAYA8] = {GrayA8ToBGR, GrayA8ToBGRX},
+		[PIXEL_BGR8] = {BGR8ToBGR, BGR8ToBGRX},
+		[PIXEL_BGRX8] = {BGRX8ToBGR, BGRX8ToBGRX},
+	};
+	pixel_row_t* simd = 0;
+#if defined(__x86_64__)
+	if (pixel_level == CPU_AVX2) {
+		simd = functions_avx2[format][bpp == 32];
+	} else if (pixel_level == CPU_SSSE3) {
+		simd = functions_ssse3[format][bpp == 32];
+	}
+#endif
+	return simd ? simd : functions[format][bpp == 32];
+}
+
+/**
+ * Extract the i-th index from a row of packed indices.
+ */
+static inline uint8_t Index(const uint8_t* src, size_t i, int bits) {
+	switch (bits) {
+		case 1: return (src[i >> 3] >> (7 - (i & 7))) & 0x01;
+		case 2: return (src[i >> 2] >> (6 - 2 * (i & 3))) & 0x03;
+		case 4: return (src[i >> 1] >> (4 - 4 * (i & 1))) & 0x0f;
+		default: return src[i];
+	}
+}
+
+void PixelRowIndexed(uint8_t* dst, const uint8_t* src, size_t first, size_t n, int bits, const uint32_t* palette, int bpp) {
+	if (bpp == 32) {
+		uint32_t* d = (uint32_t*) dst;
+		for (size_t i = 0; i < n; ++i) {
+			d[i] = palette[Index(src, first + i, bits)];
+		}
+		return;
+	}
+	for (size_t i = 0; i < n; ++i, dst += 3) {
+		uint32_t c = palette[Index(src, first + i, bits)];
+		dst[0] = c;
+		dst[1] = c >> 8;
+		dst[2] = c >> 16;
+	}
+}
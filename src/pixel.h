@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * Pixel row conversion kernels.
+ *
+ * These don't depend on UEFI, so that they can also be built and
+ * benchmarked on the host (see bench/).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/**
+ * Source pixel formats for the row conversion kernels.
+ */
+enum HackBGRT_pixel_format {
+	PIXEL_RGB8,   // R, G, B
+	PIXEL_RGBA8,  // R, G, B, A; alpha is ignored.
+	PIXEL_RGB16,  // 16-bit big-endian R, G, B
+	PIXEL_RGBA16, // 16-bit big-endian R, G, B, A; alpha is ignored.
+	PIXEL_GRAY8,  // Y
+	PIXEL_GRAYA8, // Y, A; alpha is ignored.
+	PIXEL_BGR8,   // B, G, R (24-bit BMP)
+	PIXEL_BGRX8   // B, G, R, X (32-bit BMP)
+};
+
+/**
+ * Convert a row of pixels to BMP pixels. The rows must not overlap.
+ *
+ * @param dst The destination row.
+ * @param src The source row.
+ * @param n The number of pixels.
+ */
+typedef void pixel_row_t(uint8_t* dst, const uint8_t* src, size_t n);
+
+/**
+ * Allow SIMD kernels up to an instruction set level. By default only the
+ * C kernels are used.
+ *
+ * @param level The highest level the CPU supports.
+ * @return The level of the kernels that will be used: CPU_AVX2, CPU_SSSE3 or CPU_GENERIC.
+ */
+extern enum CpuLevel PixelSetCpuLevel(enum CpuLevel level);
+
+/**
+ * Get the row conversion kernel for a format.
+ *
+ * @param format The source format.
+ * @param bpp The destination bits per pixel, 24 (BGR) or 32 (BGRX).
+ * @return The conversion function.
+ */
+extern pixel_row_t* PixelRowFunction(enum HackBGRT_pixel_format format, int bpp);
+
+/**
+ * Convert a row of palette indices to BMP pixels.
+ *
+ * @param dst The destination row.
+ * @param src The source data; indices of less than 8 bits are packed MSB first.
+ * @param first The index of the first pixel in the source data.
+ * @param n The number of pixels.
+ * @param bits The bits per index: 1, 2, 4 or 8.
+ * @param palette The palette, entries as 0x00RRGGBB; must cover all possible indices.
+ * @param bpp The destination bits per pixel, 24 (BGR) or 32 (BGRX).
+ */
+extern void PixelRowIndexed(uint8_t* dst, const uint8_t* src, size_t first, size_t n, int bits, const uint32_t* palette, int bpp);
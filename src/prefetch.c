@@ -0,0 +1,77 @@
+#include "prefetch.h"
+#include "util.h"
+
+#include <efilib.h>
+
+/**
+ * Close the file and the event, and free the buffer.
+ */
+static void Cleanup(struct Prefetch* prefetch) {
+	if (prefetch->token.Event) {
+		BS->CloseEvent(prefetch->token.Event);
+	}
+	if (prefetch->handle) {
+		prefetch->handle->Close(prefetch->handle);
+	}
+	if (prefetch->buffer) {
+		FreePool(prefetch->buffer);
+	}
+	ZeroMem(prefetch, sizeof(*prefetch));
+}
+
+BOOLEAN PrefetchStart(struct Prefetch* prefetch, EFI_FILE_HANDLE dir, const CHAR16* path) {
+	ZeroMem(prefetch, sizeof(*prefetch));
+	if (EFI_ERROR(dir->Open(dir, &prefetch->handle, (CHAR16*) path, EFI_FILE_MODE_READ, 0))) {
+		prefetch->handle = 0;
+		return FALSE;
+	}
+	if (prefetch->handle->Revision < EFI_FILE_PROTOCOL_REVISION2 || !prefetch->handle->ReadEx) {
+		LogDebug(L"HackBGRT: No ReadEx, not prefetching %s.\n", path);
+		Cleanup(prefetch);
+		return FALSE;
+	}
+	EFI_FILE_INFO *info = LibFileInfo(prefetch->handle);
+	if (info) {
+		prefetch->size = info->FileSize;
+		FreePool(info);
+	}
+	if (!prefetch->size || EFI_ERROR(BS->AllocatePool(EfiBootServicesData, prefetch->size, &prefetch->buffer)) || EFI_ERROR(BS->CreateEvent(0, 0, 0, 0, &prefetch->token.Event))) {
+		Cleanup(prefetch);
+		return FALSE;
+	}
+	prefetch->token.Status = EFI_SUCCESS;
+	prefetch->token.BufferSize = prefetch->size;
+	prefetch->token.Buffer = prefetch->buffer;
+	if (EFI_ERROR(prefetch->handle->ReadEx(prefetch->handle, &prefetch->token))) {
+		LogDebug(L"HackBGRT: ReadEx failed, not prefetching %s.\n", path);
+		Cleanup(prefetch);
+		return FALSE;
+	}
+	prefetch->pending = TRUE;
+	LogDebug(L"HackBGRT: Prefetching %s.\n", path);
+	return TRUE;
+}
+
+void* PrefetchFinish(struct Prefetch* prefetch, UINTN* size) {
+	if (!prefetch->pending) {
+		return 0;
+	}
+	if (BS->CheckEvent(prefetch->token.Event) == EFI_SUCCESS) {
+		LogDebug(L"HackBGRT: The prefetch was ready.\n");
+	} else {
+		UINTN index;
+		LogDebug(L"HackBGRT: Waiting for the prefetch.\n");
+		BS->WaitForEvent(1, &prefetch->token.Event, &index);
+	}
+	prefetch->pending = FALSE;
+	if (EFI_ERROR(prefetch->token.Status) || prefetch->token.BufferSize != prefetch->size) {
+		LogDebug(L"HackBGRT: The prefetch failed.\n");
+		Cleanup(prefetch);
+		return 0;
+	}
+	void* buffer = prefetch->buffer;
+	*size = prefetch->size;
+	prefetch->buffer = 0;
+	Cleanup(prefetch);
+	return buffer;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <efi.h>
+
+/*
+ * Background loading of a whole file, for the boot loader.
+ *
+ * The file is read with ReadEx (UEFI 2.3.1) while the splash image is
+ * decoded, so that LoadImage can take it from memory afterwards. Without
+ * ReadEx nothing is prefetched, and the file is loaded by LoadImage as
+ * before.
+ */
+
+/**
+ * The state of a prefetch.
+ */
+struct Prefetch {
+	EFI_FILE_HANDLE handle;
+	EFI_FILE_IO_TOKEN token;
+	void* buffer;
+	UINTN size;
+	BOOLEAN pending;
+};
+
+/**
+ * Start reading a file in the background.
+ *
+ * @param prefetch The state to initialize.
+ * @param dir The directory.
+ * @param path The file path within the directory.
+ * @return TRUE if the read was started, FALSE if the file can't be prefetched.
+ */
+extern BOOLEAN PrefetchStart(struct Prefetch* prefetch, EFI_FILE_HANDLE dir, const CHAR16* path);
+
+/**
+ * Wait for the read to finish and take the data.
+ * This must be called after a successful PrefetchStart, also if the data isn't needed.
+ *
+ * @param prefetch The state.
+ * @param size Returns the file size.
+ * @return The file contents, to be freed with FreePool, or 0 if the read failed.
+ */
+extern void* PrefetchFinish(struct Prefetch* prefetch, UINTN* size);
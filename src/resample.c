@@ -0,0 +1,315 @@
+#include "resample.h"
+
+/*
+ * The C kernels define the results. The SIMD kernels compute the same
+ * 32-bit sums and round them the same way, so the output doesn't depend
+ * on the level.
+ */
+
+#define H_SHIFT (RESAMPLE_WEIGHT_BITS - 8)
+#define V_SHIFT (RESAMPLE_WEIGHT_BITS + 8)
+
+/**
+ * The vertical C kernel sums this many samples at a time, so that the
+ * sums stay in the L1 cache while the rows are added to them.
+ */
+#define V_BLOCK 64
+
+/**
+ * Scale one pixel horizontally.
+ *
+ * @param dst The destination samples.
+ * @param p The first source pixel.
+ * @param bytes The source bytes per pixel.
+ * @param w The weights.
+ * @param n The number of taps.
+ */
+static inline void HorizontalPixel(uint16_t* dst, const uint8_t* p, size_t bytes, const uint16_t* w, uint32_t n) {
+	uint32_t b = 0, g = 0, r = 0;
+	for (uint32_t k = 0; k < n; ++k, p += bytes) {
+		b += p[0] * w[k];
+		g += p[1] * w[k];
+		r += p[2] * w[k];
+	}
+	dst[0] = (b + (1 << (H_SHIFT - 1))) >> H_SHIFT;
+	dst[1] = (g + (1 << (H_SHIFT - 1))) >> H_SHIFT;
+	dst[2] = (r + (1 << (H_SHIFT - 1))) >> H_SHIFT;
+}
+
+static void HorizontalC(uint16_t* dst, const uint8_t* src, size_t bytes, size_t src_w, const uint32_t* first, const uint16_t* weights, uint32_t taps, size_t dst_w) {
+	for (size_t x = 0; x < dst_w; ++x, dst += 3) {
+		const uint32_t j = first[x];
+		const uint32_t n = taps < src_w - j ? taps : src_w - j;
+		HorizontalPixel(dst, src + j * bytes, bytes, weights + x * taps, n);
+	}
+}
+
+/**
+ * Combine the samples from i on with the C kernel.
+ * The other parameters are as for ResampleVertical.
+ */
+static void VerticalC(uint8_t* dst, const uint16_t* ring, uint32_t ring_rows, uint32_t first, const uint16_t* weights, uint32_t n, size_t i, size_t samples) {
+	uint32_t acc[V_BLOCK];
+	for (; i < samples; i += V_BLOCK) {
+		const size_t m = samples - i < V_BLOCK ? samples - i : V_BLOCK;
+		// The first row sets the sums, so that there is no separate clearing pass.
+		const uint16_t* row = ring + first * samples + i;
+		for (size_t s = 0; s < m; ++s) {
+			acc[s] = row[s] * (uint32_t) weights[0];
+		}
+		uint32_t r = first;
+		for (uint32_t k = 1; k < n; ++k) {
+			r = r + 1 == ring_rows ? 0 : r + 1;
+			row = ring + r * samples + i;
+			const uint32_t wk = weights[k];
+			for (size_t s = 0; s < m; ++s) {
+				acc[s] += row[s] * wk;
+			}
+		}
+		for (size_t s = 0; s < m; ++s) {
+			dst[i + s] = (acc[s] + (1 << (V_SHIFT - 1))) >> V_SHIFT;
+		}
+	}
+}
+
+#if defined(__x86_64__)
+/*
+ * SIMD kernels. The vertical pass multiplies 8 samples at a time with
+ * SSE2 or 16 with AVX2, using pmullw and pmulhuw for the low and high
+ * halves of the 32-bit products. The horizontal pass picks two taps of
+ * each channel into 16-bit lanes with pshufb and multiplies and adds
+ * them with pmaddwd, 4 taps per 16-byte load, one pixel at a time with
+ * SSSE3 or two with AVX2; the weights are at most 1 << 14, so the signed
+ * products can't overflow. The rest of a row goes through the C kernel. Only these functions are compiled for
+ * SSSE3 or AVX2, and even the SSE2 kernel is used only if
+ * ResampleSetCpuLevel allows it.
+ */
+
+typedef char v16qi __attribute__((vector_size(16)));
+typedef char v16qu __attribute__((vector_size(16), aligned(1), may_alias));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef short v8hu __attribute__((vector_size(16), aligned(1), may_alias));
+typedef short v16hi __attribute__((vector_size(32)));
+typedef short v16hu __attribute__((vector_size(32), aligned(1), may_alias));
+typedef int v4si __attribute__((vector_size(16)));
+typedef int v8si __attribute__((vector_size(32)));
+typedef long long v2di __attribute__((vector_size(16)));
+typedef long long v2du __attribute__((vector_size(16), aligned(1), may_alias));
+typedef long long v4di __attribute__((vector_size(32)));
+typedef char v32qi __attribute__((vector_size(32)));
+typedef long long i64u __attribute__((aligned(1), may_alias));
+typedef unsigned u32u __attribute__((aligned(1), may_alias));
+
+/**
+ * A mask byte with the top bit set gives 0.
+ */
+#define Z -1
+
+/**
+ * pshufb masks that pick taps 0 and 1 and taps 2 and 3 of each channel
+ * into 16-bit lanes B, G, R, 0, from 16 bytes of BGR or BGRX pixels.
+ */
+static const v16qi taps_bgr[2] = {
+	{0, Z, 3, Z, 1, Z, 4, Z, 2, Z, 5, Z, Z, Z, Z, Z},
+	{6, Z, 9, Z, 7, Z, 10, Z, 8, Z, 11, Z, Z, Z, Z, Z},
+};
+static const v16qi taps_bgrx[2] = {
+	{0, Z, 4, Z, 1, Z, 5, Z, 2, Z, 6, Z, Z, Z, Z, Z},
+	{8, Z, 12, Z, 9, Z, 13, Z, 10, Z, 14, Z, Z, Z, Z, Z},
+};
+
+/**
+ * A pshufb mask that packs the low halves of four 32-bit lanes.
+ */
+static const v16qi pack_samples = {0, 1, 4, 5, 8, 9, 12, 13, Z, Z, Z, Z, Z, Z, Z, Z};
+
+#undef Z
+
+/**
+ * Get the weights of taps k and k + 1 in each 32-bit lane for pmaddwd.
+ */
+__attribute__((always_inline))
+static inline v4si TapPair(const uint16_t* w, uint32_t k, uint32_t taps) {
+	const uint32_t pair = k + 1 < taps ? *(const u32u*) (w + k) : w[k];
+	return (v4si) {0} + (int) pair;
+}
+
+/**
+ * Put two 128-bit vectors in the lanes of a 256-bit vector (vinserti128).
+ */
+__attribute__((target("avx2"), always_inline))
+static inline v32qi Join(v16qi lo, v16qi hi) {
+	return (v32qi) __builtin_ia32_insert128i256((v4di) __builtin_ia32_si256_si((v4si) lo), (v2di) hi, 1);
+}
+
+/**
+ * Scale the pixels from x on, one at a time. The last 16-byte load of a
+ * pixel starts (taps - 1) / 4 * 4 pixels after its first tap, and the
+ * pixels whose loads would go past the row, or whose taps are cut short
+ * by it, go through the C kernel. The other parameters are as for
+ * ResampleHorizontal.
+ */
+__attribute__((target("ssse3")))
+static void Horizontal_SSSE3(uint16_t* dst, const uint8_t* src, size_t bytes, size_t src_w, const uint32_t* first, const uint16_t* weights, uint32_t taps, size_t x, size_t dst_w) {
+	const v16qi lo_mask = bytes == 3 ? taps_bgr[0] : taps_bgrx[0];
+	const v16qi hi_mask = bytes == 3 ? taps_bgr[1] : taps_bgrx[1];
+	const size_t reach = (taps - 1) / 4 * 4 * bytes + 16;
+	for (dst += 3 * x; x < dst_w; ++x, dst += 3) {
+		const uint32_t j = first[x];
+		const uint16_t* w = weights + x * taps;
+		const uint8_t* p = src + j * bytes;
+		if (j * bytes + reach > src_w * bytes) {
+			HorizontalPixel(dst, p, bytes, w, taps < src_w - j ? taps : src_w - j);
+			continue;
+		}
+		v4si sum = {0};
+		for (uint32_t k = 0; k < taps; k += 4, p += 4 * bytes) {
+			const v16qi v = *(const v16qu*) p;
+			sum += __builtin_ia32_pmaddwd128((v8hi) __builtin_ia32_pshufb128(v, lo_mask), (v8hi) TapPair(w, k, taps));
+			if (k + 2 < taps) {
+				sum += __builtin_ia32_pmaddwd128((v8hi) __builtin_ia32_pshufb128(v, hi_mask), (v8hi) TapPair(w, k + 2, taps));
+			}
+		}
+		sum = (sum + (1 << (H_SHIFT - 1))) >> H_SHIFT;
+		if (x + 1 < dst_w) {
+			// The fourth sample is overwritten by the next pixel.
+			*(i64u*) dst = ((v2di) __builtin_ia32_pshufb128((v16qi) sum, pack_samples))[0];
+		} else {
+			dst[0] = sum[0];
+			dst[1] = sum[1];
+			dst[2] = sum[2];
+		}
+	}
+}
+
+/**
+ * Scale two pixels at a time, one in each 128-bit lane, as long as both
+ * fit in the row, and the rest with Horizontal_SSSE3.
+ */
+__attribute__((target("avx2")))
+static void Horizontal_AVX2(uint16_t* dst, const uint8_t* src, size_t bytes, size_t src_w, const uint32_t* first, const uint16_t* weights, uint32_t taps, size_t dst_w) {
+	const v32qi lo_mask = bytes == 3 ? Join(taps_bgr[0], taps_bgr[0]) : Join(taps_bgrx[0], taps_bgrx[0]);
+	const v32qi hi_mask = bytes == 3 ? Join(taps_bgr[1], taps_bgr[1]) : Join(taps_bgrx[1], taps_bgrx[1]);
+	const v32qi pack = Join(pack_samples, pack_samples);
+	const size_t reach = (taps - 1) / 4 * 4 * bytes + 16;
+	size_t x = 0;
+	// The stores of 4 samples need a pixel after the pair.
+	for (; x + 2 < dst_w; x += 2) {
+		const uint32_t ja = first[x], jb = first[x + 1];
+		if ((ja > jb ? ja : jb) * bytes + reach > src_w * bytes) {
+			break;
+		}
+		const uint16_t* wa = weights + x * taps;
+		const uint16_t* wb = wa + taps;
+		const uint8_t* pa = src + ja * bytes;
+		const uint8_t* pb = src + jb * bytes;
+		v8si sum = {0};
+		for (uint32_t k = 0; k < taps; k += 4, pa += 4 * bytes, pb += 4 * bytes) {
+			const v32qi v = Join(*(const v16qu*) pa, *(const v16qu*) pb);
+			const v32qi w = Join((v16qi) TapPair(wa, k, taps), (v16qi) TapPair(wb, k, taps));
+			sum += __builtin_ia32_pmaddwd256((v16hi) __builtin_ia32_pshufb256(v, lo_mask), (v16hi) w);
+			if (k + 2 < taps) {
+				const v32qi w2 = Join((v16qi) TapPair(wa, k + 2, taps), (v16qi) TapPair(wb, k + 2, taps));
+				sum += __builtin_ia32_pmaddwd256((v16hi) __builtin_ia32_pshufb256(v, hi_mask), (v16hi) w2);
+			}
+		}
+		sum = (sum + (1 << (H_SHIFT - 1))) >> H_SHIFT;
+		const v4di q = (v4di) __builtin_ia32_pshufb256((v32qi) sum, pack);
+		*(i64u*) (dst + 3 * x) = q[0];
+		*(i64u*) (dst + 3 * x + 3) = q[2];
+	}
+	Horizontal_SSSE3(dst, src, bytes, src_w, first, weights, taps, x, dst_w);
+}
+
+/**
+ * Combine 8 samples at a time. The parameters are as for ResampleVertical.
+ *
+ * @return The number of samples done.
+ */
+__attribute__((always_inline))
+static inline size_t Vertical8(uint8_t* dst, const uint16_t* ring, uint32_t ring_rows, uint32_t first, const uint16_t* weights, uint32_t n, size_t i, size_t samples) {
+	for (; i + 8 <= samples; i += 8) {
+		v4si lo = {0}, hi = {0};
+		uint32_t r = first;
+		for (uint32_t k = 0; k < n; ++k) {
+			const v8hi v = *(const v8hu*) (ring + r * samples + i);
+			const v8hi w = (v8hi) {0} + (short) weights[k];
+			const v8hi pl = __builtin_ia32_pmullw128(v, w), ph = __builtin_ia32_pmulhuw128(v, w);
+			lo += (v4si) __builtin_shuffle(pl, ph, (v8hi) {0, 8, 1, 9, 2, 10, 3, 11});
+			hi += (v4si) __builtin_shuffle(pl, ph, (v8hi) {4, 12, 5, 13, 6, 14, 7, 15});
+			r = r + 1 == ring_rows ? 0 : r + 1;
+		}
+		lo = (lo + (1 << (V_SHIFT - 1))) >> V_SHIFT;
+		hi = (hi + (1 << (V_SHIFT - 1))) >> V_SHIFT;
+		const v8hi s = __builtin_ia32_packssdw128(lo, hi);
+		*(i64u*) (dst + i) = ((v2di) __builtin_ia32_packuswb128(s, s))[0];
+	}
+	return i;
+}
+
+static size_t Vertical_SSE2(uint8_t* dst, const uint16_t* ring, uint32_t ring_rows, uint32_t first, const uint16_t* weights, uint32_t n, size_t samples) {
+	return Vertical8(dst, ring, ring_rows, first, weights, n, 0, samples);
+}
+
+/**
+ * Combine 16 samples at a time. The unpacks work within the 128-bit
+ * lanes, and packssdw puts the samples back in order.
+ */
+__attribute__((target("avx2")))
+static size_t Vertical_AVX2(uint8_t* dst, const uint16_t* ring, uint32_t ring_rows, uint32_t first, const uint16_t* weights, uint32_t n, size_t samples) {
+	size_t i = 0;
+	for (; i + 16 <= samples; i += 16) {
+		v8si lo = {0}, hi = {0};
+		uint32_t r = first;
+		for (uint32_t k = 0; k < n; ++k) {
+			const v16hi v = *(const v16hu*) (ring + r * samples + i);
+			const v16hi w = (v16hi) {0} + (short) weights[k];
+			const v16hi pl = __builtin_ia32_pmullw256(v, w), ph = __builtin_ia32_pmulhuw256(v, w);
+			lo += (v8si) __builtin_shuffle(pl, ph, (v16hi) {0, 16, 1, 17, 2, 18, 3, 19, 8, 24, 9, 25, 10, 26, 11, 27});
+			hi += (v8si) __builtin_shuffle(pl, ph, (v16hi) {4, 20, 5, 21, 6, 22, 7, 23, 12, 28, 13, 29, 14, 30, 15, 31});
+			r = r + 1 == ring_rows ? 0 : r + 1;
+		}
+		lo = (lo + (1 << (V_SHIFT - 1))) >> V_SHIFT;
+		hi = (hi + (1 << (V_SHIFT - 1))) >> V_SHIFT;
+		const v16hi s = __builtin_ia32_packssdw256(lo, hi);
+		const v4di b = (v4di) __builtin_ia32_packuswb256(s, s);
+		*(v2du*) (dst + i) = (v2di) {b[0], b[2]};
+	}
+	return Vertical8(dst, ring, ring_rows, first, weights, n, i, samples);
+}
+#endif
+
+static enum CpuLevel resample_level = CPU_GENERIC;
+
+enum CpuLevel ResampleSetCpuLevel(enum CpuLevel level) {
+#if defined(__x86_64__)
+	resample_level = level >= CPU_AVX2 ? CPU_AVX2 : level >= CPU_SSSE3 ? CPU_SSSE3 : level >= CPU_SSE2 ? CPU_SSE2 : CPU_GENERIC;
+#endif
+	return resample_level;
+}
+
+void ResampleHorizontal(uint16_t* dst, const uint8_t* src, size_t bytes, size_t src_w, const uint32_t* first, const uint16_t* weights, uint32_t taps, size_t dst_w) {
+#if defined(__x86_64__)
+	if (resample_level == CPU_AVX2) {
+		Horizontal_AVX2(dst, src, bytes, src_w, first, weights, taps, dst_w);
+		return;
+	}
+	if (resample_level >= CPU_SSSE3) {
+		Horizontal_SSSE3(dst, src, bytes, src_w, first, weights, taps, 0, dst_w);
+		return;
+	}
+#endif
+	HorizontalC(dst, src, bytes, src_w, first, weights, taps, dst_w);
+}
+
+void ResampleVertical(uint8_t* dst, const uint16_t* ring, uint32_t ring_rows, uint32_t first, const uint16_t* weights, uint32_t n, size_t samples) {
+	size_t i = 0;
+#if defined(__x86_64__)
+	if (resample_level == CPU_AVX2) {
+		i = Vertical_AVX2(dst, ring, ring_rows, first, weights, n, samples);
+	} else if (resample_level >= CPU_SSE2) {
+		i = Vertical_SSE2(dst, ring, ring_rows, first, weights, n, samples);
+	}
+#endif
+	VerticalC(dst, ring, ring_rows, first, weights, n, i, samples);
+}
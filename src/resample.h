@@ -0,0 +1,55 @@
+#pragma once
+
+/*
+ * Fixed-point resampling kernels for the writer (see writer.c).
+ *
+ * These don't depend on UEFI, so that they can also be built and
+ * benchmarked on the host (see bench/).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/**
+ * The number of fractional bits in the filter weights. The weights of each
+ * output sample sum to 1 << RESAMPLE_WEIGHT_BITS.
+ */
+#define RESAMPLE_WEIGHT_BITS 14
+
+/**
+ * Allow SIMD kernels up to an instruction set level. By default only the
+ * C kernels are used.
+ *
+ * @param level The highest level the CPU supports.
+ * @return The level of the kernels that will be used: CPU_AVX2, CPU_SSSE3, CPU_SSE2 or CPU_GENERIC.
+ */
+extern enum CpuLevel ResampleSetCpuLevel(enum CpuLevel level);
+
+/**
+ * Scale a row horizontally into 8.8 fixed-point BGR samples.
+ *
+ * @param dst The destination row, 3 samples per pixel.
+ * @param src The source row, BGR or BGRX.
+ * @param bytes The source bytes per pixel, 3 or 4.
+ * @param src_w The source width in pixels.
+ * @param first The first source pixel of each destination pixel.
+ * @param weights The weights, taps per destination pixel.
+ * @param taps The number of taps per destination pixel; taps past the end of the source row are skipped.
+ * @param dst_w The destination width in pixels.
+ */
+extern void ResampleHorizontal(uint16_t* dst, const uint8_t* src, size_t bytes, size_t src_w, const uint32_t* first, const uint16_t* weights, uint32_t taps, size_t dst_w);
+
+/**
+ * Combine rows of 8.8 fixed-point samples into a row of 8-bit samples.
+ *
+ * @param dst The destination row.
+ * @param ring The source rows, in a ring of ring_rows rows.
+ * @param ring_rows The number of rows in the ring.
+ * @param first The position of the first source row in the ring.
+ * @param weights The weight of each source row.
+ * @param n The number of source rows.
+ * @param samples The number of samples per row.
+ */
+extern void ResampleVertical(uint8_t* dst, const uint16_t* ring, uint32_t ring_rows, uint32_t first, const uint16_t* weights, uint32_t n, size_t samples);
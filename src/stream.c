@@ -0,0 +1,204 @@
+#include "stream.h"
+#include "cost.h"
+#include "util.h"
+
+#include <efilib.h>
+
+/**
+ * Start reading the next window of the file into a buffer.
+ * Without async reads, the read is finished before returning.
+ *
+ * @param stream The stream.
+ * @param i The buffer to fill.
+ */
+static void Start(struct Stream* stream, UINTN i) {
+	if (stream->error) {
+		stream->length[i] = 0;
+		return;
+	}
+	if (stream->async) {
+		EFI_FILE_IO_TOKEN* token = &stream->token[i];
+		token->Status = EFI_SUCCESS;
+		token->BufferSize = STREAM_BUFFER_SIZE;
+		token->Buffer = stream->buffer[i];
+		stream->started[i] = CostTicks();
+		if (!EFI_ERROR(stream->handle->ReadEx(stream->handle, token))) {
+			stream->pending[i] = TRUE;
+			return;
+		}
+		// Some firmware has the function but doesn't implement it.
+		LogDebug(L"HackBGRT: ReadEx failed, reading synchronously.\n");
+		stream->async = FALSE;
+	}
+	UINTN size = STREAM_BUFFER_SIZE;
+	UINT64 t0 = CostTicks();
+	if (EFI_ERROR(stream->handle->Read(stream->handle, &size, stream->buffer[i]))) {
+		stream->error = TRUE;
+		size = 0;
+	}
+	CostRecordRead(size, CostTicks() - t0);
+	stream->length[i] = size;
+}
+
+/**
+ * Wait until the read into a buffer is finished.
+ *
+ * @param stream The stream.
+ * @param i The buffer.
+ */
+static void Finish(struct Stream* stream, UINTN i) {
+	if (!stream->pending[i]) {
+		return;
+	}
+	EFI_FILE_IO_TOKEN* token = &stream->token[i];
+	UINT64 t0 = CostTicks();
+	if (BS->CheckEvent(token->Event) == EFI_SUCCESS) {
+		stream->ready_reads += 1;
+	} else {
+		UINTN index;
+		BS->WaitForEvent(1, &token->Event, &index);
+	}
+	UINT64 t1 = CostTicks();
+	stream->pending[i] = FALSE;
+	stream->reads += 1;
+	stream->busy_ticks += t1 - stream->started[i];
+	stream->wait_ticks += t1 - t0;
+	if (EFI_ERROR(token->Status)) {
+		stream->error = TRUE;
+		stream->length[i] = 0;
+	} else {
+		stream->length[i] = token->BufferSize;
+	}
+	CostRecordWait(stream->length[i], t1 - t0);
+}
+
+/**
+ * Fill the first buffer from the current file position,
+ * and start reading the next window into the other one.
+ */
+static void Begin(struct Stream* stream) {
+	Start(stream, 0);
+	Finish(stream, 0);
+	if (stream->length[0] == STREAM_BUFFER_SIZE) {
+		Start(stream, 1);
+	} else {
+		stream->length[1] = 0;
+	}
+	stream->current = 0;
+	stream->offset = 0;
+	stream->pos = 0;
+}
+
+/**
+ * Use ReadEx if the file protocol has it and the events can be created.
+ */
+static void InitAsync(struct Stream* stream) {
+	if (stream->handle->Revision < EFI_FILE_PROTOCOL_REVISION2 || !stream->handle->ReadEx) {
+		return;
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (EFI_ERROR(BS->CreateEvent(0, 0, 0, 0, &stream->token[i].Event))) {
+			if (i) {
+				BS->CloseEvent(stream->token[0].Event);
+			}
+			stream->token[0].Event = 0;
+			return;
+		}
+	}
+	stream->async = TRUE;
+}
+
+BOOLEAN StreamOpen(struct Stream* stream, EFI_FILE_HANDLE dir, const CHAR16* path) {
+	ZeroMem(stream, sizeof(*stream));
+	if (EFI_ERROR(dir->Open(dir, &stream->handle, (CHAR16*) path, EFI_FILE_MODE_READ, 0))) {
+		stream->handle = 0;
+		return FALSE;
+	}
+	EFI_FILE_INFO *info = LibFileInfo(stream->handle);
+	if (info) {
+		stream->size = info->FileSize;
+		FreePool(info);
+	}
+	if (EFI_ERROR(BS->AllocatePool(EfiBootServicesData, 2 * STREAM_BUFFER_SIZE, (void**) &stream->buffer[0]))) {
+		StreamClose(stream);
+		return FALSE;
+	}
+	stream->buffer[1] = stream->buffer[0] + STREAM_BUFFER_SIZE;
+	InitAsync(stream);
+	Begin(stream);
+	if (stream->error) {
+		StreamClose(stream);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+UINTN StreamRead(struct Stream* stream, void* dst, UINTN size) {
+	UINT8* out = dst;
+	UINTN done = 0;
+	while (done < size) {
+		UINTN i = stream->current;
+		UINTN left = stream->length[i] - stream->offset;
+		if (!left) {
+			// A short window is the last one.
+			if (stream->length[i] < STREAM_BUFFER_SIZE) {
+				break;
+			}
+			// Switch to the next window, and read the one after it
+			// into this buffer while the next one is consumed.
+			UINTN next = i ^ 1;
+			Finish(stream, next);
+			if (stream->length[next] == STREAM_BUFFER_SIZE) {
+				Start(stream, i);
+			} else {
+				stream->length[i] = 0;
+			}
+			stream->current = next;
+			stream->offset = 0;
+			continue;
+		}
+		UINTN n = size - done < left ? size - done : left;
+		CopyMem(out + done, stream->buffer[i] + stream->offset, n);
+		stream->offset += n;
+		done += n;
+	}
+	stream->pos += done;
+	return done;
+}
+
+BOOLEAN StreamRewind(struct Stream* stream) {
+	Finish(stream, 0);
+	Finish(stream, 1);
+	if (EFI_ERROR(stream->handle->SetPosition(stream->handle, 0))) {
+		stream->error = TRUE;
+		return FALSE;
+	}
+	stream->error = FALSE;
+	Begin(stream);
+	return !stream->error;
+}
+
+void StreamClose(struct Stream* stream) {
+	if (stream->handle) {
+		// The buffers can't be freed under a read in progress.
+		Finish(stream, 0);
+		Finish(stream, 1);
+		stream->handle->Close(stream->handle);
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (stream->token[i].Event) {
+			BS->CloseEvent(stream->token[i].Event);
+		}
+	}
+	if (stream->reads) {
+		LogDebug(L"HackBGRT: Async reads: %d of %d were ready when needed, %d%% of the read time overlapped decoding.\n",
+			(int) stream->ready_reads, (int) stream->reads,
+			stream->busy_ticks ? (int) (100 - stream->wait_ticks * 100 / stream->busy_ticks) : 0);
+	} else if (stream->handle && !stream->async) {
+		LogDebug(L"HackBGRT: File reads are synchronous.\n");
+	}
+	if (stream->buffer[0]) {
+		FreePool(stream->buffer[0]);
+	}
+	ZeroMem(stream, sizeof(*stream));
+}
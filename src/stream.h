@@ -0,0 +1,75 @@
+#pragma once
+
+#include <efi.h>
+
+/*
+ * Sequential reader for the image decoders.
+ *
+ * A file is read in windows of STREAM_BUFFER_SIZE bytes into two buffers,
+ * so the memory used for the compressed data doesn't grow with the file.
+ * While the decoder consumes one buffer, the next window is read into the
+ * other. If the file protocol has ReadEx (revision 2, UEFI 2.3.1), that
+ * read runs in the background, so the disk and the CPU work at the same
+ * time; otherwise the reads are synchronous.
+ */
+
+/**
+ * The size of one of the two buffers.
+ */
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+/**
+ * The state of a stream.
+ */
+struct Stream {
+	EFI_FILE_HANDLE handle;
+	UINT64 size; // The file size.
+	UINT64 pos; // The number of bytes consumed.
+	UINT8* buffer[2];
+	UINTN length[2]; // The number of valid bytes in each buffer.
+	UINTN current; // The buffer being consumed.
+	UINTN offset; // The position within the current buffer.
+	BOOLEAN error;
+	BOOLEAN async; // Reads are queued with ReadEx.
+	BOOLEAN pending[2]; // A read into the buffer is in progress.
+	EFI_FILE_IO_TOKEN token[2];
+	UINT64 started[2]; // The time when the read was queued.
+	UINTN reads, ready_reads; // Completed async reads, and those that didn't need waiting.
+	UINT64 busy_ticks, wait_ticks; // The time the reads took, and the time spent waiting for them.
+};
+
+/**
+ * Open a file for streaming.
+ *
+ * @param stream The stream to initialize.
+ * @param dir The directory.
+ * @param path The file path within the directory.
+ * @return TRUE on success, FALSE if the file can't be opened or the buffers can't be allocated.
+ */
+extern BOOLEAN StreamOpen(struct Stream* stream, EFI_FILE_HANDLE dir, const CHAR16* path);
+
+/**
+ * Read the next bytes.
+ *
+ * @param stream The stream.
+ * @param dst The destination.
+ * @param size The number of bytes to read.
+ * @return The number of bytes read; less than size at the end of the file or on error.
+ */
+extern UINTN StreamRead(struct Stream* stream, void* dst, UINTN size);
+
+/**
+ * Start reading again from the beginning.
+ *
+ * @param stream The stream.
+ * @return TRUE on success.
+ */
+extern BOOLEAN StreamRewind(struct Stream* stream);
+
+/**
+ * Close the file and free the buffers.
+ * With async reads, LogDebug reports how much of the reading overlapped decoding.
+ *
+ * @param stream The stream.
+ */
+extern void StreamClose(struct Stream* stream);
@@ -1,4 +1,5 @@
 #include "util.h"
+#include "cost.h"
 
 #include <efilib.h>
 
@@ -14,10 +15,6 @@ const CHAR16* TmpStr(CHAR8 *src, int length) {
 	return dest;
 }
 
-UINTN NullPrint(IN CONST CHAR16 *fmt, ...) {
-	return 0;
-}
-
 const CHAR16* TrimLeft(const CHAR16* s) {
 	// Skip white-space and BOM.
 	while (s[0] == L'\xfeff' || s[0] == ' ' || s[0] == '\t') {
@@ -26,6 +23,15 @@ const CHAR16* TrimLeft(const CHAR16* s) {
 	return s;
 }
 
+CHAR16* Trim(CHAR16* s) {
+	s = (CHAR16*) TrimLeft(s);
+	UINTN len = StrLen(s);
+	while (len && (s[len - 1] == ' ' || s[len - 1] == '\t')) {
+		s[--len] = 0;
+	}
+	return s;
+}
+
 const CHAR16* StrStr(const CHAR16* haystack, const CHAR16* needle) {
 	int len = StrLen(needle);
 	while (haystack && haystack[0]) {
@@ -99,7 +105,9 @@ void* LoadFileWithPadding(EFI_FILE_HANDLE dir, const CHAR16* path, UINTN* size_p
 		handle->Close(handle);
 		return 0;
 	}
+	UINT64 t0 = CostTicks();
 	e = handle->Read(handle, &size, data);
+	CostRecordRead(size, CostTicks() - t0);
 	for (int i = 0; i < padding; ++i) {
 		*((char*)data + size + i) = 0;
 	}
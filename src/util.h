@@ -1,6 +1,17 @@
 #pragma once
 
 #include <efi.h>
+#include <efilib.h>
+
+#include "../my_efilib/my_string.h"
+#include "log.h"
+
+/**
+ * CopyMem and ZeroMem from gnu-efi go byte by byte; use the optimized
+ * functions. CopyMem allows overlapping areas, so it maps to memmove.
+ */
+#define CopyMem(dest, src, len) my_memmove(dest, src, len)
+#define ZeroMem(buffer, size) my_memset(buffer, 0, size)
 
 /**
  * Convert a short ASCII string to UCS2, store in a static array.
@@ -11,11 +22,6 @@
  */
 extern const CHAR16* TmpStr(CHAR8 *src, int length);
 
-/**
- * Empty function that has the same signature as Print.
- */
-extern UINTN NullPrint(IN CONST CHAR16 *fmt, ...);
-
 /**
  * Return the greater of two numbers.
  */
@@ -38,6 +44,14 @@ static inline int min(int a, int b) {
  */
 extern const CHAR16* TrimLeft(const CHAR16* s);
 
+/**
+ * Trim BOM, spaces and tabs from the beginning and spaces and tabs from the end of a string.
+ *
+ * @param s The string; the end is trimmed in place.
+ * @return Pointer to the first acceptable character.
+ */
+extern CHAR16* Trim(CHAR16* s);
+
 /**
  * Find the position of another string within a string.
  *
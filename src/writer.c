@@ -0,0 +1,502 @@
+#include "writer.h"
+#include "bmp.h"
+#include "pixel.h"
+#include "resample.h"
+#include "util.h"
+#include "../my_efilib/my_efilib.h"
+
+#include <efilib.h>
+
+/*
+ * The resampler is separable and works in fixed point. Each needed source
+ * row is scaled horizontally into a ring of rows with 8.8-bit samples, and
+ * each output row is a weighted sum of the rows in the ring. Downscaling
+ * uses a box (area) filter and upscaling a bilinear filter; both are
+ * expressed as filter taps with 14-bit weights that sum to one. The
+ * passes themselves are in resample.c.
+ */
+
+#define WEIGHT_ONE (1 << RESAMPLE_WEIGHT_BITS)
+
+/*
+ * Rotated images go through a band of BAND_ROWS output rows. A full band
+ * is transposed into the BMP in tiles of BAND_ROWS x BAND_ROWS pixels, so
+ * that both the band and the destination rows stay in the cache.
+ */
+
+#define BAND_ROWS 16
+
+/**
+ * Check whether the rotation swaps the width and the height.
+ */
+static BOOLEAN IsQuarterTurn(const struct HackBGRT_writer* writer) {
+	return writer->rotate == 90 || writer->rotate == 270;
+}
+
+void WriterScaledSize(const struct HackBGRT_writer* writer, UINT32 src_w, UINT32 src_h, UINT32* scaled_w, UINT32* scaled_h) {
+	*scaled_w = src_w;
+	*scaled_h = src_h;
+	if (writer->scale == HackBGRT_SCALE_NONE || !writer->screen_w || !writer->screen_h || !src_w || !src_h) {
+		return;
+	}
+	// The image is scaled before rotating, so a quarter turn swaps the screen axes.
+	const UINT32 screen_w = IsQuarterTurn(writer) ? writer->screen_h : writer->screen_w;
+	const UINT32 screen_h = IsQuarterTurn(writer) ? writer->screen_w : writer->screen_h;
+	// Fit matches the dimension in which the image is relatively larger, fill the other one.
+	const BOOLEAN wider = (UINT64) src_w * screen_h > (UINT64) src_h * screen_w;
+	if (wider == (writer->scale == HackBGRT_SCALE_FIT)) {
+		*scaled_w = screen_w;
+		*scaled_h = max(1, ((UINT64) src_h * screen_w + src_w / 2) / src_w);
+	} else {
+		*scaled_h = screen_h;
+		*scaled_w = max(1, ((UINT64) src_w * screen_h + src_h / 2) / src_h);
+	}
+}
+
+/**
+ * Select the correct coordinate (manual, automatic, native)
+ *
+ * @param value The configured coordinate value; has special values for automatic and native.
+ * @param automatic The automatically calculated alternative.
+ * @param native The original coordinate.
+ * @see enum HackBGRT_coordinate
+ */
+static int SelectCoordinate(int value, int automatic, int native) {
+	if (value == HackBGRT_coord_auto) {
+		return automatic;
+	}
+	if (value == HackBGRT_coord_native) {
+		return native;
+	}
+	return value;
+}
+
+void WriterPlace(struct HackBGRT_writer* writer, UINT32 w, UINT32 h) {
+	// Calculate the automatically centered position for the image.
+	int auto_x = 0, auto_y = 0;
+	if (writer->screen_w && writer->screen_h) {
+		auto_x = max(0, ((int) writer->screen_w - (int) w) / 2);
+		auto_y = max(0, ((int) writer->screen_h * 2/3 - (int) h) / 2);
+	} else if (writer->native_w && writer->native_h) {
+		auto_x = max(0, writer->native_x + ((int) writer->native_w - (int) w) / 2);
+		auto_y = max(0, writer->native_y + ((int) writer->native_h - (int) h) / 2);
+	}
+
+	// Set the position (manual, automatic, original).
+	writer->offset_x = SelectCoordinate(writer->pos_x, auto_x, writer->native_x);
+	writer->offset_y = SelectCoordinate(writer->pos_y, auto_y, writer->native_y);
+}
+
+/**
+ * Compute the filter taps for one axis.
+ *
+ * @param src The source size.
+ * @param scaled The scaled size.
+ * @param offset The first visible output sample.
+ * @param count The number of visible output samples.
+ * @param taps The number of taps per output sample.
+ * @param first Returns the first source sample of each output sample.
+ * @param weights Returns the weights, taps per output sample; unused taps are 0.
+ */
+static void ComputeTaps(UINT32 src, UINT32 scaled, UINT32 offset, UINT32 count, UINT32 taps, UINT32* first, UINT16* weights) {
+	for (UINT32 i = 0; i < count; ++i) {
+		UINT16* w = weights + i * taps;
+		const UINT64 v = offset + i;
+		ZeroMem(w, taps * sizeof(*w));
+		if (scaled <= src) {
+			// Box: output v covers source [v * src, (v + 1) * src) in units of 1 / scaled.
+			const UINT64 start = v * src, end = start + src;
+			UINT32 j = start / scaled, k = 0, sum = 0;
+			first[i] = j;
+			for (; (UINT64) j * scaled < end && k < taps; ++j, ++k) {
+				UINT64 lo = (UINT64) j * scaled, hi = lo + scaled;
+				lo = lo > start ? lo : start;
+				hi = hi < end ? hi : end;
+				w[k] = (hi - lo) * WEIGHT_ONE / src;
+				sum += w[k];
+			}
+			w[k - 1] += WEIGHT_ONE - sum;
+		} else {
+			// Bilinear: sample at (v + 0.5) * src / scaled - 0.5, in 16.16 fixed point.
+			INT64 s = (INT64) (((2 * v + 1) * src << 16) / (2 * scaled)) - 0x8000;
+			s = s < 0 ? 0 : s;
+			UINT32 j = s >> 16;
+			UINT32 f = (s & 0xffff) >> (16 - RESAMPLE_WEIGHT_BITS);
+			if (j >= src - 1) {
+				j = src - 1;
+				f = 0;
+			}
+			first[i] = j;
+			w[0] = WEIGHT_ONE - f;
+			w[1] = f;
+		}
+	}
+}
+
+/**
+ * Allocate a zero-filled buffer for the resampler or the band. It comes
+ * from the arena with the decoder scratch, so that the caller's
+ * arena_release frees it even if the decoder doesn't get to WriterEnd.
+ */
+static void* WriterAlloc(UINTN size) {
+	return calloc(1, size);
+}
+
+/**
+ * Free the resampler buffers and the band, in the reverse order of
+ * allocation, so that the arena gets the space back.
+ */
+static void WriterFreeBuffers(struct HackBGRT_writer* writer) {
+	void** buffers[] = {
+		(void**) &writer->src_row, (void**) &writer->bgr_row, (void**) &writer->ring, (void**) &writer->v_weights,
+		(void**) &writer->v_first, (void**) &writer->h_weights, (void**) &writer->h_first,
+		(void**) &writer->band
+	};
+	for (int i = 0; i < sizeof(buffers) / sizeof(buffers[0]); ++i) {
+		free(*buffers[i]);
+		*buffers[i] = 0;
+	}
+}
+
+/**
+ * Get an output row: a BMP row, or a band row if the image is rotated.
+ *
+ * @param writer The writer.
+ * @param y The output row number, 0 <= y < dst_h.
+ */
+static UINT8* OutputRow(struct HackBGRT_writer* writer, UINT32 y) {
+	if (writer->band) {
+		return writer->band + (y % BAND_ROWS) * writer->dst_w * (writer->bpp / 8);
+	}
+	return BMPRow(writer->bmp, y);
+}
+
+/**
+ * Copy pixels from the band to the rotated positions in the BMP.
+ * The pixel size is a separate constant argument, so that the inlined
+ * copies become plain loads and stores.
+ */
+static inline void RotateTile(struct HackBGRT_writer* writer, UINT8* origin, UINT32 x0, UINT32 x1, UINT32 rows, const UINT32 bytes) {
+	const UINTN band_stride = writer->dst_w * bytes;
+	for (UINT32 x = x0; x < x1; ++x) {
+		const UINT8* src = writer->band + x * bytes;
+		UINT8* dst = origin + (INTN) x * writer->step_x;
+		for (UINT32 r = 0; r < rows; ++r, src += band_stride, dst += writer->step_y) {
+			if (bytes == 4) {
+				*(UINT32*) dst = *(const UINT32*) src;
+			} else {
+				dst[0] = src[0];
+				dst[1] = src[1];
+				dst[2] = src[2];
+			}
+		}
+	}
+}
+
+/**
+ * Widen the content box to the non-black pixels of an output row.
+ *
+ * @param writer The writer.
+ * @param y The output row number, 0 <= y < dst_h.
+ */
+static void TrackContent(struct HackBGRT_writer* writer, UINT32 y) {
+	const UINT8* row = OutputRow(writer, y);
+	const UINT32 bpp = writer->bpp;
+	// Only the columns outside the box found so far need to be searched.
+	UINT32 left = writer->content_x0, right = writer->content_x1;
+	if (!BMPIsBlack(row, 0, left, bpp)) {
+		for (left = 0; BMPIsBlack(row, left, left + 1, bpp); ++left) {
+		}
+	}
+	if (!BMPIsBlack(row, right, writer->dst_w, bpp)) {
+		for (right = writer->dst_w; BMPIsBlack(row, right - 1, right, bpp); --right) {
+		}
+	}
+	if (left != writer->content_x0 || right != writer->content_x1 || (left < right && !BMPIsBlack(row, left, right, bpp))) {
+		writer->content_x0 = left;
+		writer->content_x1 = right;
+		writer->content_y0 = min(writer->content_y0, y);
+		writer->content_y1 = y + 1;
+	}
+}
+
+/**
+ * Finish an output row. A rotated image is written to the BMP when the band is full.
+ *
+ * @param writer The writer.
+ * @param y The output row number, 0 <= y < dst_h.
+ */
+static void OutputDone(struct HackBGRT_writer* writer, UINT32 y) {
+	if (writer->content_known) {
+		TrackContent(writer, y);
+	}
+	if (!writer->band || ((y + 1) % BAND_ROWS && y + 1 < writer->dst_h)) {
+		return;
+	}
+	const UINT32 first = y - y % BAND_ROWS, rows = y + 1 - first;
+	UINT8* origin = writer->origin + (INTN) first * writer->step_y;
+	// Tiles of BAND_ROWS columns keep the strided side of the transpose in the cache.
+	for (UINT32 x0 = 0; x0 < writer->dst_w; x0 += BAND_ROWS) {
+		const UINT32 x1 = min(x0 + BAND_ROWS, writer->dst_w);
+		if (writer->bpp == 32) {
+			RotateTile(writer, origin, x0, x1, rows, 4);
+		} else {
+			RotateTile(writer, origin, x0, x1, rows, 3);
+		}
+	}
+}
+
+/**
+ * Set up the band and the mapping from output pixels to the rotated BMP:
+ * the output pixel (x, y) goes to origin + x * step_x + y * step_y.
+ *
+ * @return TRUE on success, FALSE on failure (allocation).
+ */
+static BOOLEAN BeginRotation(struct HackBGRT_writer* writer) {
+	BMP* bmp = writer->bmp;
+	const INTN bytes = writer->bpp / 8;
+	const INTN stride = BMPStride(bmp->width, bmp->bpp);
+	// BMP rows are bottom-up: the next row down is at -stride.
+	switch (writer->rotate) {
+		case 90: // (x, y) -> (dst_h - 1 - y, x)
+			writer->origin = BMPRow(bmp, 0) + (writer->dst_h - 1) * bytes;
+			writer->step_x = -stride;
+			writer->step_y = -bytes;
+			break;
+		case 180: // (x, y) -> (dst_w - 1 - x, dst_h - 1 - y)
+			writer->origin = BMPRow(bmp, writer->dst_h - 1) + (writer->dst_w - 1) * bytes;
+			writer->step_x = -bytes;
+			writer->step_y = stride;
+			break;
+		case 270: // (x, y) -> (y, dst_w - 1 - x)
+			writer->origin = BMPRow(bmp, writer->dst_w - 1);
+			writer->step_x = stride;
+			writer->step_y = bytes;
+			break;
+		default:
+			return TRUE;
+	}
+	writer->band = WriterAlloc(BAND_ROWS * writer->dst_w * bytes);
+	return writer->band != 0;
+}
+
+/**
+ * Cut off the parts of the output that fall outside the screen, on the
+ * right and at the bottom of the rotated image.
+ *
+ * @param writer The writer.
+ * @param cut_x The number of screen columns to cut on the right.
+ * @param cut_y The number of screen rows to cut at the bottom.
+ */
+static void CutOutput(struct HackBGRT_writer* writer, UINT32 cut_x, UINT32 cut_y) {
+	switch (writer->rotate) {
+		case 90: // The screen right is the image top, the screen bottom is the image right.
+			writer->y0 += cut_x;
+			writer->dst_h -= cut_x;
+			writer->dst_w -= cut_y;
+			break;
+		case 180: // The screen right is the image left, the screen bottom is the image top.
+			writer->x0 += cut_x;
+			writer->dst_w -= cut_x;
+			writer->y0 += cut_y;
+			writer->dst_h -= cut_y;
+			break;
+		case 270: // The screen right is the image bottom, the screen bottom is the image left.
+			writer->dst_h -= cut_x;
+			writer->x0 += cut_y;
+			writer->dst_w -= cut_y;
+			break;
+		default:
+			writer->dst_w -= cut_x;
+			writer->dst_h -= cut_y;
+			break;
+	}
+}
+
+/**
+ * Combine the rows in the ring into an output row.
+ */
+static void EmitRow(struct HackBGRT_writer* writer, UINT32 y) {
+	const UINT32 j = writer->v_first[y];
+	const UINT32 n = min(writer->v_taps, writer->src_h - j);
+	const UINT16* w = writer->v_weights + y * writer->v_taps;
+	UINT8* out = OutputRow(writer, y);
+	UINT8* bgr = writer->bgr_row ? writer->bgr_row : out;
+	ResampleVertical(bgr, writer->ring, writer->v_taps, j % writer->v_taps, w, n, writer->dst_w * 3);
+	if (writer->bgr_row) {
+		PixelRowFunction(PIXEL_BGR8, 32)(out, bgr, writer->dst_w);
+	}
+}
+
+BOOLEAN WriterBegin(struct HackBGRT_writer* writer, UINT32 src_w, UINT32 src_h) {
+	writer->src_w = src_w;
+	writer->src_h = src_h;
+	WriterScaledSize(writer, src_w, src_h, &writer->scaled_w, &writer->scaled_h);
+
+	// The output rows are in the image orientation, the BMP is rotated.
+	const BOOLEAN turn = IsQuarterTurn(writer);
+	const UINT32 screen_w = turn ? writer->screen_h : writer->screen_w;
+	const UINT32 screen_h = turn ? writer->screen_w : writer->screen_h;
+
+	// Fill may overflow the screen; keep only the centered part.
+	writer->dst_w = writer->scaled_w;
+	writer->dst_h = writer->scaled_h;
+	writer->x0 = writer->y0 = 0;
+	if (writer->scale == HackBGRT_SCALE_FILL) {
+		writer->dst_w = min(writer->dst_w, screen_w);
+		writer->dst_h = min(writer->dst_h, screen_h);
+		writer->x0 = (writer->scaled_w - writer->dst_w) / 2;
+		writer->y0 = (writer->scaled_h - writer->dst_h) / 2;
+	}
+
+	// Cut off the right and bottom parts that fall outside the screen.
+	UINT32 bmp_w = turn ? writer->dst_h : writer->dst_w;
+	UINT32 bmp_h = turn ? writer->dst_w : writer->dst_h;
+	WriterPlace(writer, bmp_w, bmp_h);
+	if (writer->screen_w && writer->screen_h) {
+		UINT32 visible_w = min(bmp_w, max(1, (int) writer->screen_w - writer->offset_x));
+		UINT32 visible_h = min(bmp_h, max(1, (int) writer->screen_h - writer->offset_y));
+		CutOutput(writer, bmp_w - visible_w, bmp_h - visible_h);
+		bmp_w = visible_w;
+		bmp_h = visible_h;
+	}
+
+	// Without a screen nothing is cut off; CreateBMP refuses BMPs over BMP_MAX_SIZE.
+	writer->bmp = CreateBMP(bmp_w, bmp_h, writer->bpp);
+	if (!writer->bmp) {
+		return FALSE;
+	}
+	if (!BeginRotation(writer)) {
+		WriterAbort(writer);
+		return FALSE;
+	}
+	// The content box starts empty.
+	writer->content_known = writer->autocrop;
+	writer->content_x0 = writer->dst_w;
+	writer->content_x1 = 0;
+	writer->content_y0 = writer->dst_h;
+	writer->content_y1 = 0;
+	if (writer->rotate) {
+		LogDebug(L"HackBGRT: Rotating by %d degrees.\n", (int) writer->rotate);
+	}
+	if (writer->scaled_w == src_w && writer->scaled_h == src_h) {
+		writer->roi_x = writer->x0;
+		writer->roi_y = writer->y0;
+		writer->roi_w = writer->dst_w;
+		writer->roi_h = writer->dst_h;
+		if (writer->roi_w != src_w || writer->roi_h != src_h) {
+			LogDebug(L"HackBGRT: Cropping %dx%d to %dx%d at (%d, %d).\n",
+				src_w, src_h, writer->roi_w, writer->roi_h, writer->roi_x, writer->roi_y);
+		}
+		return TRUE;
+	}
+
+	writer->h_taps = writer->scaled_w < src_w ? (src_w + writer->scaled_w - 1) / writer->scaled_w + 1 : 2;
+	writer->v_taps = writer->scaled_h < src_h ? (src_h + writer->scaled_h - 1) / writer->scaled_h + 1 : 2;
+	writer->h_first = WriterAlloc(writer->dst_w * sizeof(UINT32));
+	writer->h_weights = WriterAlloc(writer->dst_w * writer->h_taps * sizeof(UINT16));
+	writer->v_first = WriterAlloc(writer->dst_h * sizeof(UINT32));
+	writer->v_weights = WriterAlloc(writer->dst_h * writer->v_taps * sizeof(UINT16));
+	writer->ring = WriterAlloc(writer->v_taps * writer->dst_w * 3 * sizeof(UINT16));
+	// 32-bit rows are combined into 24-bit samples first.
+	writer->bgr_row = writer->bpp == 32 ? WriterAlloc(writer->dst_w * 3) : 0;
+	if (!writer->h_first || !writer->h_weights || !writer->v_first || !writer->v_weights || !writer->ring || (writer->bpp == 32 && !writer->bgr_row)) {
+		WriterAbort(writer);
+		return FALSE;
+	}
+	ComputeTaps(src_w, writer->scaled_w, writer->x0, writer->dst_w, writer->h_taps, writer->h_first, writer->h_weights);
+	ComputeTaps(src_h, writer->scaled_h, writer->y0, writer->dst_h, writer->v_taps, writer->v_first, writer->v_weights);
+
+	// The source pixels covered by the taps; h_first becomes relative to roi_x.
+	writer->roi_x = writer->h_first[0];
+	writer->roi_w = min(writer->h_first[writer->dst_w - 1] + writer->h_taps, src_w) - writer->roi_x;
+	writer->roi_y = writer->v_first[0];
+	writer->roi_h = min(writer->v_first[writer->dst_h - 1] + writer->v_taps, src_h) - writer->roi_y;
+	for (UINT32 x = 0; x < writer->dst_w; ++x) {
+		writer->h_first[x] -= writer->roi_x;
+	}
+	writer->src_row = WriterAlloc(writer->roi_w * (writer->bpp / 8));
+	if (!writer->src_row) {
+		WriterAbort(writer);
+		return FALSE;
+	}
+	LogDebug(L"HackBGRT: Scaling %dx%d to %dx%d, visible %dx%d at (%d, %d), source %dx%d at (%d, %d).\n",
+		src_w, src_h, writer->scaled_w, writer->scaled_h, writer->dst_w, writer->dst_h, writer->x0, writer->y0,
+		writer->roi_w, writer->roi_h, writer->roi_x, writer->roi_y);
+	writer->next_row = 0;
+	return TRUE;
+}
+
+UINT8* WriterRow(struct HackBGRT_writer* writer, UINT32 y) {
+	if (WriterIsDirect(writer)) {
+		return OutputRow(writer, y - writer->roi_y);
+	}
+	return writer->src_row;
+}
+
+void WriterCommit(struct HackBGRT_writer* writer, UINT32 y) {
+	if (WriterIsDirect(writer)) {
+		OutputDone(writer, y - writer->roi_y);
+		return;
+	}
+	if (writer->next_row >= writer->dst_h) {
+		return;
+	}
+	// Rows above the visible part are not needed.
+	if (y < writer->v_first[writer->next_row]) {
+		return;
+	}
+	UINT16* row = writer->ring + (y % writer->v_taps) * writer->dst_w * 3;
+	ResampleHorizontal(row, writer->src_row, writer->bpp / 8, writer->roi_w, writer->h_first, writer->h_weights, writer->h_taps, writer->dst_w);
+	while (writer->next_row < writer->dst_h) {
+		UINT32 last = min(writer->v_first[writer->next_row] + writer->v_taps - 1, writer->src_h - 1);
+		if (last > y) {
+			break;
+		}
+		EmitRow(writer, writer->next_row);
+		OutputDone(writer, writer->next_row);
+		writer->next_row += 1;
+	}
+}
+
+BMP* WriterEnd(struct HackBGRT_writer* writer) {
+	WriterFreeBuffers(writer);
+	return writer->bmp;
+}
+
+BOOLEAN WriterContentBox(const struct HackBGRT_writer* writer, UINT32* x, UINT32* y, UINT32* w, UINT32* h) {
+	const UINT32 x0 = writer->content_x0, x1 = writer->content_x1;
+	const UINT32 y0 = writer->content_y0, y1 = writer->content_y1;
+	if (x0 >= x1) {
+		return FALSE;
+	}
+	// Map the box like BeginRotation maps the pixels.
+	switch (writer->rotate) {
+		case 90: // (x, y) -> (dst_h - 1 - y, x)
+			*x = writer->dst_h - y1;
+			*y = x0;
+			break;
+		case 180: // (x, y) -> (dst_w - 1 - x, dst_h - 1 - y)
+			*x = writer->dst_w - x1;
+			*y = writer->dst_h - y1;
+			break;
+		case 270: // (x, y) -> (y, dst_w - 1 - x)
+			*x = y0;
+			*y = writer->dst_w - x1;
+			break;
+		default:
+			*x = x0;
+			*y = y0;
+			break;
+	}
+	*w = IsQuarterTurn(writer) ? y1 - y0 : x1 - x0;
+	*h = IsQuarterTurn(writer) ? x1 - x0 : y1 - y0;
+	return TRUE;
+}
+
+void WriterAbort(struct HackBGRT_writer* writer) {
+	WriterFreeBuffers(writer);
+	writer->content_known = FALSE;
+	FreeBMP(writer->bmp);
+	writer->bmp = 0;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+/**
+ * Writes decoded image rows to a BMP for the BGRT, scaling them if needed.
+ *
+ * The decoder calls WriterBegin with the image size, then for each row
+ * from top to bottom converts the pixels to WriterRow and calls
+ * WriterCommit, and finally calls WriterEnd (or WriterAbort on failure).
+ *
+ * Only the part of the image that ends up on the screen is produced: the
+ * decoder only needs to convert the rows and columns of the region of
+ * interest (roi_x, roi_y, roi_w, roi_h); the other rows need no WriterRow
+ * or WriterCommit at all.
+ *
+ * Without scaling, WriterRow points directly to the BMP. With scaling,
+ * the rows are resampled as they come, keeping only a few rows in memory.
+ * A rotated image is collected in bands of a few rows, which are then
+ * transposed into the BMP.
+ */
+struct HackBGRT_writer {
+	// Settings, filled in before WriterBegin.
+	UINT32 bpp;
+	enum HackBGRT_scale scale;
+	UINT32 screen_w, screen_h;
+	// The configured position (see enum HackBGRT_coordinate) and the original BGRT image.
+	int pos_x, pos_y;
+	int native_x, native_y;
+	UINT32 native_w, native_h;
+	// The clockwise rotation in degrees: 0, 90, 180 or 270.
+	UINT32 rotate;
+	// Find the non-black part of the image while writing it; see WriterContentBox.
+	BOOLEAN autocrop;
+
+	// The source image size, and the part of it that is needed.
+	UINT32 src_w, src_h;
+	UINT32 roi_x, roi_y, roi_w, roi_h;
+	// The scaled image size, and the visible part of it (the BMP, before rotation).
+	UINT32 scaled_w, scaled_h;
+	UINT32 x0, y0, dst_w, dst_h;
+	BMP* bmp;
+	// The BGRT offsets of the BMP.
+	int offset_x, offset_y;
+
+	// Resampler state; see writer.c.
+	UINT8* src_row;
+	UINT32 h_taps, v_taps;
+	UINT32* h_first;
+	UINT16* h_weights;
+	UINT32* v_first;
+	UINT16* v_weights;
+	UINT16* ring;
+	UINT8* bgr_row;
+	UINT32 next_row;
+
+	// Rotation state; see writer.c.
+	UINT8* band;
+	UINT8* origin;
+	INTN step_x, step_y;
+
+	// The non-black part of the output rows written so far, before rotation.
+	BOOLEAN content_known;
+	UINT32 content_x0, content_x1, content_y0, content_y1;
+};
+
+/**
+ * Calculate the scaled size of an image.
+ *
+ * @param writer The writer with its settings.
+ * @param src_w The source width.
+ * @param src_h The source height.
+ * @param scaled_w Returns the scaled width.
+ * @param scaled_h Returns the scaled height.
+ */
+extern void WriterScaledSize(const struct HackBGRT_writer* writer, UINT32 src_w, UINT32 src_h, UINT32* scaled_w, UINT32* scaled_h);
+
+/**
+ * Calculate the BGRT offsets for a BMP of the given size.
+ * WriterBegin does this automatically; this is for images that are used as is.
+ *
+ * @param writer The writer with its settings.
+ * @param w The BMP width.
+ * @param h The BMP height.
+ */
+extern void WriterPlace(struct HackBGRT_writer* writer, UINT32 w, UINT32 h);
+
+/**
+ * Start writing an image: place and crop it, allocate the BMP and the resampler.
+ *
+ * @param writer The writer with its settings.
+ * @param src_w The source width.
+ * @param src_h The source height.
+ * @return TRUE on success, FALSE on failure (allocation).
+ */
+extern BOOLEAN WriterBegin(struct HackBGRT_writer* writer, UINT32 src_w, UINT32 src_h);
+
+/**
+ * Check whether the source rows are used as they are, without scaling.
+ */
+static inline BOOLEAN WriterIsDirect(const struct HackBGRT_writer* writer) {
+	return !writer->src_row;
+}
+
+/**
+ * Get the buffer for a source row, in the BMP pixel format.
+ *
+ * @param writer The writer.
+ * @param y The source row number, counting from the top; roi_y <= y < roi_y + roi_h.
+ * @return Pointer for roi_w pixels, starting from the source column roi_x.
+ */
+extern UINT8* WriterRow(struct HackBGRT_writer* writer, UINT32 y);
+
+/**
+ * Finish a source row of the region of interest. Rows must be committed from top to bottom.
+ *
+ * @param writer The writer.
+ * @param y The source row number, counting from the top.
+ */
+extern void WriterCommit(struct HackBGRT_writer* writer, UINT32 y);
+
+/**
+ * Finish writing and free the resampler.
+ *
+ * @return The BMP.
+ */
+extern BMP* WriterEnd(struct HackBGRT_writer* writer);
+
+/**
+ * Get the bounding box of the pixels that are not black, found while
+ * writing with the autocrop setting, in the same form as BMPContentBox.
+ *
+ * @param writer The writer after WriterEnd.
+ * @param x Returns the left edge.
+ * @param y Returns the top edge, counting from the top.
+ * @param w Returns the width.
+ * @param h Returns the height.
+ * @return FALSE if the whole BMP is black, TRUE otherwise.
+ */
+extern BOOLEAN WriterContentBox(const struct HackBGRT_writer* writer, UINT32* x, UINT32* y, UINT32* w, UINT32* h);
+
+/**
+ * Cancel writing and free everything, including the BMP.
+ */
+extern void WriterAbort(struct HackBGRT_writer* writer);
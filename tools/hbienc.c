@@ -0,0 +1,282 @@
+// Host tool for converting images to the HBI format (src/hbi.h).
+//
+// Reads an uncompressed 24-bit or 32-bit BMP, or a binary PPM (P6),
+// and writes an HBI file with LZ4-compressed tiles. The result is checked
+// by decoding it again; with -b, the decoding speed is also measured.
+// If the output name ends with ".c", the file is written as a C array
+// for the builtin image (src/builtin.h).
+//
+// Usage: hbienc [-t tile_rows] [-b] input.bmp|input.ppm output.hbi|output.c
+
+#include "../src/hbi.h"
+#include "../src/lz4.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint32_t read16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t read32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Write the data as the C array of the builtin image.
+static int write_c(FILE* f, const uint8_t* data, size_t size) {
+	fprintf(f, "// Generated by tools/hbienc; see src/builtin.h.\n\n");
+	fprintf(f, "const unsigned int builtin_image_size = %zu;\n\n", size);
+	fprintf(f, "__attribute__((aligned(8))) const unsigned char builtin_image[] = {");
+	for (size_t i = 0; i < size; ++i) {
+		fprintf(f, "%s0x%02x,", i % 16 ? " " : "\n\t", data[i]);
+	}
+	return fprintf(f, "\n};\n") > 0;
+}
+
+static uint8_t* read_file(const char* path, size_t* size) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	rewind(f);
+	uint8_t* data = malloc(*size + 1);
+	if (data && fread(data, 1, *size, f) != *size) {
+		free(data);
+		data = 0;
+	}
+	fclose(f);
+	return data;
+}
+
+// The image as HBI rows: top to bottom, BGR or BGRX, no padding.
+struct image {
+	uint32_t width, height, bpp;
+	uint8_t* pixels;
+};
+
+static int load_bmp(const uint8_t* data, size_t size, struct image* img) {
+	if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+		return 0;
+	}
+	int32_t w = read32(data + 18), h = read32(data + 22);
+	uint32_t bpp = read16(data + 28), compression = read32(data + 30), offset = read32(data + 10);
+	if (w <= 0 || h == 0 || (bpp != 24 && bpp != 32) || compression != 0) {
+		fprintf(stderr, "Only uncompressed 24-bit and 32-bit BMP files are supported.\n");
+		return 0;
+	}
+	img->width = w;
+	img->height = h < 0 ? -h : h;
+	img->bpp = bpp;
+	size_t stride = ((size_t) w * bpp / 8 + 3) & ~(size_t) 3;
+	size_t row_bytes = (size_t) w * bpp / 8;
+	if (offset > size || stride * img->height > size - offset) {
+		return 0;
+	}
+	img->pixels = malloc(row_bytes * img->height);
+	for (uint32_t y = 0; y < img->height; ++y) {
+		uint32_t src_y = h < 0 ? y : img->height - 1 - y;
+		memcpy(img->pixels + y * row_bytes, data + offset + src_y * stride, row_bytes);
+	}
+	return 1;
+}
+
+static int load_ppm(const uint8_t* data, size_t size, struct image* img) {
+	unsigned w, h, maxval;
+	int n = 0;
+	if (size < 2 || data[0] != 'P' || data[1] != '6') {
+		return 0;
+	}
+	((uint8_t*) data)[size] = 0;
+	if (sscanf((const char*) data, "P6 %u %u %u%n", &w, &h, &maxval, &n) != 3 || maxval != 255) {
+		fprintf(stderr, "Only 8-bit binary PPM files are supported.\n");
+		return 0;
+	}
+	const uint8_t* src = data + n + 1;
+	if ((size_t) (src - data) > size || (size_t) w * h * 3 > size - (src - data)) {
+		return 0;
+	}
+	img->width = w;
+	img->height = h;
+	img->bpp = 24;
+	img->pixels = malloc((size_t) w * h * 3);
+	for (size_t i = 0; i < (size_t) w * h; ++i) {
+		img->pixels[i * 3 + 0] = src[i * 3 + 2];
+		img->pixels[i * 3 + 1] = src[i * 3 + 1];
+		img->pixels[i * 3 + 2] = src[i * 3 + 0];
+	}
+	return 1;
+}
+
+// LZ4 block compression: greedy matching with a hash table of 4-byte sequences.
+// The format requires the last match to start at least 12 bytes before the end
+// and the last 5 bytes to be literals.
+
+static uint8_t* emit_length(uint8_t* op, size_t len) {
+	for (; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+static uint8_t* emit_sequence(uint8_t* op, const uint8_t* literals, size_t literal_len, size_t offset, size_t match_len) {
+	uint8_t* token = op++;
+	size_t ml = match_len ? match_len - 4 : 0;
+	*token = (literal_len < 15 ? literal_len : 15) << 4 | (ml < 15 ? ml : 15);
+	if (literal_len >= 15) {
+		op = emit_length(op, literal_len - 15);
+	}
+	memcpy(op, literals, literal_len);
+	op += literal_len;
+	if (match_len) {
+		*op++ = offset;
+		*op++ = offset >> 8;
+		if (ml >= 15) {
+			op = emit_length(op, ml - 15);
+		}
+	}
+	return op;
+}
+
+static size_t lz4_bound(size_t n) {
+	return n + n / 255 + 16;
+}
+
+static size_t lz4_compress(uint8_t* dst, const uint8_t* src, size_t n) {
+	static uint32_t table[1 << 16];
+	memset(table, 0, sizeof(table));
+	uint8_t* op = dst;
+	size_t ip = 0, anchor = 0;
+	while (n >= 13 && ip <= n - 12) {
+		uint32_t seq = read32(src + ip);
+		uint32_t h = (seq * 2654435761u) >> 16;
+		size_t ref = table[h];
+		table[h] = ip + 1;
+		if (ref-- && ip - ref <= 65535 && read32(src + ref) == seq) {
+			size_t len = 4;
+			while (ip + len < n - 5 && src[ref + len] == src[ip + len]) {
+				++len;
+			}
+			op = emit_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+			ip += len;
+			anchor = ip;
+		} else {
+			++ip;
+		}
+	}
+	op = emit_sequence(op, src + anchor, n - anchor, 0, 0);
+	return op - dst;
+}
+
+int main(int argc, char** argv) {
+	uint32_t tile_rows = 16;
+	int bench = 0;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; ++i) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			tile_rows = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-b") == 0) {
+			bench = 1;
+		} else {
+			break;
+		}
+	}
+	if (argc - i != 2 || tile_rows == 0 || tile_rows > HBI_MAX_SIZE) {
+		fprintf(stderr, "Usage: %s [-t tile_rows] [-b] input.bmp|input.ppm output.hbi|output.c\n", argv[0]);
+		return 1;
+	}
+
+	size_t in_size;
+	uint8_t* in = read_file(argv[i], &in_size);
+	struct image img;
+	if (!in || !(load_bmp(in, in_size, &img) || load_ppm(in, in_size, &img))) {
+		fprintf(stderr, "%s: can't read the image.\n", argv[i]);
+		return 1;
+	}
+	if (img.width > HBI_MAX_SIZE || img.height > HBI_MAX_SIZE) {
+		fprintf(stderr, "%s: the image is too big.\n", argv[i]);
+		return 1;
+	}
+
+	struct hbi_header header = {
+		.magic = {HBI_MAGIC[0], HBI_MAGIC[1], HBI_MAGIC[2], HBI_MAGIC[3]},
+		.width = img.width,
+		.height = img.height,
+		.bpp = img.bpp,
+		.tile_rows = tile_rows,
+		.tile_count = (img.height - 1) / tile_rows + 1,
+	};
+	size_t stride = HBIStride(&header);
+	size_t index_size = (header.tile_count + 1) * sizeof(uint32_t);
+	size_t capacity = sizeof(header) + index_size + header.tile_count * lz4_bound(tile_rows * stride);
+	uint8_t* out = malloc(capacity);
+	uint32_t* offsets = (uint32_t*) (out + sizeof(header));
+	memcpy(out, &header, sizeof(header));
+	size_t pos = sizeof(header) + index_size;
+	for (uint32_t t = 0; t < header.tile_count; ++t) {
+		offsets[t] = pos;
+		const uint8_t* raw = img.pixels + (size_t) t * tile_rows * stride;
+		size_t raw_size = HBITileRows(&header, t) * stride;
+		size_t n = lz4_compress(out + pos, raw, raw_size);
+		if (n >= raw_size) {
+			// Incompressible; a tile of the raw size is stored as is.
+			memcpy(out + pos, raw, raw_size);
+			n = raw_size;
+		}
+		pos += n;
+	}
+	offsets[header.tile_count] = pos;
+	if (pos > UINT32_MAX) {
+		fprintf(stderr, "%s: the image is too big.\n", argv[i]);
+		return 1;
+	}
+
+	// Check the result with the same decoder as HackBGRT.
+	const struct hbi_header* parsed = HBIParse(out, pos);
+	uint8_t* check = malloc((size_t) img.height * stride);
+	for (uint32_t t = 0; parsed && t < header.tile_count; ++t) {
+		if (!HBIDecodeTile(parsed, t, check + (size_t) t * tile_rows * stride)) {
+			parsed = 0;
+		}
+	}
+	if (!parsed || memcmp(check, img.pixels, (size_t) img.height * stride) != 0) {
+		fprintf(stderr, "%s: decoding the result failed.\n", argv[i + 1]);
+		return 1;
+	}
+
+	const char* ext = strrchr(argv[i + 1], '.');
+	int c_array = ext && strcmp(ext, ".c") == 0;
+	FILE* f = fopen(argv[i + 1], c_array ? "w" : "wb");
+	int written = f && (c_array ? write_c(f, out, pos) : fwrite(out, 1, pos, f) == pos);
+	if (!f || fclose(f) != 0 || !written) {
+		fprintf(stderr, "%s: can't write the file.\n", argv[i + 1]);
+		return 1;
+	}
+	printf("%ux%u, %u bpp, %u tiles of %u rows: %zu -> %zu bytes (%.1f%%)\n",
+		img.width, img.height, img.bpp, header.tile_count, tile_rows,
+		(size_t) img.height * stride, pos, 100.0 * pos / ((size_t) img.height * stride));
+
+	if (bench) {
+		int iterations = 0;
+		double t0 = now(), t1;
+		do {
+			for (uint32_t t = 0; t < header.tile_count; ++t) {
+				HBIDecodeTile(parsed, t, check + (size_t) t * tile_rows * stride);
+			}
+			++iterations;
+		} while ((t1 = now()) - t0 < 1.0);
+		printf("decode: %.2f ms, %.0f MB/s on one core\n",
+			(t1 - t0) * 1e3 / iterations, (double) img.height * stride * iterations / (t1 - t0) / 1e6);
+	}
+	return 0;
+}
@@ -59,6 +59,8 @@ freely, subject to the following restrictions:
 #define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
 #define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
 
+#define INPUT_BUFFER_SIZE 4096	/* the window of compressed data being inflated */
+
 #define SET_ERROR(upng,code) do { (upng)->error = (code); (upng)->error_line = __LINE__; } while (0)
 
 #define upng_chunk_length(chunk) MAKE_DWORD_PTR(chunk)
@@ -83,9 +85,20 @@ typedef enum upng_color {
 typedef struct upng_source {
 	const unsigned char*	buffer;
 	unsigned long			size;
+	unsigned long			pos;
 	char					owning;
+	upng_read_callback		read;
+	void*					user;
 } upng_source;
 
+/* the compressed data, read from the IDAT chunks as it is inflated */
+typedef struct upng_input {
+	unsigned char			buffer[INPUT_BUFFER_SIZE];
+	unsigned long			length;
+	unsigned long			idat_left;	/* bytes left in the current IDAT chunk */
+	char					idat_done;
+} upng_input;
+
 struct upng_t {
 	unsigned		width;
 	unsigned		height;
@@ -98,12 +111,16 @@ struct upng_t {
 	unsigned long	size;
 
 	unsigned char*	palette;
+	unsigned		palette_entries;
+
+	unsigned		row_limit;
 
 	upng_error		error;
 	unsigned		error_line;
 
 	upng_state		state;
 	upng_source		source;
+	upng_input		input;
 };
 
 typedef struct huffman_tree {
@@ -197,6 +214,81 @@ static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstr
 	return result;
 }
 
+/*read the next bytes of the file; return the number of bytes read, less than size at the end */
+static unsigned long upng_source_read(upng_t* upng, unsigned char* buffer, unsigned long size)
+{
+	if (upng->source.read != NULL) {
+		return upng->source.read(upng->source.user, buffer, size);
+	}
+
+	if (size > upng->source.size - upng->source.pos) {
+		size = upng->source.size - upng->source.pos;
+	}
+	memcpy(buffer, upng->source.buffer + upng->source.pos, size);
+	upng->source.pos += size;
+	return size;
+}
+
+/*skip the next bytes of the file; return 0 if the file ends first */
+static int upng_source_skip(upng_t* upng, unsigned long size)
+{
+	unsigned char tmp[256];
+	while (size > 0) {
+		unsigned long n = size < sizeof(tmp) ? size : sizeof(tmp);
+		if (upng_source_read(upng, tmp, n) != n) {
+			return 0;
+		}
+		size -= n;
+	}
+	return 1;
+}
+
+/*read the next bytes of the zlib stream, which continues from one IDAT chunk to the next; return the number of bytes read */
+static unsigned long upng_idat_read(upng_t* upng, unsigned char* buffer, unsigned long size)
+{
+	unsigned long done = 0;
+	while (done < size && !upng->input.idat_done) {
+		unsigned long n, got;
+
+		if (upng->input.idat_left == 0) {
+			/* the CRC of the previous chunk and the header of the next one */
+			unsigned char header[12];
+			if (upng_source_read(upng, header, 12) != 12 || upng_chunk_type(header + 4) != CHUNK_IDAT || upng_chunk_length(header + 4) > INT_MAX) {
+				upng->input.idat_done = 1;
+				break;
+			}
+			upng->input.idat_left = upng_chunk_length(header + 4);
+			continue;
+		}
+
+		n = size - done < upng->input.idat_left ? size - done : upng->input.idat_left;
+		got = upng_source_read(upng, buffer + done, n);
+		done += got;
+		upng->input.idat_left -= got;
+		if (got != n) {
+			upng->input.idat_done = 1;
+		}
+	}
+	return done;
+}
+
+/*make sure that at least "need" bytes from the bit pointer on are in the input buffer, unless the data ends first; the bytes before the bit pointer are dropped */
+static void uz_refill(upng_t* upng, unsigned long *bp, unsigned long need)
+{
+	unsigned long start = (*bp) >> 3, i;
+	if (start > upng->input.length || upng->input.length - start >= need || upng->input.idat_done) {
+		return;
+	}
+
+	for (i = start; i < upng->input.length; i++) {
+		upng->input.buffer[i - start] = upng->input.buffer[i];
+	}
+	upng->input.length -= start;
+	(*bp) &= 0x7;
+
+	upng->input.length += upng_idat_read(upng, upng->input.buffer + upng->input.length, INPUT_BUFFER_SIZE - upng->input.length);
+}
+
 /* the buffer must be numcodes*2 in size! */
 static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
 {
@@ -210,7 +302,7 @@ static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned num
 static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
 {
 	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
+	unsigned blcount[MAX_BIT_LENGTH+1];
 	unsigned nextcode[MAX_BIT_LENGTH+1];
 	unsigned bits, n, i;
 	unsigned nodefilled = 0;	/*up to which node it is filled */
@@ -274,13 +366,14 @@ static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const
 	}
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+static unsigned huffman_decode_symbol(upng_t *upng, unsigned long *bp, const huffman_tree* codetree)
 {
+	const unsigned char *in = upng->input.buffer;
 	unsigned treepos = 0, ct;
 	unsigned char bit;
 	for (;;) {
 		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
+		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) >= upng->input.length) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return 0;
 		}
@@ -301,8 +394,9 @@ static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, uns
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, unsigned long *bp)
 {
+	const unsigned char *in = upng->input.buffer;
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
 	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
 	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
@@ -310,7 +404,9 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 
 	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
 	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
+	/*the counts and the code length codes take at most 71 bits */
+	uz_refill(upng, bp, 10);
+	if (((*bp) >> 3) + 2 >= upng->input.length) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
@@ -342,7 +438,10 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*now we can use this tree to read the lengths for the tree that this function will return */
 	i = 0;
 	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		unsigned code;
+		/*a code length code and its repeat count take at most 14 bits */
+		uz_refill(upng, bp, 3);
+		code = huffman_decode_symbol(upng, bp, codelengthcodetree);
 		if (upng->error != UPNG_EOK) {
 			break;
 		}
@@ -358,7 +457,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
 			unsigned value;	/*set value to the previous code */
 
-			if ((*bp) >> 3 >= inlength) {
+			if ((*bp) >> 3 >= upng->input.length) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
@@ -388,7 +487,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			}
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
 			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
+			if ((*bp) >> 3 >= upng->input.length) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
@@ -414,7 +513,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 		} else if (code == 18) {	/*repeat "0" 11-138 times */
 			unsigned replength = 11;	/*read in the bits that indicate repeat length */
 			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
+			if ((*bp) >> 3 >= upng->input.length) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
@@ -456,8 +555,9 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 }
 
 /*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, unsigned long *bp, unsigned long *pos, unsigned btype)
 {
+	const unsigned char *in = upng->input.buffer;
 	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
 	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
 	unsigned done = 0;
@@ -477,11 +577,14 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
 		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
 		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, bp);
 	}
 
 	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+		unsigned code;
+		/*a length code, a distance code and their extra bits take at most 48 bits */
+		uz_refill(upng, bp, 7);
+		code = huffman_decode_symbol(upng, bp, &codetree);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
@@ -508,14 +611,14 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
 
 			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			if (((*bp) >> 3) >= upng->input.length) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 			length += read_bits(bp, in, numextrabits);
 
 			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			codeD = huffman_decode_symbol(upng, bp, &codetreeD);
 			if (upng->error != UPNG_EOK) {
 				return;
 			}
@@ -532,7 +635,7 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			numextrabitsD = DISTANCE_EXTRA[codeD];
 
 			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			if (((*bp) >> 3) >= upng->input.length) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
@@ -560,8 +663,9 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, unsigned long *bp, unsigned long *pos)
 {
+	const unsigned char *in = upng->input.buffer;
 	unsigned long p;
 	unsigned len, nlen, n;
 
@@ -569,10 +673,11 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 	while (((*bp) & 0x7) != 0) {
 		(*bp)++;
 	}
+	uz_refill(upng, bp, 4);
 	p = (*bp) / 8;		/*byte position */
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
+	if (p + 4 > upng->input.length) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
@@ -581,6 +686,7 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 	p += 2;
 	nlen = in[p] + 256 * in[p + 1];
 	p += 2;
+	(*bp) = p * 8;
 
 	/* check if 16-bit nlen is really the one's complement of len */
 	if (len + nlen != 65535) {
@@ -593,23 +699,27 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 		return;
 	}
 
-	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
+	/* read the literal data: len bytes are now stored in the out buffer, one input buffer at a time */
+	while (len > 0) {
+		uz_refill(upng, bp, len);
+		p = (*bp) / 8;
+		n = upng->input.length - p < len ? upng->input.length - p : len;
+		if (n == 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
+		memcpy(out + (*pos), in + p, n);
+		(*pos) += n;
+		(*bp) += n * 8;
+		len -= n;
 	}
-
-	(*bp) = p * 8;
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
+static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, unsigned long bp)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
+	/*bp is the bit pointer in the input buffer, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
 	unsigned long pos = 0;	/*byte position in the out buffer */
 
 	unsigned done = 0;
@@ -618,23 +728,24 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 		unsigned btype;
 
 		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		uz_refill(upng, &bp, 1);
+		if ((bp >> 3) >= upng->input.length) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
 		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+		done = read_bit(&bp, upng->input.buffer);
+		btype = read_bits(&bp, upng->input.buffer, 2);
 
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, outsize, &bp, &pos);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, out, outsize, &bp, &pos, btype);	/*compression, btype 01 or 10 */
 		}
 
 		/* stop if an error has occured */
@@ -646,10 +757,17 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 	return upng->error;
 }
 
-static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, const unsigned char *in, unsigned long insize)
+/*inflate the zlib stream of the IDAT chunks; the first chunk header has been read already */
+static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize)
 {
+	const unsigned char *in = upng->input.buffer;
+	unsigned long bp = 0;
+
+	upng->input.length = 0;
+	uz_refill(upng, &bp, INPUT_BUFFER_SIZE);
+
 	/* we require two bytes for the zlib data header */
-	if (insize < 2) {
+	if (upng->input.length < 2) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
@@ -673,7 +791,7 @@ static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long out
 	}
 
 	/* create output buffer */
-	uz_inflate_data(upng, out, outsize, in, insize, 2);
+	uz_inflate_data(upng, out, outsize, 16);
 
 	return upng->error;
 }
@@ -694,6 +812,109 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
+/*
+   Vector unfilter: Up 16 bytes at a time, and for 3 and 4 bytes per pixel
+   (8-bit RGB and RGBA) Average and Paeth one pixel at a time in 16-bit
+   lanes, without the branches of paeth_predictor, which mispredict on
+   photos. The generic vectors compile to SSE2 on x86_64. Sub gains
+   nothing, and SSE4.1 (pmovzxbw, pblendvb) measured the same as SSE2,
+   so there are no other variants.
+ */
+static int simd_enabled = 0;
+
+typedef unsigned char px_bytes __attribute__((vector_size(8)));
+typedef short px_vec __attribute__((vector_size(16)));
+typedef unsigned char row_vec __attribute__((vector_size(16), aligned(1), may_alias));
+typedef unsigned px_u32 __attribute__((aligned(1), may_alias));
+
+#define SIMD_INLINE __attribute__((always_inline)) static inline
+
+/* Load a pixel; with wide, 3-byte pixels are read as 4 bytes. */
+SIMD_INLINE px_vec load_px(const unsigned char *p, int wide)
+{
+	unsigned long long x = wide ? *(const px_u32 *) p : p[0] | p[1] << 8 | p[2] << 16;
+	return __builtin_convertvector((px_bytes) x, px_vec);
+}
+
+/*
+   Store a pixel; with wide, 3-byte pixels are written as 4 bytes, the last
+   one being the unchanged input byte x, which may be the same memory.
+ */
+SIMD_INLINE void store_px(unsigned char *p, px_vec v, px_vec x, unsigned long bytewidth, int wide)
+{
+	if (bytewidth == 3 && wide) {
+		const px_vec keep = {-1, -1, -1, 0};
+		v = (v & keep) | (x & ~keep);
+	}
+	unsigned long long y = (unsigned long long) __builtin_convertvector(v, px_bytes);
+	if (wide) {
+		*(px_u32 *) p = (unsigned) y;
+	} else {
+		p[0] = y;
+		p[1] = y >> 8;
+		p[2] = y >> 16;
+	}
+}
+
+SIMD_INLINE px_vec abs_px(px_vec x)
+{
+	px_vec m = x >> 15;
+	return (x ^ m) - m;
+}
+
+/* The lanes are 0..255, so the sums need no masking until they are stored. */
+SIMD_INLINE px_vec paeth_px(px_vec a, px_vec b, px_vec c)
+{
+	px_vec pa = abs_px(b - c), pb = abs_px(a - c), pc = abs_px(a + b - c - c);
+	px_vec use_a = (pa <= pb) & (pa <= pc);
+	px_vec use_b = ~use_a & (pb <= pc);
+	return (a & use_a) | (b & use_b) | (c & ~(use_a | use_b));
+}
+
+/* Returns 0 if the filter isn't handled here; the first row (no precon) is left to the C code. */
+SIMD_INLINE int unfilter_px(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	unsigned long i;
+	px_vec a = {0}, b, c = {0};
+	if (!precon || filterType < 2 || filterType > 4)
+		return 0;
+	if (filterType == 2) {
+		for (i = 0; i + 16 <= length; i += 16)
+			*(row_vec *) &recon[i] = *(const row_vec *) &scanline[i] + *(const row_vec *) &precon[i];
+		for (; i < length; i++)
+			recon[i] = scanline[i] + precon[i];
+		return 1;
+	}
+	if ((bytewidth != 3 && bytewidth != 4) || length % bytewidth)
+		return 0;
+	for (i = 0; i < length; i += bytewidth) {
+		int wide = bytewidth == 4 || i + 4 <= length;
+		px_vec x = load_px(&scanline[i], wide);
+		b = load_px(&precon[i], wide);
+		if (filterType == 3) {
+			a = (x + ((a + b) >> 1)) & 0xff;
+		} else {
+			a = (x + paeth_px(a, b, c)) & 0xff;
+			c = b;
+		}
+		store_px(&recon[i], a, x, bytewidth, wide);
+	}
+	return 1;
+}
+
+static int unfilter_simd(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	/* Constant pixel sizes make simpler loops. */
+	switch (bytewidth) {
+	case 3:
+		return unfilter_px(recon, scanline, precon, 3, filterType, length);
+	case 4:
+		return unfilter_px(recon, scanline, precon, 4, filterType, length);
+	default:
+		return unfilter_px(recon, scanline, precon, bytewidth, filterType, length);
+	}
+}
+
 static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
@@ -705,6 +926,8 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	 */
 
 	unsigned long i;
+	if (simd_enabled && unfilter_simd(recon, scanline, precon, bytewidth, filterType, length))
+		return;
 	switch (filterType) {
 	case 0:
 		for (i = 0; i < length; i++)
@@ -818,7 +1041,7 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 {
 	unsigned bpp = upng_get_bpp(info_png);
 	unsigned w = info_png->width;
-	unsigned h = info_png->height;
+	unsigned h = info_png->row_limit;
 
 	if (bpp == 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
@@ -908,12 +1131,17 @@ static void upng_free_source(upng_t* upng)
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
+	upng->source.pos = 0;
 	upng->source.owning = 0;
+	upng->source.read = NULL;
+	upng->source.user = NULL;
 }
 
 /*read the information from the header and store it in the upng_Info. return value is error*/
 upng_error upng_header(upng_t* upng)
 {
+	unsigned char header[33];
+
 	/* if we have an error state, bail now */
 	if (upng->error != UPNG_EOK) {
 		return upng->error;
@@ -924,31 +1152,29 @@ upng_error upng_header(upng_t* upng)
 		return upng->error;
 	}
 
-	/* minimum length of a valid PNG file is 29 bytes
-	 * FIXME: verify this against the specification, or
-	 * better against the actual code below */
-	if (upng->source.size < 29) {
+	/* the signature and the IHDR chunk take the first 33 bytes */
+	if (upng_source_read(upng, header, 33) != 33) {
 		SET_ERROR(upng, UPNG_ENOTPNG);
 		return upng->error;
 	}
 
 	/* check that PNG header matches expected value */
-	if (upng->source.buffer[0] != 137 || upng->source.buffer[1] != 80 || upng->source.buffer[2] != 78 || upng->source.buffer[3] != 71 || upng->source.buffer[4] != 13 || upng->source.buffer[5] != 10 || upng->source.buffer[6] != 26 || upng->source.buffer[7] != 10) {
+	if (header[0] != 137 || header[1] != 80 || header[2] != 78 || header[3] != 71 || header[4] != 13 || header[5] != 10 || header[6] != 26 || header[7] != 10) {
 		SET_ERROR(upng, UPNG_ENOTPNG);
 		return upng->error;
 	}
 
 	/* check that the first chunk is the IHDR chunk */
-	if (MAKE_DWORD_PTR(upng->source.buffer + 12) != CHUNK_IHDR) {
+	if (MAKE_DWORD_PTR(header + 12) != CHUNK_IHDR) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* read the values given in the header */
-	upng->width = MAKE_DWORD_PTR(upng->source.buffer + 16);
-	upng->height = MAKE_DWORD_PTR(upng->source.buffer + 20);
-	upng->color_depth = upng->source.buffer[24];
-	upng->color_type = (upng_color)upng->source.buffer[25];
+	upng->width = MAKE_DWORD_PTR(header + 16);
+	upng->height = MAKE_DWORD_PTR(header + 20);
+	upng->color_depth = header[24];
+	upng->color_type = (upng_color)header[25];
 
 	/* determine our color format */
 	upng->format = determine_format(upng);
@@ -958,19 +1184,19 @@ upng_error upng_header(upng_t* upng)
 	}
 
 	/* check that the compression method (byte 27) is 0 (only allowed value in spec) */
-	if (upng->source.buffer[26] != 0) {
+	if (header[26] != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* check that the compression method (byte 27) is 0 (only allowed value in spec) */
-	if (upng->source.buffer[27] != 0) {
+	if (header[27] != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* check that the compression method (byte 27) is 0 (spec allows 1, but uPNG does not support it) */
-	if (upng->source.buffer[28] != 0) {
+	if (header[28] != 0) {
 		SET_ERROR(upng, UPNG_EUNINTERLACED);
 		return upng->error;
 	}
@@ -982,11 +1208,8 @@ upng_error upng_header(upng_t* upng)
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
 upng_error upng_decode(upng_t* upng)
 {
-	const unsigned char *chunk;
-	unsigned char* compressed;
 	unsigned char* inflated;
 	unsigned char* palette = NULL;
-	unsigned long compressed_size = 0, compressed_index = 0;
 	unsigned long palette_size = 0;
 	unsigned long inflated_size;
 	upng_error error;
@@ -1014,17 +1237,15 @@ upng_error upng_decode(upng_t* upng)
 		upng->size = 0;
 	}
 
-	/* first byte of the first chunk after the header */
-	chunk = upng->source.buffer + 33;
-
-	/* scan through the chunks, finding the size of all IDAT chunks, and also
-	 * verify general well-formed-ness */
-	while (chunk < upng->source.buffer + upng->source.size) {
+	/* read the chunks up to the first IDAT; the IDAT chunks are then read
+	 * while inflating, so the compressed data is never held in memory at once */
+	for (;;) {
+		unsigned char chunk[8];
 		unsigned long length;
-		// const unsigned char *data;	/*the data in the chunk */
 
-		/* make sure chunk header is not larger than the total compressed */
-		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
+		/* make sure chunk header is not past the end of the file */
+		if (upng_source_read(upng, chunk, 8) != 8) {
+			free(palette);
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
@@ -1032,98 +1253,63 @@ upng_error upng_decode(upng_t* upng)
 		/* get length; sanity check it */
 		length = upng_chunk_length(chunk);
 		if (length > INT_MAX) {
+			free(palette);
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
-		/* make sure chunk header+paylaod is not larger than the total compressed */
-		if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
-		}
-
-		/* get pointer to payload */
-		// data = chunk + 8;
-
 		/* parse chunks */
 		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			compressed_size += length;
+			upng->input.idat_left = length;
+			upng->input.idat_done = 0;
+			break;
 		} else if (upng_chunk_type(chunk) == CHUNK_PLTE) {
+			free(palette);
 			palette_size = length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-			break;
-		} else if (upng_chunk_critical(chunk)) {
-			SET_ERROR(upng, UPNG_EUNSUPPORTED);
+			palette = (unsigned char*)malloc(palette_size ? palette_size : 1);
+			if (palette == NULL) {
+				SET_ERROR(upng, UPNG_ENOMEM);
+				return upng->error;
+			}
+			if (upng_source_read(upng, palette, palette_size) != palette_size || !upng_source_skip(upng, 4)) {
+				free(palette);
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return upng->error;
+			}
+		} else if (upng_chunk_type(chunk) == CHUNK_IEND || upng_chunk_critical(chunk)) {
+			/* no image data, or a critical chunk that we don't know */
+			free(palette);
+			SET_ERROR(upng, upng_chunk_type(chunk) == CHUNK_IEND ? UPNG_EMALFORMED : UPNG_EUNSUPPORTED);
 			return upng->error;
-		}
-
-		chunk += length + 12;
-	}
-
-	/* allocate enough space for the (compressed and filtered) image data */
-	compressed = (unsigned char*)malloc(compressed_size);
-	if (compressed == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
-	}
-
-	if (palette_size) {
-		palette = (unsigned char*)malloc(palette_size);
-		if (palette == NULL) {
-			free(compressed);
-			SET_ERROR(upng, UPNG_ENOMEM);
+		} else if (!upng_source_skip(upng, length + 4)) {
+			free(palette);
+			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 	}
 
-	/* scan through the chunks again, this time copying the values into
-	 * our compressed buffer.  there's no reason to validate anything a second time. */
-	chunk = upng->source.buffer + 33;
-	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
-
-		length = upng_chunk_length(chunk);
-
-		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			data = chunk + 8;
-			memcpy(compressed + compressed_index, data, length);
-			compressed_index += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_PLTE) {
-			data = chunk + 8;
-			memcpy(palette, data, palette_size);
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-			break;
-		}
-
-		chunk += length + 12;
-	}
-
 	/* allocate space to store inflated (but still filtered) data */
 	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
 	inflated = (unsigned char*)malloc(inflated_size);
 	if (inflated == NULL) {
 		free(palette);
-		free(compressed);
 		SET_ERROR(upng, UPNG_ENOMEM);
 		return upng->error;
 	}
 
 	/* decompress image data */
-	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
+	error = uz_inflate(upng, inflated, inflated_size);
 	if (error != UPNG_EOK) {
 		free(palette);
-		free(compressed);
 		free(inflated);
 		return upng->error;
 	}
 
-	/* free the compressed compressed data */
-	free(compressed);
-
-	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+	/* allocate final image buffer; rows past the row limit are only inflated */
+	if (upng->row_limit == 0 || upng->row_limit > upng->height) {
+		upng->row_limit = upng->height;
+	}
+	upng->size = (upng->row_limit * upng->width * upng_get_bpp(upng) + 7) / 8;
 	upng->buffer = (unsigned char*)malloc(upng->size);
 	if (upng->buffer == NULL) {
 		free(palette);
@@ -1145,6 +1331,7 @@ upng_error upng_decode(upng_t* upng)
 	} else {
 		/* palette */
 		upng->palette = palette;
+		upng->palette_entries = palette_size / 3;
 		upng->state = UPNG_DECODED;
 	}
 
@@ -1166,6 +1353,11 @@ static upng_t* upng_new(void)
 	upng->buffer = NULL;
 	upng->size = 0;
 
+	upng->palette = NULL;
+	upng->palette_entries = 0;
+
+	upng->row_limit = 0;
+
 	upng->width = upng->height = 0;
 
 	upng->color_type = UPNG_RGBA;
@@ -1179,7 +1371,10 @@ static upng_t* upng_new(void)
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
+	upng->source.pos = 0;
 	upng->source.owning = 0;
+	upng->source.read = NULL;
+	upng->source.user = NULL;
 
 	return upng;
 }
@@ -1198,6 +1393,19 @@ upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
 	return upng;
 }
 
+upng_t* upng_new_from_callback(upng_read_callback read, void* user)
+{
+	upng_t* upng = upng_new();
+	if (upng == NULL) {
+		return NULL;
+	}
+
+	upng->source.read = read;
+	upng->source.user = user;
+
+	return upng;
+}
+
 upng_t* upng_new_from_file(const char *filename)
 {
 	upng_t* upng;
@@ -1332,3 +1540,18 @@ const unsigned char* upng_get_palette(const upng_t* upng)
 {
 	return upng->palette;
 }
+
+void upng_set_row_limit(upng_t* upng, unsigned rows)
+{
+	upng->row_limit = rows;
+}
+
+void upng_set_simd(int enabled)
+{
+	simd_enabled = enabled;
+}
+
+unsigned upng_get_palette_entries(const upng_t* upng)
+{
+	return upng->palette_entries;
+}
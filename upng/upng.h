@@ -61,13 +61,24 @@ typedef enum upng_format {
 
 typedef struct upng_t upng_t;
 
+/* Read callback: copy the next bytes of the PNG file to buffer, return the number of bytes copied (less than size at the end of the file). */
+typedef unsigned long (*upng_read_callback)(void* user, unsigned char* buffer, unsigned long size);
+
 upng_t*		upng_new_from_bytes	(const unsigned char* buffer, unsigned long size);
 upng_t*		upng_new_from_file	(const char* path);
+/* Read the file sequentially through the callback; the IDAT data is inflated as it is read, without a copy of the whole file. */
+upng_t*		upng_new_from_callback	(upng_read_callback read, void* user);
 void		upng_free			(upng_t* upng);
 
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
 
+/* Make upng_decode unfilter only the first rows of the image (0 = all); the rest are only inflated. */
+void		upng_set_row_limit	(upng_t* upng, unsigned rows);
+
+/* Use the vector unfilter code (SSE2) for all images: 0 = plain C (the default), 1 = vectors. */
+void		upng_set_simd		(int enabled);
+
 upng_error	upng_get_error		(const upng_t* upng);
 unsigned	upng_get_error_line	(const upng_t* upng);
 
@@ -82,5 +93,6 @@ upng_format	upng_get_format		(const upng_t* upng);
 const unsigned char*	upng_get_buffer		(const upng_t* upng);
 unsigned				upng_get_size		(const upng_t* upng);
 const unsigned char*	upng_get_palette	(const upng_t* upng);
+unsigned				upng_get_palette_entries	(const upng_t* upng);
 
 #endif /*defined(UPNG_H)*/
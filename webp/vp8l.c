@@ -0,0 +1,853 @@
+/*
+VP8L -- a decoder for lossless WebP images
+Written for HackBGRT from the WebP lossless bitstream specification (RFC 9649).
+*/
+
+#include "../my_efilib/my_efilib.h"
+
+#include "vp8l.h"
+
+#define NUM_LITERAL_CODES 256
+#define NUM_LENGTH_CODES 24
+#define NUM_DISTANCE_CODES 40
+#define NUM_CODE_LENGTH_CODES 19
+#define MAX_CACHE_BITS 11
+#define MAX_CODE_LENGTH 15
+#define FAST_BITS 8
+#define MAX_TRANSFORMS 4
+
+#define DIV_ROUND_UP(n, bits) (((n) + (1u << (bits)) - 1) >> (bits))
+
+enum {
+	PREDICTOR_TRANSFORM = 0,
+	CROSS_COLOR_TRANSFORM = 1,
+	SUBTRACT_GREEN_TRANSFORM = 2,
+	COLOR_INDEXING_TRANSFORM = 3
+};
+
+/* The five prefix codes of a group: green + length + cache, red, blue, alpha, distance. */
+enum { GREEN = 0, RED, BLUE, ALPHA, DIST, CODES_PER_GROUP };
+
+typedef struct bit_reader {
+	const uint8_t* pos;
+	const uint8_t* end;
+	uint64_t bits;
+	unsigned nbits;
+	unsigned overrun; /* zero bytes fed after the end of the data */
+} bit_reader;
+
+/*
+A canonical prefix code. Codes of up to FAST_BITS bits are looked up in
+a table; longer codes are decoded one bit at a time.
+*/
+typedef struct huffman {
+	uint16_t count[MAX_CODE_LENGTH + 1]; /* the number of codes of each length */
+	uint16_t fast[1 << FAST_BITS];       /* symbol << 4 | length, or 0 for longer codes */
+	uint16_t* symbols;                   /* the symbols in code order */
+	int single;                          /* the symbol of a code with one symbol (no bits), or -1 */
+} huffman;
+
+typedef struct htree_group {
+	huffman codes[CODES_PER_GROUP];
+} htree_group;
+
+/* The prefix codes and the color cache of an entropy-coded image. */
+typedef struct image_codes {
+	unsigned cache_bits;
+	uint32_t* cache;
+	unsigned meta_bits;  /* the block size of the entropy image, or 0 if there is none */
+	unsigned meta_xsize;
+	uint32_t* meta;      /* the group index of each block */
+	unsigned num_groups;
+	htree_group* groups;
+	uint16_t* symbols;
+} image_codes;
+
+typedef struct transform {
+	int type;
+	unsigned bits;
+	unsigned xsize;      /* the image width after the inverse transform */
+	uint32_t* data;
+} transform;
+
+struct vp8l_decoder {
+	unsigned width;
+	unsigned height;
+	bit_reader br;
+
+	unsigned num_transforms;
+	transform transforms[MAX_TRANSFORMS];
+
+	/* The entropy-coded image, before the inverse transforms. */
+	unsigned xsize;
+	image_codes codes;
+	uint32_t* pixels;
+	size_t decoded;
+
+	unsigned row;
+	uint32_t* rows[2];
+	uint32_t* prev; /* the previous row of the predictor transform */
+	int error;
+};
+
+static void free_ptr(void* ptr)
+{
+	if (ptr) {
+		free(ptr);
+	}
+}
+
+static void* alloc_zero(size_t size)
+{
+	void* ptr = malloc(size);
+	if (ptr) {
+		memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+static uint32_t read_le32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Bit reader: bits are read from the least significant bit of each byte. */
+
+static void br_fill(bit_reader* br)
+{
+	while (br->nbits <= 56) {
+		if (br->pos != br->end) {
+			br->bits |= (uint64_t)*br->pos++ << br->nbits;
+		} else {
+			++br->overrun;
+		}
+		br->nbits += 8;
+	}
+}
+
+static uint32_t br_read(bit_reader* br, unsigned n)
+{
+	if (br->nbits < n) {
+		br_fill(br);
+	}
+	uint32_t v = (uint32_t)(br->bits & (((uint64_t)1 << n) - 1));
+	br->bits >>= n;
+	br->nbits -= n;
+	return v;
+}
+
+/* Check whether more bits have been read than there are. */
+static int br_eos(const bit_reader* br)
+{
+	return br->overrun * 8 > br->nbits;
+}
+
+/* Prefix codes */
+
+static unsigned reverse_bits(unsigned code, unsigned len)
+{
+	unsigned r = 0;
+	for (; len; --len, code >>= 1) {
+		r = (r << 1) | (code & 1);
+	}
+	return r;
+}
+
+static int huffman_build(huffman* h, const uint8_t* lengths, unsigned n, uint16_t* symbols)
+{
+	uint16_t offs[MAX_CODE_LENGTH + 1];
+	unsigned i, len, used = 0, last = 0;
+	int left = 1;
+
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+	h->symbols = symbols;
+	h->single = -1;
+	for (i = 0; i < n; ++i) {
+		h->count[lengths[i]]++;
+		if (lengths[i]) {
+			++used;
+			last = i;
+		}
+	}
+	if (used == 0) {
+		return 0;
+	}
+	if (used == 1) {
+		h->single = last;
+		return 1;
+	}
+
+	/* The code must be complete. */
+	for (len = 1; len <= MAX_CODE_LENGTH; ++len) {
+		left = (left << 1) - h->count[len];
+		if (left < 0) {
+			return 0;
+		}
+	}
+	if (left) {
+		return 0;
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < MAX_CODE_LENGTH; ++len) {
+		offs[len + 1] = offs[len] + h->count[len];
+	}
+	for (i = 0; i < n; ++i) {
+		if (lengths[i]) {
+			symbols[offs[lengths[i]]++] = i;
+		}
+	}
+
+	/* The first bit of a code is read first, so the table is indexed by reversed codes. */
+	unsigned code = 0, index = 0;
+	for (len = 1; len <= FAST_BITS; ++len, code <<= 1) {
+		for (i = 0; i < h->count[len]; ++i, ++code, ++index) {
+			unsigned fill;
+			for (fill = reverse_bits(code, len); fill < (1 << FAST_BITS); fill += 1 << len) {
+				h->fast[fill] = (symbols[index] << 4) | len;
+			}
+		}
+	}
+	return 1;
+}
+
+static unsigned read_symbol(const huffman* h, bit_reader* br)
+{
+	if (h->single >= 0) {
+		return h->single;
+	}
+	if (br->nbits < MAX_CODE_LENGTH) {
+		br_fill(br);
+	}
+	unsigned e = h->fast[br->bits & ((1 << FAST_BITS) - 1)];
+	if (e) {
+		br->bits >>= e & 15;
+		br->nbits -= e & 15;
+		return e >> 4;
+	}
+	uint64_t bits = br->bits;
+	int code = 0, first = 0, index = 0;
+	unsigned len;
+	for (len = 1; len <= MAX_CODE_LENGTH; ++len) {
+		code |= bits & 1;
+		bits >>= 1;
+		int count = h->count[len];
+		if (code - count < first) {
+			br->bits >>= len;
+			br->nbits -= len;
+			return h->symbols[index + (code - first)];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return ~0u; /* not reached with a complete code */
+}
+
+static int read_code_lengths(bit_reader* br, const uint8_t* code_length_code_lengths, unsigned n, uint8_t* lengths)
+{
+	static const uint8_t extra_bits[3] = {2, 3, 7};
+	static const uint8_t repeat_offsets[3] = {3, 3, 11};
+	huffman h;
+	uint16_t symbols[NUM_CODE_LENGTH_CODES];
+	unsigned symbol = 0, max_symbol = n, prev = 8;
+
+	if (!huffman_build(&h, code_length_code_lengths, NUM_CODE_LENGTH_CODES, symbols)) {
+		return 0;
+	}
+	if (br_read(br, 1)) {
+		unsigned length_bits = 2 + 2 * br_read(br, 3);
+		max_symbol = 2 + br_read(br, length_bits);
+		if (max_symbol > n) {
+			return 0;
+		}
+	}
+	while (symbol < n && max_symbol--) {
+		unsigned code_len = read_symbol(&h, br);
+		if (code_len < 16) {
+			lengths[symbol++] = code_len;
+			if (code_len) {
+				prev = code_len;
+			}
+		} else {
+			unsigned repeat = br_read(br, extra_bits[code_len - 16]) + repeat_offsets[code_len - 16];
+			unsigned len = code_len == 16 ? prev : 0;
+			if (symbol + repeat > n) {
+				return 0;
+			}
+			while (repeat--) {
+				lengths[symbol++] = len;
+			}
+		}
+	}
+	return 1;
+}
+
+static int read_huffman(bit_reader* br, unsigned n, huffman* h, uint16_t* symbols, uint8_t* lengths)
+{
+	static const uint8_t code_length_order[NUM_CODE_LENGTH_CODES] = {
+		17, 18, 0, 1, 2, 3, 4, 5, 16, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+	};
+
+	memset(lengths, 0, n);
+	if (br_read(br, 1)) {
+		/* Simple code: one or two symbols. */
+		unsigned num_symbols = br_read(br, 1) + 1;
+		unsigned symbol = br_read(br, br_read(br, 1) ? 8 : 1);
+		if (symbol >= n) {
+			return 0;
+		}
+		lengths[symbol] = 1;
+		if (num_symbols == 2) {
+			symbol = br_read(br, 8);
+			if (symbol >= n) {
+				return 0;
+			}
+			lengths[symbol] = 1;
+		}
+	} else {
+		uint8_t code_length_code_lengths[NUM_CODE_LENGTH_CODES] = {0};
+		unsigned i, num_codes = br_read(br, 4) + 4;
+		for (i = 0; i < num_codes; ++i) {
+			code_length_code_lengths[code_length_order[i]] = br_read(br, 3);
+		}
+		if (!read_code_lengths(br, code_length_code_lengths, n, lengths)) {
+			return 0;
+		}
+	}
+	return !br_eos(br) && huffman_build(h, lengths, n, symbols);
+}
+
+/* Entropy-coded images */
+
+static uint32_t* decode_subimage(vp8l_decoder* dec, unsigned xsize, unsigned ysize);
+
+static void free_codes(image_codes* codes)
+{
+	free_ptr(codes->cache);
+	free_ptr(codes->meta);
+	free_ptr(codes->groups);
+	free_ptr(codes->symbols);
+	memset(codes, 0, sizeof(*codes));
+}
+
+static int read_codes(vp8l_decoder* dec, unsigned xsize, unsigned ysize, int is_main, image_codes* codes)
+{
+	bit_reader* br = &dec->br;
+	unsigned sizes[CODES_PER_GROUP] = {
+		NUM_LITERAL_CODES + NUM_LENGTH_CODES, NUM_LITERAL_CODES, NUM_LITERAL_CODES, NUM_LITERAL_CODES, NUM_DISTANCE_CODES
+	};
+	unsigned i, k, group_symbols = 0;
+
+	memset(codes, 0, sizeof(*codes));
+	if (br_read(br, 1)) {
+		codes->cache_bits = br_read(br, 4);
+		if (codes->cache_bits < 1 || codes->cache_bits > MAX_CACHE_BITS) {
+			return 0;
+		}
+		codes->cache = alloc_zero(sizeof(uint32_t) << codes->cache_bits);
+		if (!codes->cache) {
+			return 0;
+		}
+		sizes[GREEN] += 1 << codes->cache_bits;
+	}
+
+	/* Only the main image may use different codes in different blocks. */
+	codes->num_groups = 1;
+	if (is_main && br_read(br, 1)) {
+		codes->meta_bits = br_read(br, 3) + 2;
+		codes->meta_xsize = DIV_ROUND_UP(xsize, codes->meta_bits);
+		unsigned meta_ysize = DIV_ROUND_UP(ysize, codes->meta_bits);
+		codes->meta = decode_subimage(dec, codes->meta_xsize, meta_ysize);
+		if (!codes->meta) {
+			return 0;
+		}
+		for (i = 0; i < codes->meta_xsize * meta_ysize; ++i) {
+			codes->meta[i] = (codes->meta[i] >> 8) & 0xffff;
+			if (codes->meta[i] >= codes->num_groups) {
+				codes->num_groups = codes->meta[i] + 1;
+			}
+		}
+	}
+
+	for (k = 0; k < CODES_PER_GROUP; ++k) {
+		group_symbols += sizes[k];
+	}
+	uint8_t* lengths = malloc(sizes[GREEN]);
+	codes->groups = malloc(codes->num_groups * sizeof(htree_group));
+	codes->symbols = malloc((size_t)codes->num_groups * group_symbols * sizeof(uint16_t));
+	int ok = lengths && codes->groups && codes->symbols;
+	for (i = 0; ok && i < codes->num_groups; ++i) {
+		uint16_t* symbols = codes->symbols + (size_t)i * group_symbols;
+		for (k = 0; ok && k < CODES_PER_GROUP; symbols += sizes[k++]) {
+			ok = read_huffman(br, sizes[k], &codes->groups[i].codes[k], symbols, lengths);
+		}
+	}
+	free_ptr(lengths);
+	return ok;
+}
+
+static const htree_group* get_group(const image_codes* codes, unsigned col, unsigned row)
+{
+	if (!codes->meta) {
+		return codes->groups;
+	}
+	return &codes->groups[codes->meta[(row >> codes->meta_bits) * codes->meta_xsize + (col >> codes->meta_bits)]];
+}
+
+/* Decode a length or a distance from its prefix symbol and extra bits. */
+static unsigned prefix_value(bit_reader* br, unsigned symbol)
+{
+	if (symbol < 4) {
+		return symbol + 1;
+	}
+	unsigned extra_bits = (symbol - 2) >> 1;
+	unsigned offset = (2 + (symbol & 1)) << extra_bits;
+	return offset + br_read(br, extra_bits) + 1;
+}
+
+/* Convert a distance code to a distance in pixels; the first 120 codes are nearby 2D offsets. */
+static size_t plane_to_distance(unsigned xsize, unsigned code)
+{
+	static const int8_t offsets[120][2] = {
+		{0, 1}, {1, 0}, {1, 1}, {-1, 1}, {0, 2}, {2, 0}, {1, 2}, {-1, 2},
+		{2, 1}, {-2, 1}, {2, 2}, {-2, 2}, {0, 3}, {3, 0}, {1, 3}, {-1, 3},
+		{3, 1}, {-3, 1}, {2, 3}, {-2, 3}, {3, 2}, {-3, 2}, {0, 4}, {4, 0},
+		{1, 4}, {-1, 4}, {4, 1}, {-4, 1}, {3, 3}, {-3, 3}, {2, 4}, {-2, 4},
+		{4, 2}, {-4, 2}, {0, 5}, {3, 4}, {-3, 4}, {4, 3}, {-4, 3}, {5, 0},
+		{1, 5}, {-1, 5}, {5, 1}, {-5, 1}, {2, 5}, {-2, 5}, {5, 2}, {-5, 2},
+		{4, 4}, {-4, 4}, {3, 5}, {-3, 5}, {5, 3}, {-5, 3}, {0, 6}, {6, 0},
+		{1, 6}, {-1, 6}, {6, 1}, {-6, 1}, {2, 6}, {-2, 6}, {6, 2}, {-6, 2},
+		{4, 5}, {-4, 5}, {5, 4}, {-5, 4}, {3, 6}, {-3, 6}, {6, 3}, {-6, 3},
+		{0, 7}, {7, 0}, {1, 7}, {-1, 7}, {5, 5}, {-5, 5}, {7, 1}, {-7, 1},
+		{4, 6}, {-4, 6}, {6, 4}, {-6, 4}, {2, 7}, {-2, 7}, {7, 2}, {-7, 2},
+		{3, 7}, {-3, 7}, {7, 3}, {-7, 3}, {5, 6}, {-5, 6}, {6, 5}, {-6, 5},
+		{8, 0}, {4, 7}, {-4, 7}, {7, 4}, {-7, 4}, {8, 1}, {8, 2}, {6, 6},
+		{-6, 6}, {8, 3}, {5, 7}, {-5, 7}, {7, 5}, {-7, 5}, {8, 4}, {6, 7},
+		{-6, 7}, {7, 6}, {-7, 6}, {8, 5}, {7, 7}, {-7, 7}, {8, 6}, {8, 7}
+	};
+	if (code > 120) {
+		return code - 120;
+	}
+	long dist = offsets[code - 1][0] + (long)offsets[code - 1][1] * xsize;
+	return dist >= 1 ? (size_t)dist : 1;
+}
+
+/*
+Decode pixels from *pos until at least stop. A backward reference may
+continue past stop, up to the end of the image.
+*/
+static int decode_pixels(vp8l_decoder* dec, image_codes* codes, uint32_t* data, unsigned xsize, size_t total, size_t* pos_io, size_t stop)
+{
+	bit_reader* br = &dec->br;
+	size_t pos = *pos_io;
+	unsigned col = pos % xsize, row = pos / xsize;
+	const unsigned mask = codes->meta ? (1u << codes->meta_bits) - 1 : ~0u;
+	const unsigned cache_shift = 32 - codes->cache_bits;
+	const unsigned cache_limit = NUM_LITERAL_CODES + NUM_LENGTH_CODES + (codes->cache ? 1u << codes->cache_bits : 0);
+	const htree_group* group = pos < total ? get_group(codes, col, row) : 0;
+
+	while (pos < stop) {
+		uint32_t argb;
+		if ((col & mask) == 0) {
+			group = get_group(codes, col, row);
+		}
+		unsigned code = read_symbol(&group->codes[GREEN], br);
+		if (code < NUM_LITERAL_CODES) {
+			unsigned red = read_symbol(&group->codes[RED], br);
+			unsigned blue = read_symbol(&group->codes[BLUE], br);
+			unsigned alpha = read_symbol(&group->codes[ALPHA], br);
+			argb = (alpha << 24) | (red << 16) | (code << 8) | blue;
+		} else if (code < NUM_LITERAL_CODES + NUM_LENGTH_CODES) {
+			size_t length = prefix_value(br, code - NUM_LITERAL_CODES);
+			size_t dist = plane_to_distance(xsize, prefix_value(br, read_symbol(&group->codes[DIST], br)));
+			if (dist > pos || length > total - pos) {
+				return 0;
+			}
+			uint32_t* dst = data + pos;
+			const uint32_t* src = dst - dist;
+			size_t i;
+			for (i = 0; i < length; ++i) {
+				dst[i] = src[i];
+			}
+			if (codes->cache) {
+				for (i = 0; i < length; ++i) {
+					codes->cache[(0x1e35a7bd * dst[i]) >> cache_shift] = dst[i];
+				}
+			}
+			pos += length;
+			col += length % xsize;
+			row += length / xsize;
+			if (col >= xsize) {
+				col -= xsize;
+				++row;
+			}
+			if (col & mask) {
+				group = get_group(codes, col, row);
+			}
+			continue;
+		} else if (code < cache_limit) {
+			argb = codes->cache[code - (NUM_LITERAL_CODES + NUM_LENGTH_CODES)];
+		} else {
+			return 0;
+		}
+		data[pos++] = argb;
+		if (codes->cache) {
+			codes->cache[(0x1e35a7bd * argb) >> cache_shift] = argb;
+		}
+		if (++col == xsize) {
+			col = 0;
+			++row;
+		}
+	}
+	*pos_io = pos;
+	return !br_eos(br);
+}
+
+static uint32_t* decode_subimage(vp8l_decoder* dec, unsigned xsize, unsigned ysize)
+{
+	image_codes codes;
+	uint32_t* data = 0;
+	if (read_codes(dec, xsize, ysize, 0, &codes)) {
+		size_t total = (size_t)xsize * ysize, pos = 0;
+		data = malloc(total * sizeof(uint32_t));
+		if (data && !decode_pixels(dec, &codes, data, xsize, total, &pos, total)) {
+			free(data);
+			data = 0;
+		}
+	}
+	free_codes(&codes);
+	return data;
+}
+
+/* Transforms */
+
+static uint32_t add_pixels(uint32_t a, uint32_t b)
+{
+	return (((a & 0xff00ff00) + (b & 0xff00ff00)) & 0xff00ff00) | (((a & 0x00ff00ff) + (b & 0x00ff00ff)) & 0x00ff00ff);
+}
+
+static uint32_t average2(uint32_t a, uint32_t b)
+{
+	return (((a ^ b) & 0xfefefefe) >> 1) + (a & b);
+}
+
+static int clip255(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static int abs_int(int v)
+{
+	return v < 0 ? -v : v;
+}
+
+static uint32_t select_pixel(uint32_t L, uint32_t T, uint32_t TL)
+{
+	int shift, diff = 0;
+	for (shift = 0; shift < 32; shift += 8) {
+		int l = (L >> shift) & 0xff, t = (T >> shift) & 0xff, tl = (TL >> shift) & 0xff;
+		diff += abs_int(l - tl) - abs_int(t - tl);
+	}
+	return diff <= 0 ? T : L;
+}
+
+static uint32_t clamp_add_subtract_full(uint32_t a, uint32_t b, uint32_t c)
+{
+	uint32_t r = 0;
+	int shift;
+	for (shift = 0; shift < 32; shift += 8) {
+		int v = (int)((a >> shift) & 0xff) + (int)((b >> shift) & 0xff) - (int)((c >> shift) & 0xff);
+		r |= (uint32_t)clip255(v) << shift;
+	}
+	return r;
+}
+
+static uint32_t clamp_add_subtract_half(uint32_t a, uint32_t b)
+{
+	uint32_t r = 0;
+	int shift;
+	for (shift = 0; shift < 32; shift += 8) {
+		int va = (a >> shift) & 0xff, vb = (b >> shift) & 0xff;
+		r |= (uint32_t)clip255(va + (va - vb) / 2) << shift;
+	}
+	return r;
+}
+
+static uint32_t predict(unsigned mode, uint32_t L, uint32_t T, uint32_t TL, uint32_t TR)
+{
+	switch (mode) {
+		case 1: return L;
+		case 2: return T;
+		case 3: return TR;
+		case 4: return TL;
+		case 5: return average2(average2(L, TR), T);
+		case 6: return average2(L, TL);
+		case 7: return average2(L, T);
+		case 8: return average2(TL, T);
+		case 9: return average2(T, TR);
+		case 10: return average2(average2(L, TL), average2(T, TR));
+		case 11: return select_pixel(L, T, TL);
+		case 12: return clamp_add_subtract_full(L, T, TL);
+		case 13: return clamp_add_subtract_half(average2(L, T), TL);
+		default: return 0xff000000;
+	}
+}
+
+static void inverse_predictor(const transform* t, unsigned y, uint32_t* row, const uint32_t* prev)
+{
+	const unsigned w = t->xsize;
+	unsigned x;
+	if (y == 0) {
+		row[0] = add_pixels(row[0], 0xff000000);
+		for (x = 1; x < w; ++x) {
+			row[x] = add_pixels(row[x], row[x - 1]);
+		}
+		return;
+	}
+	const uint32_t* modes = t->data + (y >> t->bits) * DIV_ROUND_UP(w, t->bits);
+	row[0] = add_pixels(row[0], prev[0]);
+	for (x = 1; x < w; ++x) {
+		/* The rightmost pixel uses the leftmost pixel of the current row as TR. */
+		uint32_t TR = x + 1 < w ? prev[x + 1] : row[0];
+		uint32_t pred = predict((modes[x >> t->bits] >> 8) & 15, row[x - 1], prev[x], prev[x - 1], TR);
+		row[x] = add_pixels(row[x], pred);
+	}
+}
+
+static int color_delta(int8_t a, int8_t b)
+{
+	return ((int)a * b) >> 5;
+}
+
+static void inverse_cross_color(const transform* t, unsigned y, uint32_t* row)
+{
+	const uint32_t* codes = t->data + (y >> t->bits) * DIV_ROUND_UP(t->xsize, t->bits);
+	unsigned x;
+	for (x = 0; x < t->xsize; ++x) {
+		uint32_t code = codes[x >> t->bits], argb = row[x];
+		int8_t green = (int8_t)(argb >> 8);
+		int red = (argb >> 16) & 0xff, blue = argb & 0xff;
+		red = (red + color_delta((int8_t)code, green)) & 0xff;
+		blue = (blue + color_delta((int8_t)(code >> 8), green) + color_delta((int8_t)(code >> 16), (int8_t)red)) & 0xff;
+		row[x] = (argb & 0xff00ff00) | ((uint32_t)red << 16) | blue;
+	}
+}
+
+static void inverse_subtract_green(const transform* t, uint32_t* row)
+{
+	unsigned x;
+	for (x = 0; x < t->xsize; ++x) {
+		uint32_t green = (row[x] >> 8) & 0xff;
+		uint32_t red_blue = ((row[x] & 0x00ff00ff) + ((green << 16) | green)) & 0x00ff00ff;
+		row[x] = (row[x] & 0xff00ff00) | red_blue;
+	}
+}
+
+static void inverse_color_indexing(const transform* t, const uint32_t* in, uint32_t* out)
+{
+	unsigned x;
+	if (t->bits == 0) {
+		for (x = 0; x < t->xsize; ++x) {
+			out[x] = t->data[(in[x] >> 8) & 0xff];
+		}
+		return;
+	}
+	/* Several indices are packed in the green channel, the first one in the lowest bits. */
+	const unsigned bits_per_index = 8 >> t->bits;
+	const unsigned x_mask = (1 << t->bits) - 1, index_mask = (1 << bits_per_index) - 1;
+	for (x = 0; x < t->xsize; ++x) {
+		unsigned packed = (in[x >> t->bits] >> 8) & 0xff;
+		out[x] = t->data[(packed >> ((x & x_mask) * bits_per_index)) & index_mask];
+	}
+}
+
+static int read_transform(vp8l_decoder* dec, unsigned* xsize)
+{
+	bit_reader* br = &dec->br;
+	int type = br_read(br, 2);
+	unsigned i;
+
+	/* Each transform may be used only once. */
+	for (i = 0; i < dec->num_transforms; ++i) {
+		if (dec->transforms[i].type == type) {
+			return 0;
+		}
+	}
+	transform* t = &dec->transforms[dec->num_transforms++];
+	t->type = type;
+	t->xsize = *xsize;
+	switch (type) {
+		case PREDICTOR_TRANSFORM:
+		case CROSS_COLOR_TRANSFORM:
+			t->bits = br_read(br, 3) + 2;
+			t->data = decode_subimage(dec, DIV_ROUND_UP(t->xsize, t->bits), DIV_ROUND_UP(dec->height, t->bits));
+			return t->data != 0;
+		case SUBTRACT_GREEN_TRANSFORM:
+			return 1;
+		case COLOR_INDEXING_TRANSFORM: {
+			unsigned num_colors = br_read(br, 8) + 1;
+			t->bits = num_colors > 16 ? 0 : num_colors > 4 ? 1 : num_colors > 2 ? 2 : 3;
+			uint32_t* palette = decode_subimage(dec, num_colors, 1);
+			/* Indices beyond the palette give transparent black. */
+			t->data = alloc_zero(256 * sizeof(uint32_t));
+			if (!palette || !t->data) {
+				free_ptr(palette);
+				return 0;
+			}
+			/* The palette is delta-coded. */
+			t->data[0] = palette[0];
+			for (i = 1; i < num_colors; ++i) {
+				t->data[i] = add_pixels(palette[i], t->data[i - 1]);
+			}
+			free(palette);
+			*xsize = DIV_ROUND_UP(*xsize, t->bits);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Decoder */
+
+/* Find the VP8L data in a RIFF WebP file. */
+static const uint8_t* find_vp8l(const uint8_t* data, size_t* size)
+{
+	if (*size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WEBP", 4) != 0) {
+		return data;
+	}
+	size_t end = (size_t)read_le32(data + 4) + 8;
+	if (end > *size) {
+		end = *size;
+	}
+	size_t pos = 12;
+	while (end - pos >= 8) {
+		size_t chunk_size = read_le32(data + pos + 4);
+		if (chunk_size > end - pos - 8) {
+			break;
+		}
+		if (memcmp(data + pos, "VP8L", 4) == 0) {
+			*size = chunk_size;
+			return data + pos + 8;
+		}
+		/* Chunks are padded to an even size. */
+		pos += 8 + chunk_size + (chunk_size & 1);
+		if (pos > end) {
+			break;
+		}
+	}
+	return 0;
+}
+
+vp8l_decoder* vp8l_new_from_bytes(const void* data, size_t size)
+{
+	const uint8_t* p = find_vp8l(data, &size);
+	if (!p || size < 5 || p[0] != 0x2f) {
+		return 0;
+	}
+	uint32_t header = read_le32(p + 1);
+	if (header >> 29 != 0) {
+		/* Unknown version. */
+		return 0;
+	}
+
+	vp8l_decoder* dec = alloc_zero(sizeof(*dec));
+	if (!dec) {
+		return 0;
+	}
+	dec->width = (header & 0x3fff) + 1;
+	dec->height = ((header >> 14) & 0x3fff) + 1;
+	dec->br.pos = p + 5;
+	dec->br.end = p + size;
+
+	unsigned xsize = dec->width;
+	int ok = 1;
+	while (ok && br_read(&dec->br, 1)) {
+		ok = dec->num_transforms < MAX_TRANSFORMS && read_transform(dec, &xsize);
+	}
+	dec->xsize = xsize;
+	ok = ok && read_codes(dec, dec->xsize, dec->height, 1, &dec->codes) && !br_eos(&dec->br);
+	if (ok) {
+		dec->pixels = malloc((size_t)dec->xsize * dec->height * sizeof(uint32_t));
+		dec->rows[0] = malloc(dec->width * sizeof(uint32_t));
+		dec->rows[1] = malloc(dec->width * sizeof(uint32_t));
+		dec->prev = malloc(dec->width * sizeof(uint32_t));
+		ok = dec->pixels && dec->rows[0] && dec->rows[1] && dec->prev;
+	}
+	if (!ok) {
+		vp8l_free(dec);
+		return 0;
+	}
+	return dec;
+}
+
+unsigned vp8l_get_width(const vp8l_decoder* dec)
+{
+	return dec->width;
+}
+
+unsigned vp8l_get_height(const vp8l_decoder* dec)
+{
+	return dec->height;
+}
+
+const uint32_t* vp8l_next_row(vp8l_decoder* dec)
+{
+	const unsigned y = dec->row;
+	const size_t total = (size_t)dec->xsize * dec->height;
+	const size_t needed = (size_t)(y + 1) * dec->xsize;
+	int i;
+
+	if (dec->error || y >= dec->height) {
+		return 0;
+	}
+	if (dec->decoded < needed && !decode_pixels(dec, &dec->codes, dec->pixels, dec->xsize, total, &dec->decoded, needed)) {
+		dec->error = 1;
+		return 0;
+	}
+
+	/* The decoded pixels may be referenced later, so the transforms work on a copy. */
+	uint32_t* row = dec->rows[0];
+	memcpy(row, dec->pixels + (size_t)y * dec->xsize, dec->xsize * sizeof(uint32_t));
+	for (i = dec->num_transforms - 1; i >= 0; --i) {
+		const transform* t = &dec->transforms[i];
+		switch (t->type) {
+			case PREDICTOR_TRANSFORM:
+				inverse_predictor(t, y, row, dec->prev);
+				memcpy(dec->prev, row, t->xsize * sizeof(uint32_t));
+				break;
+			case CROSS_COLOR_TRANSFORM:
+				inverse_cross_color(t, y, row);
+				break;
+			case SUBTRACT_GREEN_TRANSFORM:
+				inverse_subtract_green(t, row);
+				break;
+			case COLOR_INDEXING_TRANSFORM: {
+				uint32_t* out = row == dec->rows[0] ? dec->rows[1] : dec->rows[0];
+				inverse_color_indexing(t, row, out);
+				row = out;
+				break;
+			}
+		}
+	}
+	++dec->row;
+	return row;
+}
+
+void vp8l_free(vp8l_decoder* dec)
+{
+	unsigned i;
+	if (!dec) {
+		return;
+	}
+	for (i = 0; i < dec->num_transforms; ++i) {
+		free_ptr(dec->transforms[i].data);
+	}
+	free_codes(&dec->codes);
+	free_ptr(dec->pixels);
+	free_ptr(dec->rows[0]);
+	free_ptr(dec->rows[1]);
+	free_ptr(dec->prev);
+	free(dec);
+}
@@ -0,0 +1,41 @@
+/*
+VP8L -- a decoder for lossless WebP images
+Written for HackBGRT from the WebP lossless bitstream specification (RFC 9649).
+
+The image is decoded row by row from top to bottom. Each row is returned
+as 32-bit ARGB pixels (B, G, R, A in memory on little-endian machines).
+The entropy-coded data is decoded only as far as the requested rows need,
+so the rows below the region of interest cost nothing.
+
+Lossy WebP (VP8) and animations are not supported.
+*/
+
+#if !defined(VP8L_H)
+#define VP8L_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct vp8l_decoder vp8l_decoder;
+
+/*
+Read the headers, the transforms and the prefix codes of a WebP file
+(a RIFF file with a VP8L chunk, or a bare VP8L stream).
+Returns the decoder, or NULL if the data is invalid, unsupported or if
+memory allocation failed.
+*/
+vp8l_decoder* vp8l_new_from_bytes(const void* data, size_t size);
+
+unsigned vp8l_get_width(const vp8l_decoder* dec);
+unsigned vp8l_get_height(const vp8l_decoder* dec);
+
+/*
+Decode the next row.
+Returns width ARGB pixels, valid until the next call, or NULL if the data
+is corrupted or all rows have been decoded.
+*/
+const uint32_t* vp8l_next_row(vp8l_decoder* dec);
+
+void vp8l_free(vp8l_decoder* dec);
+
+#endif /*defined(VP8L_H)*/